@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmark of the per frame tunnel code, without any sockets involved:
+//   frame:   building the tunnel headers in front of captured frames, as the receiver does
+//   deframe: splitting the received stream into frames, as StreamGroup::recvBatch does
+// Frame size 0 selects a mix of 64, 594 and 1518 byte frames (7:4:1), read size 0
+// selects random read sizes, so packets are split at arbitrary positions.
+// Besides the usual Google Benchmark output, ns/frame and bytes/cycle are reported.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "deframer.hpp"
+#include "frame.hpp"
+#include "tunnel.hpp"
+
+static const size_t   HEADER_LEN  = sizeof (TunnelHeader);
+static const size_t   BATCH_SIZE  = 64;
+static const size_t   BATCHES     = 16;
+static const uint32_t MIN_FRAME   = 64;
+static const uint32_t MAX_PAYLOAD = 65535;
+static const size_t   RING_SIZE   = 1 << 20;
+static const size_t   MAX_READ    = 65536;
+static const uint32_t IMIX[12]    = {64, 64, 64, 64, 64, 64, 64, 594, 594, 594, 594, 1518};
+
+
+// TSC ticks, which run at the nominal and not the current clock frequency
+static uint64_t cycles ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc ();
+#else
+    return 0;
+#endif
+}
+
+static uint32_t frameSize (int64_t size, std::mt19937& rng)
+{
+    return size ? (uint32_t)size : IMIX[rng () % 12];
+}
+
+// time and cycles spent in the benchmark loop
+class Measurement
+{
+public:
+    Measurement () :
+        m_start (std::chrono::steady_clock::now ()),
+        m_cycles (cycles ())
+    {
+    }
+
+    void report (benchmark::State& state, uint64_t frames, uint64_t bytes) const
+    {
+        const uint64_t c = cycles () - m_cycles;
+        const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now () - m_start).count ();
+
+        state.SetItemsProcessed ((int64_t)frames);
+        state.SetBytesProcessed ((int64_t)bytes);
+        if (frames)
+            state.counters["ns/frame"] = ns / (double)frames;
+        if (c)
+            state.counters["bytes/cycle"] = (double)bytes / (double)c;
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_cycles;
+};
+
+static void frame (benchmark::State& state)
+{
+    const int64_t size = state.range (0);
+
+    // captured frames with room for the tunnel header in front of each one, like the
+    // raw socket delivers them
+    const size_t stride = (HEADER_LEN + std::max<size_t> ((size_t)size, 1518) + 63) & ~(size_t)63;
+    std::vector<uint8_t> buffer (BATCHES * BATCH_SIZE * stride);
+    std::vector<Frame> frames (BATCHES * BATCH_SIZE);
+    std::mt19937 rng (1);
+    for (size_t n = 0; n < frames.size (); n++)
+    {
+        frames[n].data = &buffer[n * stride + HEADER_LEN];
+        frames[n].len  = frameSize (size, rng);
+    }
+
+    Frame packets[BATCH_SIZE];
+    uint64_t frameCount = 0;
+    uint64_t bytes = 0;
+    size_t batch = 0;
+    Measurement measurement;
+    for (auto _ : state)
+    {
+        const Frame* f = &frames[batch * BATCH_SIZE];
+        batch = (batch + 1) % BATCHES;
+        for (size_t n = 0; n < BATCH_SIZE; n++)
+        {
+            packets[n].data = (uint8_t*)TunnelHeader::packet (f[n].data - HEADER_LEN, (uint32_t)f[n].len);
+            packets[n].len  = HEADER_LEN + f[n].len;
+            bytes += packets[n].len;
+        }
+        benchmark::DoNotOptimize (packets);
+        benchmark::ClobberMemory ();
+        frameCount += BATCH_SIZE;
+    }
+    measurement.report (state, frameCount, bytes);
+}
+
+// Fills the whole ring with packets, without committing them. The stream then repeats
+// itself with a period of the ring size and can be committed over and over again, so
+// only the parsing is measured and not copying the data into the ring.
+static void fillRing (Deframer& deframer, int64_t size)
+{
+    uint8_t* p = deframer.writePtr ();
+    size_t remaining = deframer.size ();
+    std::mt19937 rng (1);
+    while (remaining)
+    {
+        uint32_t len = frameSize (size, rng);
+        // the last packet takes the rest
+        if (remaining < 2 * HEADER_LEN + len + MIN_FRAME)
+            len = (uint32_t)(remaining - HEADER_LEN);
+        TunnelHeader::packet (p, len);
+        p += HEADER_LEN + len;
+        remaining -= HEADER_LEN + len;
+    }
+}
+
+static void deframe (benchmark::State& state)
+{
+    const int64_t size = state.range (0);
+    const int64_t readSize = state.range (1);
+
+    Deframer deframer (RING_SIZE, MAX_PAYLOAD);
+    fillRing (deframer, size);
+
+    std::vector<size_t> reads (1024);
+    std::mt19937 rng (2);
+    for (auto& r : reads)
+        r = readSize ? (size_t)readSize : 1 + rng () % MAX_READ;
+
+    Frame frames[BATCH_SIZE];
+    uint64_t frameCount = 0;
+    uint64_t bytes = 0;
+    size_t read = 0;
+    Measurement measurement;
+    for (auto _ : state)
+    {
+        // one receive call, then all complete packets are handed out in batches
+        const size_t len = std::min (reads[read++ % reads.size ()], deframer.writable ());
+        deframer.commit (len);
+        bytes += len;
+
+        size_t n = 0;
+        const TunnelHeader* header;
+        while ((header = deframer.next ()) != nullptr)
+        {
+            if (!header->isPacket () || !header->getLength ())
+                continue;
+            frames[n].data = (uint8_t*)header->payload ();
+            frames[n].len  = header->getLength ();
+            if (++n == BATCH_SIZE)
+            {
+                benchmark::DoNotOptimize (frames);
+                frameCount += n;
+                n = 0;
+            }
+        }
+        benchmark::DoNotOptimize (frames);
+        frameCount += n;
+        deframer.release ();
+    }
+    measurement.report (state, frameCount, bytes);
+}
+
+BENCHMARK (frame)->ArgName ("size")->Arg (64)->Arg (1500)->Arg (9000)->Arg (0);
+BENCHMARK (deframe)->ArgNames ({"size", "read"})->ArgsProduct ({{64, 1500, 9000, 0}, {1448, 65536, 0}});
+
+BENCHMARK_MAIN ();
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_WINDOWS
+#include <Winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include <cstring>
+
+#include "addrinfo.hpp"
+#include "socketexception.hpp"
+
+
+AddrInfo::AddrInfo (const struct addrinfo& info)
+{
+    family = info.ai_family;
+    socktype = info.ai_socktype;
+    protocol = info.ai_protocol;
+    addrlen = info.ai_addrlen;
+    std::memcpy (&addr, info.ai_addr, addrlen);
+}
+
+std::string ipToString (const struct sockaddr* addr)
+{
+    const char* ret = "";
+    if (addr->sa_family == AF_INET)
+    {
+        char ip[INET_ADDRSTRLEN];
+        ret = ::inet_ntop(AF_INET, &((struct sockaddr_in *)addr)->sin_addr , ip, sizeof(ip));
+    }
+    if (addr->sa_family == AF_INET6)
+    {
+        char ip[INET6_ADDRSTRLEN];
+        ret = ::inet_ntop(AF_INET6, &((struct sockaddr_in6 *)addr)->sin6_addr , ip, sizeof(ip));
+    }
+
+    if (!ret)
+        throw SocketException ();
+
+    return ret;
+}
+
+void getaddrinfo (const std::string& node, uint16_t remotePort,
+    int family, int sockType, int protocol, std::list<AddrInfo>& result)
+{
+    struct addrinfo hints;
+    struct addrinfo *res, *rp;
+
+    std::memset (&hints, 0, sizeof (hints));
+    hints.ai_family   = family;
+    hints.ai_socktype = sockType;
+    hints.ai_protocol = protocol;
+    result.clear ();
+
+    int s = ::getaddrinfo (node.c_str (),
+        sockType != SOCK_RAW ? std::to_string(remotePort).c_str() : NULL,
+        &hints, &res);
+    if (s != 0)
+    {
+        throw SocketException (gai_strerror(s));
+    }
+    for (rp = res; rp != NULL; rp = rp->ai_next)
+    {
+        result.emplace_back (*rp);
+    }
+    freeaddrinfo (res);
+}
+
+uint16_t portOf (const struct sockaddr* addr)
+{
+    // the port is at the same offset for IPv4 and IPv6
+    return ntohs (((const struct sockaddr_in6*)addr)->sin6_port);
+}
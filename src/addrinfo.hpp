@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADDRINFO_HPP
+#define ADDRINFO_HPP
+
+#if HAVE_WINDOWS
+#include <Winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#endif
+
+#include <string>
+#include <list>
+#include <cstdint>
+
+// resolved address, shared by the TCP and UDP sockets
+struct AddrInfo
+{
+    AddrInfo (const struct addrinfo& info);
+
+    int              family;
+    int              socktype;
+    int              protocol;
+    socklen_t        addrlen;
+    struct sockaddr_storage  addr;
+};
+
+void getaddrinfo (const std::string& node, uint16_t remotePort,
+    int family, int sockType, int protocol, std::list<AddrInfo> &result);
+std::string ipToString (const struct sockaddr* addr);
+uint16_t portOf (const struct sockaddr* addr);
+
+#endif
@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+
+#include "capturefilter.hpp"
+
+// number of bytes of an accepted frame passed to the socket, i.e. everything
+static const uint32_t ACCEPT = 0x40000;
+static const uint32_t DROP   = 0;
+
+// jump targets which are resolved when a term or rule is complete
+static const uint8_t TERM_OK   = 0xfe;
+static const uint8_t TERM_FAIL = 0xff;
+// longest jump of a conditional instruction
+static const size_t MAX_JUMP = 0xfd;
+
+// ------------ local helper functions ------------
+static void compileTerm (std::istringstream& in, const std::string& keyword, std::vector<struct sock_filter>& code);
+static uint32_t parseNumber (const std::string& token, uint32_t max);
+static void parseMac (const std::string& token, uint32_t& high, uint32_t& low);
+static std::string nextToken (std::istringstream& in, const char* expected);
+
+
+std::vector<struct sock_filter> CaptureFilter::compile (const std::string& rules)
+{
+    // commas are tokens on their own
+    std::string text;
+    for (char c : rules)
+    {
+        if (c == ',')
+            text += " , ";
+        else
+            text += c;
+    }
+
+    std::istringstream in (text);
+    std::vector<struct sock_filter> program;
+    bool hasAccept = false;
+    std::string token;
+
+    while (in >> token)
+    {
+        uint32_t action;
+        if (token == "accept")
+            action = ACCEPT;
+        else if (token == "drop")
+            action = DROP;
+        else
+            throw std::invalid_argument ("Filter rule must start with accept or drop instead of '" + token + "'");
+        hasAccept |= action == ACCEPT;
+
+        std::vector<struct sock_filter> rule;
+        while (in >> token && token != ",")
+        {
+            bool negate = false;
+            if (token == "not")
+            {
+                negate = true;
+                token = nextToken (in, "term");
+            }
+
+            std::vector<struct sock_filter> term;
+            compileTerm (in, token, term);
+
+            // TERM_OK continues with the next term, TERM_FAIL leaves the rule
+            for (size_t n = 0; n < term.size (); n++)
+            {
+                for (uint8_t* j : {&term[n].jt, &term[n].jf})
+                {
+                    if (negate && (*j == TERM_OK || *j == TERM_FAIL))
+                        *j = *j == TERM_OK ? TERM_FAIL : TERM_OK;
+                    if (*j == TERM_OK)
+                        *j = (uint8_t)(term.size () - n - 1);
+                }
+            }
+            rule.insert (rule.end (), term.begin (), term.end ());
+        }
+        rule.push_back (BPF_STMT (BPF_RET | BPF_K, action));
+
+        if (rule.size () > MAX_JUMP)
+            throw std::invalid_argument ("Filter rule too long");
+        for (size_t n = 0; n < rule.size (); n++)
+        {
+            for (uint8_t* j : {&rule[n].jt, &rule[n].jf})
+            {
+                if (*j == TERM_FAIL)
+                    *j = (uint8_t)(rule.size () - n - 1);
+            }
+        }
+        program.insert (program.end (), rule.begin (), rule.end ());
+    }
+
+    program.push_back (BPF_STMT (BPF_RET | BPF_K, hasAccept ? DROP : ACCEPT));
+    if (program.size () > BPF_MAXINSNS)
+        throw std::invalid_argument ("Too many filter rules");
+
+    return program;
+}
+
+
+// ------------ local helper functions ------------
+
+void compileTerm (std::istringstream& in, const std::string& keyword, std::vector<struct sock_filter>& code)
+{
+    if (keyword == "type")
+    {
+        uint32_t type = parseNumber (nextToken (in, "EtherType"), 0xffff);
+        code.push_back (BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 12));
+        code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, type, TERM_OK, TERM_FAIL));
+    }
+    else if (keyword == "src" || keyword == "dst")
+    {
+        uint32_t high, low;
+        parseMac (nextToken (in, "MAC address"), high, low);
+        const uint32_t offset = keyword == "src" ? 6 : 0;
+        code.push_back (BPF_STMT (BPF_LD | BPF_W | BPF_ABS, offset));
+        code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, high, 0, TERM_FAIL));
+        code.push_back (BPF_STMT (BPF_LD | BPF_H | BPF_ABS, offset + 4));
+        code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, low, TERM_OK, TERM_FAIL));
+    }
+    else if (keyword == "multicast")
+    {
+        // group bit of the destination, includes broadcast
+        code.push_back (BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 0));
+        code.push_back (BPF_JUMP (BPF_JMP | BPF_JSET | BPF_K, 1, TERM_OK, TERM_FAIL));
+    }
+    else if (keyword == "broadcast")
+    {
+        code.push_back (BPF_STMT (BPF_LD | BPF_W | BPF_ABS, 0));
+        code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 0xffffffff, 0, TERM_FAIL));
+        code.push_back (BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 4));
+        code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 0xffff, TERM_OK, TERM_FAIL));
+    }
+    else if (keyword == "vlan")
+    {
+        const std::string token = nextToken (in, "VLAN id");
+        const bool any = token == "any";
+        const uint32_t id = any ? 0 : parseNumber (token, 0xfff);
+
+        // the tag is either stripped by the driver and available as metadata,
+        // or still in the frame
+        code.push_back (BPF_STMT (BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT)));
+        if (any)
+        {
+            code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 0, 0, TERM_OK));
+            code.push_back (BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 12));
+            code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 0x8100, TERM_OK, 0));
+            code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 0x88a8, TERM_OK, TERM_FAIL));
+        }
+        else
+        {
+            code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 0, 3, 0));
+            code.push_back (BPF_STMT (BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_VLAN_TAG)));
+            code.push_back (BPF_STMT (BPF_ALU | BPF_AND | BPF_K, 0xfff));
+            code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, id, TERM_OK, TERM_FAIL));
+            code.push_back (BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 12));
+            code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 0x8100, 1, 0));
+            code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 0x88a8, 0, TERM_FAIL));
+            code.push_back (BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 14));
+            code.push_back (BPF_STMT (BPF_ALU | BPF_AND | BPF_K, 0xfff));
+            code.push_back (BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, id, TERM_OK, TERM_FAIL));
+        }
+    }
+    else
+    {
+        throw std::invalid_argument ("Unknown filter term '" + keyword + "'");
+    }
+}
+
+uint32_t parseNumber (const std::string& token, uint32_t max)
+{
+    size_t end = 0;
+    unsigned long value = 0;
+    try
+    {
+        value = std::stoul (token, &end, 0);
+    }
+    catch (...)
+    {
+    }
+    if (!end || end != token.size () || value > max)
+        throw std::invalid_argument ("Invalid number '" + token + "' in filter");
+    return (uint32_t)value;
+}
+
+void parseMac (const std::string& token, uint32_t& high, uint32_t& low)
+{
+    unsigned b[6];
+    char rest;
+    if (std::sscanf (token.c_str (), "%2x:%2x:%2x:%2x:%2x:%2x%c", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &rest) != 6)
+        throw std::invalid_argument ("Invalid MAC address '" + token + "' in filter");
+
+    // absolute loads are in network byte order
+    high = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+    low  = (b[4] << 8) | b[5];
+}
+
+std::string nextToken (std::istringstream& in, const char* expected)
+{
+    std::string token;
+    if (!(in >> token) || token == ",")
+        throw std::invalid_argument (std::string ("Filter term incomplete, ") + expected + " expected");
+    return token;
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAPTUREFILTER_HPP
+#define CAPTUREFILTER_HPP
+
+#include <string>
+#include <vector>
+#include <linux/filter.h>
+
+// Compiles capture rules into a classic BPF program for SO_ATTACH_FILTER, so
+// unwanted frames are dropped by the kernel before they are copied to user space.
+//
+//   rules  := rule { "," rule }
+//   rule   := ("accept" | "drop") { ["not"] term }
+//   term   := "type" ETHERTYPE | "vlan" (ID | "any") | "src" MAC | "dst" MAC
+//             | "multicast" | "broadcast"
+//
+// All terms of a rule must match, the first matching rule decides. Frames matching
+// no rule are dropped if there is an accept rule, otherwise they are captured.
+// Example: "drop dst 01:80:c2:00:00:00, accept vlan 10, accept not multicast"
+class CaptureFilter
+{
+public:
+    // throws std::invalid_argument on syntax errors
+    static std::vector<struct sock_filter> compile (const std::string& rules);
+};
+
+#endif
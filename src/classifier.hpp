@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLASSIFIER_HPP
+#define CLASSIFIER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Priority (0 - 7, 7 is highest) of an Ethernet frame, taken from the PCP of the outer
+// VLAN tag or, for untagged frames, from the DSCP of IPv4/IPv6 (class selector bits).
+// Untagged PTP and PROFINET RT frames are network control traffic.
+static inline unsigned framePriority (const uint8_t* frame, size_t len)
+{
+    if (len < 14)
+        return 0;
+
+    const uint16_t type = (uint16_t)(frame[12] << 8 | frame[13]);
+    if ((type == 0x8100 || type == 0x88a8) && len >= 16)
+        return frame[14] >> 5;
+
+    switch (type)
+    {
+    case 0x0800: // IPv4
+        return len >= 16 ? frame[15] >> 5 : 0;
+    case 0x86dd: // IPv6, traffic class spans the first two bytes
+        return len >= 15 ? (frame[14] & 0x0f) >> 1 : 0;
+    case 0x88f7: // PTP
+        return 7;
+    case 0x8892: // PROFINET
+        return 6;
+    default:
+        return 0;
+    }
+}
+
+// Traffic class of a priority, the order of IEEE 802.1Q for 4 queues:
+// 0 network control (6, 7), 1 realtime (4, 5), 2 best effort (0, 2, 3), 3 background (1)
+static inline unsigned trafficClass (unsigned priority)
+{
+    static const uint8_t classes[8] = { 2, 3, 2, 2, 1, 1, 0, 0 };
+    return classes[priority & 7];
+}
+
+#endif
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "coalescer.hpp"
+#include "tcpsocket.hpp"
+#include "compressor.hpp"
+#include "stats.hpp"
+#include "console.hpp"
+#include "bug.hpp"
+
+
+Coalescer::Coalescer (const CoalescerConfig& config, const TcpSocket* socket, Compressor* compressor) :
+    m_config (config),
+    m_socket (socket),
+    m_compressor (compressor),
+    m_buffer (nullptr),
+    m_current (0),
+    m_len (0),
+    m_frames (0),
+    m_flows (0),
+    m_stats (nullptr),
+    m_flushes (),
+    m_batchHistogram (),
+    m_totalFrames (0),
+    m_totalBytes (0),
+    m_pending (),
+    m_nextNotification (0),
+    m_zeroCopySends (0)
+{
+    BUG_ON (!config.maxBytes || !config.maxFrames);
+
+    // the socket must have zero copy enabled
+    m_buffers.reset (new uint8_t[config.maxBytes * (m_config.zeroCopy ? ZEROCOPY_BUFFERS : 1)]);
+    m_buffer = m_buffers.get ();
+}
+
+void Coalescer::add (const void* packet, size_t len, uint64_t flows)
+{
+    // doesn't fit anymore
+    if (m_len + len > m_config.maxBytes)
+        flush (BYTES);
+
+    // larger than the whole buffer, send it directly
+    if (len > m_config.maxBytes)
+    {
+        for (size_t sent = 0; sent < len; )
+            sent += m_socket->send ((const uint8_t*)packet + sent, len - sent);
+        record (1);
+        m_flushes[BYTES]++;
+        m_totalFrames++;
+        m_totalBytes += len;
+        return;
+    }
+
+    if (!m_frames)
+        m_deadline = std::chrono::steady_clock::now () + std::chrono::microseconds (m_config.latency);
+
+    std::memcpy (m_buffer + m_len, packet, len);
+    m_len += len;
+    m_frames++;
+    m_flows |= flows;
+
+    if (m_frames >= m_config.maxFrames)
+        flush (FRAMES);
+    else if (m_len == m_config.maxBytes)
+        flush (BYTES);
+    else if (!timeout ())
+        flush (LATENCY);
+}
+
+void Coalescer::flush ()
+{
+    flush (LATENCY);
+}
+
+void Coalescer::flush (Reason reason)
+{
+    if (!m_frames)
+        return;
+
+    const uint8_t* data = m_buffer;
+    size_t len = m_len;
+    if (m_compressor)
+    {
+        size_t packetLen;
+        const uint8_t* packet = m_compressor->compress (data, len, packetLen, m_flows);
+        if (packet)
+        {
+            data = packet;
+            len  = packetLen;
+        }
+    }
+
+    // compressed batches are in the compressor's buffer, which is reused immediately
+    if (m_config.zeroCopy && data == m_buffer && len >= ZEROCOPY_MIN)
+    {
+        sendZeroCopy (data, len);
+    }
+    else
+    {
+        for (size_t sent = 0; sent < len; )
+            sent += m_socket->send (data + sent, len - sent);
+    }
+
+    record (m_frames);
+    m_flushes[reason]++;
+    m_totalFrames += m_frames;
+    m_totalBytes  += m_len;
+
+    m_len    = 0;
+    m_frames = 0;
+    m_flows  = 0;
+}
+
+void Coalescer::record (unsigned frames)
+{
+    const unsigned bucket = std::min ((unsigned)std::bit_width (frames) - 1, HISTOGRAM_SIZE - 1);
+    m_batchHistogram[bucket]++;
+    if (m_stats)
+    {
+        // only the sending thread records, the counters are not modified atomically
+        std::atomic<uint64_t>& c = m_stats->coalesced[std::min (bucket, StatsSlot::COALESCE_BUCKETS - 1)];
+        c.store (c.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+void Coalescer::sendZeroCopy (const uint8_t* data, size_t len)
+{
+    for (size_t sent = 0; sent < len; )
+    {
+        size_t ret = m_socket->sendZeroCopy (data + sent, len - sent);
+        if (!ret)
+        {
+            // too much memory pinned, wait for the kernel to release some
+            m_socket->waitZeroCopy (1);
+            reapZeroCopy ();
+            continue;
+        }
+        sent += ret;
+        m_nextNotification++;
+        m_zeroCopySends++;
+    }
+    m_pending[m_current].last = m_nextNotification - 1;
+    m_pending[m_current].busy = true;
+
+    // continue with the next buffer, it must have been released by the kernel.
+    // The other thread might reap the notification we wait for, so don't wait forever.
+    m_current = (m_current + 1) % ZEROCOPY_BUFFERS;
+    m_buffer  = m_buffers.get () + m_current * m_config.maxBytes;
+    reapZeroCopy ();
+    while (m_pending[m_current].busy)
+    {
+        m_socket->waitZeroCopy (1);
+        reapZeroCopy ();
+    }
+}
+
+void Coalescer::reapZeroCopy ()
+{
+    const uint32_t completed = m_socket->reapZeroCopy ();
+    for (auto& p : m_pending)
+    {
+        if (p.busy && (int32_t)(completed - p.last) > 0)
+            p.busy = false;
+    }
+}
+
+int Coalescer::timeout () const
+{
+    if (!m_frames)
+        return -1;
+
+    auto remaining = std::chrono::duration_cast<std::chrono::microseconds> (
+        m_deadline - std::chrono::steady_clock::now ()).count ();
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+void Coalescer::printStatistics () const
+{
+    uint64_t flushes = m_flushes[BYTES] + m_flushes[FRAMES] + m_flushes[LATENCY];
+    if (!flushes)
+        return;
+
+    Console::Print ("coalescing: %llu frames, %llu bytes in %llu sends (avg. %.1f frames, %.0f bytes)\n",
+        (unsigned long long)m_totalFrames, (unsigned long long)m_totalBytes, (unsigned long long)flushes,
+        (double)m_totalFrames / flushes, (double)m_totalBytes / flushes);
+    Console::Print ("  flushed by bytes: %llu, frames: %llu, latency: %llu\n",
+        (unsigned long long)m_flushes[BYTES], (unsigned long long)m_flushes[FRAMES],
+        (unsigned long long)m_flushes[LATENCY]);
+    if (m_zeroCopySends)
+        Console::Print ("  zero copy sends: %llu, copied by the kernel: %llu\n",
+            (unsigned long long)m_zeroCopySends, (unsigned long long)m_socket->zeroCopyCopied ());
+    for (unsigned n = 0; n < HISTOGRAM_SIZE; n++)
+    {
+        if (m_batchHistogram[n])
+            Console::Print ("  %6u - %6u frames: %llu\n", 1u << n, (2u << n) - 1,
+                (unsigned long long)m_batchHistogram[n]);
+    }
+}
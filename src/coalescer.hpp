@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COALESCER_HPP
+#define COALESCER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <chrono>
+
+class TcpSocket;
+class Compressor;
+struct StatsSlot;
+
+struct CoalescerConfig
+{
+    size_t   maxBytes;  // flush if the buffered data reaches this size
+    unsigned maxFrames; // flush if this number of frames is buffered
+    int      latency;   // flush at the latest after this time in microseconds, -1 disables coalescing
+    bool     zeroCopy;  // send large batches with MSG_ZEROCOPY, must be enabled on the socket
+
+    CoalescerConfig () :
+        maxBytes (64 * 1024),
+        maxFrames (256),
+        latency (-1),
+        zeroCopy (false)
+    {
+    }
+
+    bool isEnabled () const
+    {
+        return latency >= 0;
+    }
+};
+
+// Collects encapsulated frames and sends them with a single call,
+// whichever threshold is reached first.
+class Coalescer
+{
+public:
+    // the buffered frames are compressed with compressor, if one is given
+    Coalescer (const CoalescerConfig& config, const TcpSocket* socket, Compressor* compressor = nullptr);
+    Coalescer (const Coalescer&) = delete;
+    Coalescer& operator=(const Coalescer&) = delete;
+
+    // append an encapsulated frame (tunnel header + payload), might flush.
+    // flows is the Compressor::flowSet() of the frames in the packet.
+    void add (const void* packet, size_t len, uint64_t flows = 0);
+    void flush ();
+    // the batch sizes are published in the slot as well
+    void setStats (StatsSlot* stats)
+    {
+        m_stats = stats;
+    }
+
+    // remaining time in microseconds until the buffered data must be flushed,
+    // -1 if the buffer is empty
+    int timeout () const;
+
+    void printStatistics () const;
+
+private:
+    enum Reason {BYTES, FRAMES, LATENCY, REASON_COUNT};
+
+    void flush (Reason reason);
+    void record (unsigned frames);
+    void sendZeroCopy (const uint8_t* data, size_t len);
+    void reapZeroCopy ();
+
+    // batches smaller than this are copied, pinning the pages costs more than copying them
+    static const size_t ZEROCOPY_MIN = 16 * 1024;
+    // with zero copy, a buffer is filled while the previous ones are still owned by the kernel
+    static const unsigned ZEROCOPY_BUFFERS = 8;
+
+    CoalescerConfig m_config;
+    const TcpSocket* m_socket;
+    Compressor* m_compressor;
+    std::unique_ptr<uint8_t[]> m_buffers;
+    uint8_t* m_buffer;  // the one currently filled
+    unsigned m_current;
+    size_t   m_len;
+    unsigned m_frames;
+    uint64_t m_flows;
+    std::chrono::steady_clock::time_point m_deadline;
+
+    // statistics
+    static const unsigned HISTOGRAM_SIZE = 16;
+    StatsSlot* m_stats;
+    uint64_t m_flushes[REASON_COUNT];
+    uint64_t m_batchHistogram[HISTOGRAM_SIZE]; // frames per flush, power of two buckets
+    uint64_t m_totalFrames;
+    uint64_t m_totalBytes;
+
+    // zero copy state, notifications are counted per send call
+    struct Pending
+    {
+        uint32_t last; // notification of the last send call from this buffer
+        bool     busy;
+    };
+    Pending  m_pending[ZEROCOPY_BUFFERS];
+    uint32_t m_nextNotification; // the kernel numbers the zero copy send calls of a socket
+    uint64_t m_zeroCopySends;
+};
+
+#endif
@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+#if HAVE_LZ4
+#include <lz4.h>
+#endif
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compressor.hpp"
+#include "console.hpp"
+
+// a batch must shrink at least by this fraction, otherwise it is sent uncompressed
+static const size_t MIN_SAVING = 16;
+// limits of the number of batches skipped in adaptive mode
+static const unsigned MIN_BACKOFF = 8;
+static const unsigned MAX_BACKOFF = 1024;
+
+
+bool Compressor::isSupported (unsigned algorithm)
+{
+    switch (algorithm)
+    {
+#if HAVE_LZ4
+    case CompressedHeader::LZ4:
+        return true;
+#endif
+#if HAVE_ZSTD
+    case CompressedHeader::ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+Compressor::Compressor (const CompressorConfig& config) :
+    m_config (config),
+    m_capacity (0),
+    m_context (nullptr),
+    m_flows (),
+    m_batches (0),
+    m_compressed (0),
+    m_bytesIn (0),
+    m_bytesOut (0)
+{
+    if (!isSupported (config.algorithm))
+        throw std::invalid_argument ("Unsupported compression algorithm");
+
+#if HAVE_LZ4
+    if (config.algorithm == CompressedHeader::LZ4)
+        m_capacity = (size_t)LZ4_compressBound ((int)MAX_BATCH);
+#endif
+#if HAVE_ZSTD
+    if (config.algorithm == CompressedHeader::ZSTD)
+    {
+        m_capacity = ZSTD_compressBound (MAX_BATCH);
+        m_context  = ZSTD_createCCtx ();
+        if (!m_context)
+            throw std::bad_alloc ();
+    }
+#endif
+    m_buffer.reset (new uint8_t[sizeof (TunnelHeader) + sizeof (CompressedHeader) + m_capacity]);
+}
+
+Compressor::~Compressor ()
+{
+#if HAVE_ZSTD
+    ZSTD_freeCCtx ((ZSTD_CCtx*)m_context);
+#endif
+}
+
+// Returns the flows of a batch which are due for a try, the batch is compressed if
+// there is one. So an incompressible flow doesn't stop the compression of the other
+// flows on the same stream. Flows which back off count the batch as skipped.
+uint64_t Compressor::due (uint64_t flows)
+{
+    if (!m_config.adaptive)
+        return flows;
+
+    uint64_t due = 0;
+    for (uint64_t f = flows; f; f &= f - 1)
+    {
+        const unsigned slot = (unsigned)std::countr_zero (f);
+        if (m_flows[slot].skip)
+            m_flows[slot].skip--;
+        else
+            due |= 1ull << slot;
+    }
+    return due;
+}
+
+// only the flows which were due are judged by the result, incompressible
+// ones back off exponentially before they are tried again
+void Compressor::backoff (uint64_t flows, bool compressible)
+{
+    if (!m_config.adaptive)
+        return;
+
+    for (uint64_t f = flows; f; f &= f - 1)
+    {
+        Flow& flow = m_flows[std::countr_zero (f)];
+        flow.backoff = compressible ? 0 : std::min (std::max (flow.backoff * 2, MIN_BACKOFF), MAX_BACKOFF);
+        flow.skip    = flow.backoff;
+    }
+}
+
+const uint8_t* Compressor::compress ([[maybe_unused]] const uint8_t* batch, size_t len, size_t& packetLen, uint64_t flows)
+{
+    m_batches++;
+    m_bytesIn += len;
+
+    flows = due (flows);
+    if (len > MAX_BATCH || !flows)
+    {
+        m_bytesOut += len;
+        return nullptr;
+    }
+
+    [[maybe_unused]] uint8_t* out = m_buffer.get () + sizeof (TunnelHeader) + sizeof (CompressedHeader);
+    size_t compressed = 0;
+#if HAVE_LZ4
+    if (m_config.algorithm == CompressedHeader::LZ4)
+    {
+        compressed = (size_t)LZ4_compress_fast ((const char*)batch, (char*)out, (int)len, (int)m_capacity,
+            std::max (m_config.level, 1));
+    }
+#endif
+#if HAVE_ZSTD
+    if (m_config.algorithm == CompressedHeader::ZSTD)
+    {
+        compressed = ZSTD_compressCCtx ((ZSTD_CCtx*)m_context, out, m_capacity, batch, len, m_config.level);
+        if (ZSTD_isError (compressed))
+            compressed = 0;
+    }
+#endif
+
+    const size_t payloadLen = sizeof (CompressedHeader) + compressed;
+    if (!compressed || payloadLen > len - len / MIN_SAVING)
+    {
+        backoff (flows, false);
+        m_bytesOut += len;
+        return nullptr;
+    }
+    backoff (flows, true);
+
+    TunnelHeader::build (m_buffer.get (), Type::COMPRESSED, (uint32_t)payloadLen);
+    ((CompressedHeader*)(m_buffer.get () + sizeof (TunnelHeader)))->set (
+        (CompressedHeader::Algorithm)m_config.algorithm, (uint32_t)len);
+
+    packetLen = sizeof (TunnelHeader) + payloadLen;
+    m_compressed++;
+    m_bytesOut += packetLen;
+    return m_buffer.get ();
+}
+
+void Compressor::printStatistics () const
+{
+    if (!m_batches)
+        return;
+
+    Console::Print ("compression: %llu of %llu batches compressed, %llu -> %llu bytes (%.1f%%)\n",
+        (unsigned long long)m_compressed, (unsigned long long)m_batches,
+        (unsigned long long)m_bytesIn, (unsigned long long)m_bytesOut,
+        m_bytesIn ? 100.0 * (double)m_bytesOut / (double)m_bytesIn : 100.0);
+}
+
+
+Decompressor::Decompressor () :
+    m_buffer (new uint8_t[Compressor::MAX_BATCH]),
+    m_context (nullptr)
+{
+}
+
+Decompressor::~Decompressor ()
+{
+#if HAVE_ZSTD
+    ZSTD_freeDCtx ((ZSTD_DCtx*)m_context);
+#endif
+}
+
+size_t Decompressor::decompress (const uint8_t* payload, size_t len)
+{
+    if (len < sizeof (CompressedHeader))
+        throw std::runtime_error ("Invalid compressed packet");
+
+    const CompressedHeader* h = (const CompressedHeader*)payload;
+    const size_t rawLen = h->getLength ();
+    if (rawLen > Compressor::MAX_BATCH)
+        throw std::runtime_error ("Compressed batch too large");
+
+    const uint8_t* data = payload + sizeof (CompressedHeader);
+    const size_t dataLen = len - sizeof (CompressedHeader);
+    switch (h->getAlgorithm ())
+    {
+#if HAVE_LZ4
+    case CompressedHeader::LZ4:
+        if (LZ4_decompress_safe ((const char*)data, (char*)m_buffer.get (), (int)dataLen, (int)rawLen) != (int)rawLen)
+            throw std::runtime_error ("Corrupted compressed batch");
+        return rawLen;
+#endif
+#if HAVE_ZSTD
+    case CompressedHeader::ZSTD:
+        if (!m_context && !(m_context = ZSTD_createDCtx ()))
+            throw std::bad_alloc ();
+        if (ZSTD_decompressDCtx ((ZSTD_DCtx*)m_context, m_buffer.get (), rawLen, data, dataLen) != rawLen)
+            throw std::runtime_error ("Corrupted compressed batch");
+        return rawLen;
+#endif
+    default:
+        (void)data;
+        (void)dataLen;
+        throw std::runtime_error ("Unsupported compression algorithm of peer");
+    }
+}
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPRESSOR_HPP
+#define COMPRESSOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "tunnel.hpp"
+
+struct CompressorConfig
+{
+    unsigned algorithm; // CompressedHeader::Algorithm, 0 disables compression
+    int      level;     // zstd level or lz4 acceleration
+    bool     adaptive;  // stop compressing a flow for a while, if its data turns out incompressible
+
+    CompressorConfig () :
+        algorithm (0),
+        level (1),
+        adaptive (true)
+    {
+    }
+
+    bool isEnabled () const
+    {
+        return algorithm != 0;
+    }
+};
+
+// Compresses a batch of encapsulated frames into a single COMPRESSED packet.
+class Compressor
+{
+public:
+    // max. size of the uncompressed batch
+    static constexpr size_t MAX_BATCH = 256 * 1024;
+    // max. payload of a COMPRESSED packet, it is only sent if it is smaller than the batch
+    static constexpr size_t MAX_PAYLOAD = sizeof (CompressedHeader) + MAX_BATCH;
+
+    static bool isSupported (unsigned algorithm);
+
+    // Set of flows in a batch, the adaptive mode tracks the flows by their flowHash().
+    // The upper bits are used, the lower ones select the stream.
+    static uint64_t flowSet (uint32_t hash)
+    {
+        return 1ull << (hash >> 26);
+    }
+
+    explicit Compressor (const CompressorConfig& config);
+    Compressor (const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+    ~Compressor ();
+
+    // Returns the COMPRESSED packet including its tunnel header or nullptr,
+    // if the batch should be sent as it is. flows is the flowSet() of its frames.
+    const uint8_t* compress (const uint8_t* batch, size_t len, size_t& packetLen, uint64_t flows);
+
+    void printStatistics () const;
+
+private:
+    static const unsigned FLOW_SLOTS = 64;
+
+    uint64_t due (uint64_t flows);
+    void backoff (uint64_t flows, bool compressible);
+
+    CompressorConfig m_config;
+    size_t   m_capacity;
+    std::unique_ptr<uint8_t[]> m_buffer;
+    void*    m_context;
+
+    // adaptive mode: number of batches of a flow to send uncompressed before the next try
+    struct Flow
+    {
+        unsigned skip;
+        unsigned backoff;
+    };
+    Flow m_flows[FLOW_SLOTS];
+
+    // statistics
+    uint64_t m_batches;
+    uint64_t m_compressed;
+    uint64_t m_bytesIn;
+    uint64_t m_bytesOut;
+};
+
+// Decompresses COMPRESSED packets into an internal buffer, the packets are
+// parsed from there in place.
+class Decompressor
+{
+public:
+    Decompressor ();
+    Decompressor (const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+    ~Decompressor ();
+
+    // returns the length of the decompressed packets at data(),
+    // throws std::runtime_error on corrupted or unsupported data
+    size_t decompress (const uint8_t* payload, size_t len);
+    uint8_t* data () const
+    {
+        return m_buffer.get ();
+    }
+
+private:
+    std::unique_ptr<uint8_t[]> m_buffer;
+    void* m_context;
+};
+
+#endif
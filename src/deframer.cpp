@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include "deframer.hpp"
+#include "bug.hpp"
+
+
+Deframer::Deframer (size_t size, uint32_t maxPayload) :
+    m_buffer (nullptr),
+    m_size (0),
+    m_mask (0),
+    m_maxPayload (maxPayload),
+    m_read (0),
+    m_parse (0),
+    m_write (0)
+{
+    // power of two, so that positions can be masked, and large enough to hold at least two packets
+    const size_t pageSize = (size_t)sysconf (_SC_PAGESIZE);
+    const size_t minSize = 2 * (sizeof (TunnelHeader) + maxPayload);
+    m_size = pageSize;
+    while (m_size < size || m_size < minSize)
+        m_size <<= 1;
+    m_mask = m_size - 1;
+
+    int fd = memfd_create ("l2tun-deframer", MFD_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error (errno, std::generic_category(), "memfd_create");
+
+    if (ftruncate (fd, (off_t)m_size))
+    {
+        int error = errno;
+        ::close (fd);
+        throw std::system_error (error, std::generic_category(), "ftruncate");
+    }
+
+    // reserve address space for both mappings, then map the same memory twice into it
+    void* base = ::mmap (nullptr, 2 * m_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED
+        || ::mmap (base, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || ::mmap ((uint8_t*)base + m_size, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        int error = errno;
+        if (base != MAP_FAILED)
+            ::munmap (base, 2 * m_size);
+        ::close (fd);
+        throw std::system_error (error, std::generic_category(), "mmap");
+    }
+
+    // the mappings keep the memory alive
+    ::close (fd);
+    m_buffer = (uint8_t*)base;
+}
+
+Deframer::~Deframer ()
+{
+    ::munmap (m_buffer, 2 * m_size);
+}
+
+void Deframer::commit (size_t len)
+{
+    BUG_ON (len > writable ());
+    m_write += len;
+}
+
+const TunnelHeader* Deframer::next ()
+{
+    const size_t available = (size_t)(m_write - m_parse);
+    if (available < sizeof (TunnelHeader))
+        return nullptr;
+
+    const TunnelHeader* header = (const TunnelHeader*)(m_buffer + (m_parse & m_mask));
+    const uint32_t payloadLen = header->getLength ();
+    if (payloadLen > m_maxPayload)
+        throw std::length_error ("Length exceeds MTU of interface");
+
+    if (available < sizeof (TunnelHeader) + payloadLen)
+        return nullptr;
+
+    m_parse += sizeof (TunnelHeader) + payloadLen;
+    return header;
+}
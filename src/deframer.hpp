@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEFRAMER_HPP
+#define DEFRAMER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "tunnel.hpp"
+
+// Splits the tunnel byte stream into packets.
+// The stream is received into a ring buffer which is mapped twice back-to-back,
+// so every packet and every free region is contiguous in memory, regardless of
+// where it starts. Packets are parsed in place, nothing is ever copied or compacted.
+class Deframer
+{
+public:
+    // size is rounded up to a multiple of the page size
+    Deframer (size_t size, uint32_t maxPayload);
+    Deframer (const Deframer&) = delete;
+    Deframer& operator=(const Deframer&) = delete;
+    ~Deframer ();
+
+    // contiguous free space for the next receive call
+    uint8_t* writePtr () const
+    {
+        return m_buffer + (m_write & m_mask);
+    }
+    size_t writable () const
+    {
+        return m_size - (size_t)(m_write - m_read);
+    }
+    // make len bytes written to writePtr() available for parsing
+    void commit (size_t len);
+
+    // returns the next complete packet or nullptr if more data is needed,
+    // throws std::length_error if the payload exceeds maxPayload
+    const TunnelHeader* next ();
+    // all packets returned by next() so far are not used anymore
+    void release ()
+    {
+        m_read = m_parse;
+    }
+
+    // number of received bytes not yet returned by next()
+    size_t pending () const
+    {
+        return (size_t)(m_write - m_parse);
+    }
+    size_t size () const
+    {
+        return m_size;
+    }
+
+private:
+    uint8_t* m_buffer;
+    size_t   m_size;
+    size_t   m_mask;
+    uint32_t m_maxPayload;
+
+    // stream positions, they only grow and are reduced modulo size when accessing the buffer
+    uint64_t m_read;  // start of the oldest packet still in use
+    uint64_t m_parse; // start of the next packet to be parsed
+    uint64_t m_write; // end of the received data
+};
+
+#endif
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLOWHASH_HPP
+#define FLOWHASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Hash over the addresses of an Ethernet frame and, if present, over the IPv4/IPv6
+// addresses and TCP/UDP/SCTP ports. All frames of a flow get the same value.
+static inline uint32_t flowHash (const uint8_t* frame, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash] (const uint8_t* p, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            hash ^= p[i];
+            hash *= 16777619u;
+        }
+    };
+
+    if (len < 14)
+        return hash;
+
+    // MAC addresses
+    mix (frame, 12);
+
+    // skip VLAN tags
+    size_t off = 12;
+    uint16_t type = (uint16_t)(frame[off] << 8 | frame[off + 1]);
+    while ((type == 0x8100 || type == 0x88a8) && len >= off + 6)
+    {
+        off += 4;
+        type = (uint16_t)(frame[off] << 8 | frame[off + 1]);
+    }
+    off += 2;
+
+    uint8_t proto = 0;
+    size_t l4 = 0;
+    if (type == 0x0800 && len >= off + 20)
+    {
+        const uint8_t* ip = frame + off;
+        proto = ip[9];
+        mix (ip + 12, 8);
+        // fragments don't have ports, so ignore them for all fragments of a datagram
+        if (!(ip[6] & 0x3f) && !ip[7])
+            l4 = off + (ip[0] & 0x0f) * 4;
+    }
+    else if (type == 0x86dd && len >= off + 40)
+    {
+        const uint8_t* ip = frame + off;
+        proto = ip[6];
+        mix (ip + 8, 32);
+        l4 = off + 40;
+    }
+    else
+    {
+        mix (frame + off - 2, 2);
+        return hash;
+    }
+
+    mix (&proto, 1);
+    // TCP, UDP, SCTP: source and destination port
+    if (l4 && (proto == 6 || proto == 17 || proto == 132) && len >= l4 + 4)
+        mix (frame + l4, 4);
+
+    return hash;
+}
+
+#endif
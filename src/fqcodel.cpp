@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctime>
+#include <cmath>
+
+#include "fqcodel.hpp"
+#include "flowhash.hpp"
+#include "console.hpp"
+
+
+FqCodel::FqCodel (const FqCodelConfig& config) :
+    m_config (config),
+    m_entries (config.limit),
+    m_flows (config.flows),
+    m_free (0),
+    m_size (0),
+    m_frames (0),
+    m_codelDrops (0),
+    m_overlimitDrops (0),
+    m_maxSize (0)
+{
+    for (size_t n = 0; n < m_entries.size (); n++)
+        m_entries[n].next = n + 1 < m_entries.size () ? (uint32_t)(n + 1) : NONE;
+    for (auto& f : m_flows)
+    {
+        f.head       = NONE;
+        f.tail       = NONE;
+        f.backlog    = 0;
+        f.deficit    = 0;
+        f.next       = NONE;
+        f.active     = false;
+        f.dropping   = false;
+        f.firstAbove = 0;
+        f.dropNext   = 0;
+        f.count      = 0;
+        f.lastCount  = 0;
+    }
+}
+
+uint64_t FqCodel::now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void FqCodel::enqueue (FrameRef&& frame, uint64_t now)
+{
+    if (m_free == NONE)
+        dropLongest ();
+
+    const Frame f = frame.frame ();
+    const uint32_t index = (uint32_t)(flowHash (f.data, f.len) % m_flows.size ());
+    Flow& flow = m_flows[index];
+
+    const uint32_t e = m_free;
+    m_free = m_entries[e].next;
+    m_entries[e].frame = std::move (frame);
+    m_entries[e].time  = now;
+    m_entries[e].next  = NONE;
+    if (flow.tail == NONE)
+        flow.head = e;
+    else
+        m_entries[flow.tail].next = e;
+    flow.tail = e;
+    flow.backlog += f.len;
+
+    if (!flow.active)
+    {
+        flow.active  = true;
+        flow.deficit = m_config.quantum;
+        append (m_new, index);
+    }
+
+    m_frames++;
+    if (++m_size > m_maxSize)
+        m_maxSize = m_size;
+}
+
+size_t FqCodel::dequeue (FrameRef* frames, size_t count, size_t bytes, uint64_t now)
+{
+    size_t n = 0;
+    size_t sent = 0;
+    while (n < count && sent < bytes)
+    {
+        FlowList* list = m_new.head != NONE ? &m_new : &m_old;
+        if (list->head == NONE)
+            break;
+
+        const uint32_t index = list->head;
+        Flow& flow = m_flows[index];
+        if (flow.deficit <= 0)
+        {
+            flow.deficit += m_config.quantum;
+            removeHead (*list);
+            append (m_old, index);
+            continue;
+        }
+
+        const uint32_t e = codelDequeue (flow, now);
+        if (e == NONE)
+        {
+            // a new flow gets one more round as an old flow, so that it can't starve the others
+            // by going empty and coming back as new flow
+            removeHead (*list);
+            if (list == &m_new && m_old.head != NONE)
+                append (m_old, index);
+            else
+                flow.active = false;
+            continue;
+        }
+
+        const size_t len = m_entries[e].frame.frame ().len;
+        flow.deficit -= (int64_t)len;
+        sent += len;
+        frames[n++] = std::move (m_entries[e].frame);
+        release (e);
+    }
+    return n;
+}
+
+void FqCodel::printStatistics () const
+{
+    Console::Print ("fq_codel: %llu frames, %llu dropped by codel, %llu dropped over limit, max. %zu of %zu queued\n",
+        (unsigned long long)m_frames, (unsigned long long)m_codelDrops, (unsigned long long)m_overlimitDrops,
+        m_maxSize, m_entries.size ());
+}
+
+// removes the head entry of the flow, the caller frees it
+uint32_t FqCodel::pop (Flow& flow)
+{
+    const uint32_t e = flow.head;
+    if (e == NONE)
+        return NONE;
+
+    flow.head = m_entries[e].next;
+    if (flow.head == NONE)
+        flow.tail = NONE;
+    flow.backlog -= m_entries[e].frame.frame ().len;
+    m_size--;
+    return e;
+}
+
+// RFC 8289
+uint32_t FqCodel::codelDequeue (Flow& flow, uint64_t now)
+{
+    uint32_t e = pop (flow);
+    bool ok = okToDrop (flow, e, now);
+
+    if (flow.dropping)
+    {
+        if (!ok)
+            flow.dropping = false;
+        while (flow.dropping && now >= flow.dropNext)
+        {
+            release (e);
+            m_codelDrops++;
+            flow.count++;
+            e  = pop (flow);
+            ok = okToDrop (flow, e, now);
+            if (!ok)
+                flow.dropping = false;
+            else
+                flow.dropNext = controlLaw (flow.dropNext, flow.count);
+        }
+    }
+    else if (ok)
+    {
+        release (e);
+        m_codelDrops++;
+        e  = pop (flow);
+        ok = okToDrop (flow, e, now);
+        flow.dropping = true;
+
+        // continue with the drop rate of the last dropping state, if it ended recently
+        const uint32_t delta = flow.count - flow.lastCount;
+        if (delta > 1 && now - flow.dropNext < 16 * (uint64_t)m_config.interval)
+            flow.count = delta;
+        else
+            flow.count = 1;
+        flow.lastCount = flow.count;
+        flow.dropNext  = controlLaw (now, flow.count);
+    }
+    return e;
+}
+
+bool FqCodel::okToDrop (Flow& flow, uint32_t entry, uint64_t now)
+{
+    if (entry == NONE)
+    {
+        flow.firstAbove = 0;
+        return false;
+    }
+
+    const uint64_t sojourn = now - m_entries[entry].time;
+    if (sojourn < m_config.target || flow.backlog <= m_config.mtu)
+    {
+        flow.firstAbove = 0;
+        return false;
+    }
+    if (!flow.firstAbove)
+    {
+        flow.firstAbove = now + m_config.interval;
+        return false;
+    }
+    return now >= flow.firstAbove;
+}
+
+void FqCodel::release (uint32_t entry)
+{
+    m_entries[entry].frame.reset ();
+    m_entries[entry].next = m_free;
+    m_free = entry;
+}
+
+// only the active flows can have a backlog
+void FqCodel::dropLongest ()
+{
+    Flow* longest = nullptr;
+    for (const FlowList* list : { &m_new, &m_old })
+    {
+        for (uint32_t i = list->head; i != NONE; i = m_flows[i].next)
+        {
+            if (!longest || m_flows[i].backlog > longest->backlog)
+                longest = &m_flows[i];
+        }
+    }
+
+    const uint32_t e = longest ? pop (*longest) : NONE;
+    if (e != NONE)
+    {
+        release (e);
+        m_overlimitDrops++;
+    }
+}
+
+void FqCodel::append (FlowList& list, uint32_t flow)
+{
+    m_flows[flow].next = NONE;
+    if (list.tail == NONE)
+        list.head = flow;
+    else
+        m_flows[list.tail].next = flow;
+    list.tail = flow;
+}
+
+uint32_t FqCodel::removeHead (FlowList& list)
+{
+    const uint32_t flow = list.head;
+    list.head = m_flows[flow].next;
+    if (list.head == NONE)
+        list.tail = NONE;
+    return flow;
+}
+
+uint64_t FqCodel::controlLaw (uint64_t t, uint32_t count) const
+{
+    return t + (uint64_t)(m_config.interval / std::sqrt ((double)count));
+}
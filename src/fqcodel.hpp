@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FQCODEL_HPP
+#define FQCODEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "framepool.hpp"
+
+struct FqCodelConfig
+{
+    uint32_t target;   // acceptable standing delay in microseconds, 0 disables fq_codel
+    uint32_t interval; // microseconds the delay may stay above target before frames are dropped
+    unsigned flows;    // number of flow queues
+    size_t   limit;    // max. number of frames in all flow queues
+    unsigned quantum;  // bytes a flow may send per round
+    unsigned burst;    // bytes dequeued at once, also the unsent data the socket may keep
+    size_t   mtu;      // max. frame length, a flow whose backlog fits into one frame is never dropped from
+
+    FqCodelConfig () :
+        target (0),
+        interval (100000),
+        flows (1024),
+        limit (1024),
+        quantum (1514),
+        burst (16384),
+        mtu (1514)
+    {
+    }
+
+    bool isEnabled () const
+    {
+        return target > 0;
+    }
+};
+
+// Fair queuing of flows with CoDel on each flow queue (RFC 8290). Frames are distributed
+// by their flow hash, new flows are served first and all others by deficit round robin.
+// A flow whose frames stay longer than target in the queue for an interval gets frames
+// dropped at an increasing rate, until its delay is below target again.
+// Not thread safe, it is used by the thread sending into the tunnel.
+class FqCodel
+{
+public:
+    explicit FqCodel (const FqCodelConfig& config);
+    FqCodel (const FqCodel&) = delete;
+    FqCodel& operator=(const FqCodel&) = delete;
+
+    // monotonic time in microseconds
+    static uint64_t now ();
+
+    // if the limit is reached, the oldest frame of the longest flow queue is dropped
+    void enqueue (FrameRef&& frame, uint64_t now);
+    // takes up to count frames, stops after bytes (at least one frame)
+    size_t dequeue (FrameRef* frames, size_t count, size_t bytes, uint64_t now);
+
+    bool empty () const
+    {
+        return !m_size;
+    }
+    size_t size () const
+    {
+        return m_size;
+    }
+
+    void printStatistics () const;
+
+private:
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct Entry
+    {
+        FrameRef frame;
+        uint64_t time; // of enqueue
+        uint32_t next;
+    };
+
+    struct Flow
+    {
+        uint32_t head;
+        uint32_t tail;
+        size_t   backlog; // bytes
+        int64_t  deficit;
+        uint32_t next;    // in the new or old list
+        bool     active;  // in one of the lists
+
+        // CoDel state
+        bool     dropping;
+        uint64_t firstAbove; // time the delay must stay above target until dropping starts
+        uint64_t dropNext;
+        uint32_t count;      // drops since dropping started
+        uint32_t lastCount;
+    };
+
+    struct FlowList
+    {
+        uint32_t head = NONE;
+        uint32_t tail = NONE;
+    };
+
+    uint32_t pop (Flow& flow);
+    uint32_t codelDequeue (Flow& flow, uint64_t now);
+    bool okToDrop (Flow& flow, uint32_t entry, uint64_t now);
+    void release (uint32_t entry);
+    void dropLongest ();
+    void append (FlowList& list, uint32_t flow);
+    uint32_t removeHead (FlowList& list);
+    uint64_t controlLaw (uint64_t t, uint32_t count) const;
+
+    FqCodelConfig m_config;
+    std::vector<Entry> m_entries;
+    std::vector<Flow>  m_flows;
+    uint32_t m_free;  // list of unused entries
+    size_t   m_size;
+    FlowList m_new;
+    FlowList m_old;
+
+    uint64_t m_frames;
+    uint64_t m_codelDrops;
+    uint64_t m_overlimitDrops;
+    size_t   m_maxSize;
+};
+
+#endif
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include "framepool.hpp"
+#include "console.hpp"
+#include "bug.hpp"
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// ------------ local helper functions ------------
+static void preferLocalNode (void* memory, size_t size);
+
+
+FramePool::FramePool (const FramePoolConfig& config, uint8_t* memory, size_t memorySize, bool hugePages) :
+    m_memory (memory),
+    m_memorySize (memorySize),
+    m_bufferSize ((config.bufferSize + 63) & ~(size_t)63),
+    m_count (config.count),
+    m_hugePages (hugePages),
+    m_slots (new Slot[config.count]),
+    m_released (NONE),
+    m_free (NONE),
+    m_allocs (0),
+    m_exhausted (0)
+{
+    for (unsigned n = config.count; n--; )
+    {
+        m_slots[n].refs.store (0, std::memory_order_relaxed);
+        m_slots[n].next   = m_free;
+        m_slots[n].offset = 0;
+        m_slots[n].len    = 0;
+        m_slots[n].time   = 0;
+        m_slots[n].gso    = false;
+        m_free = n;
+    }
+}
+
+FramePool::~FramePool ()
+{
+    ::munmap (m_memory, m_memorySize);
+}
+
+std::unique_ptr<FramePool> FramePool::create (const FramePoolConfig& config)
+{
+    BUG_ON (!config.count || !config.bufferSize);
+
+    const size_t bufferSize = (config.bufferSize + 63) & ~(size_t)63;
+    size_t size = bufferSize * config.count;
+    void* memory = MAP_FAILED;
+    bool hugePages = false;
+    if (config.hugePages)
+    {
+        const size_t hugeSize = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        memory = ::mmap (nullptr, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED)
+        {
+            size = hugeSize;
+            hugePages = true;
+        }
+        else
+        {
+            Console::PrintVerbose ("No huge pages available for the frame pool\n");
+        }
+    }
+    if (memory == MAP_FAILED)
+        memory = ::mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::system_error (errno, std::generic_category(), "mmap");
+
+    // the pages are faulted in now, so they are allocated on the preferred node
+    // and the data path doesn't take page faults
+    preferLocalNode (memory, size);
+    const size_t page = hugePages ? HUGE_PAGE_SIZE : (size_t)::sysconf (_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += page)
+        ((volatile uint8_t*)memory)[offset] = 0;
+
+    return std::unique_ptr<FramePool> (new FramePool (config, (uint8_t*)memory, size, hugePages));
+}
+
+FrameRef FramePool::alloc ()
+{
+    if (m_free == NONE)
+    {
+        // take all buffers released by other threads at once
+        m_free = m_released.exchange (NONE, std::memory_order_acquire);
+        if (m_free == NONE)
+        {
+            m_exhausted++;
+            return FrameRef ();
+        }
+    }
+
+    const uint32_t index = m_free;
+    m_free = m_slots[index].next;
+    m_slots[index].refs.store (1, std::memory_order_relaxed);
+    m_slots[index].offset = 0;
+    m_slots[index].len    = 0;
+    m_slots[index].time   = 0;
+    m_slots[index].gso    = false;
+    m_allocs++;
+    return FrameRef (this, index);
+}
+
+FrameRef FramePool::copy (const Frame& frame, size_t headroom, size_t prefix)
+{
+    BUG_ON (prefix > headroom || headroom + frame.len > m_bufferSize);
+
+    FrameRef ref = alloc ();
+    if (ref)
+    {
+        std::memcpy (ref.buffer () + headroom - prefix, frame.data - prefix, prefix + frame.len);
+        ref.setFrame (headroom, frame.len);
+    }
+    return ref;
+}
+
+// Only the owner pops from the released list, and it takes the whole list.
+// So a pushed index can't be taken and pushed again during a push (no ABA).
+void FramePool::release (uint32_t index)
+{
+    uint32_t head = m_released.load (std::memory_order_relaxed);
+    do
+    {
+        m_slots[index].next = head;
+    } while (!m_released.compare_exchange_weak (head, index, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void FramePool::printStatistics () const
+{
+    Console::Print ("frame pool: %u buffers of %zu bytes%s, %llu allocations, %llu times exhausted\n",
+        m_count, m_bufferSize, m_hugePages ? " (huge pages)" : "",
+        (unsigned long long)m_allocs, (unsigned long long)m_exhausted);
+}
+
+
+// ------------ local helper functions ------------
+
+// best effort, without NUMA support the pages are simply where they are faulted in
+void preferLocalNode (void* memory, size_t size)
+{
+    unsigned cpu, node;
+    if (::syscall (SYS_getcpu, &cpu, &node, nullptr) || node >= 64)
+        return;
+
+    const unsigned long nodemask = 1ul << node;
+    if (::syscall (SYS_mbind, memory, size, MPOL_PREFERRED, &nodemask, 64ul, 0u))
+        Console::PrintDebug ("mbind failed: %s\n", std::strerror (errno));
+}
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEPOOL_HPP
+#define FRAMEPOOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "frame.hpp"
+
+class FramePool;
+
+struct FramePoolConfig
+{
+    unsigned count;      // number of buffers
+    size_t   bufferSize; // rounded up to a multiple of the cache line size
+    bool     hugePages;  // back the pool with huge pages, falls back to normal pages
+
+    FramePoolConfig () :
+        count (1024),
+        bufferSize (2048),
+        hugePages (false)
+    {
+    }
+};
+
+// Reference counted handle of a pool buffer holding one frame. Copying a handle
+// only increments the counter, the buffer returns to the pool when the last
+// handle is gone. Handles may be passed to and released by other threads.
+class FrameRef
+{
+public:
+    FrameRef () : m_pool (nullptr), m_index (0) {}
+    FrameRef (const FrameRef& obj);
+    FrameRef (FrameRef&& obj) : m_pool (obj.m_pool), m_index (obj.m_index)
+    {
+        obj.m_pool = nullptr;
+    }
+    FrameRef& operator=(const FrameRef& obj);
+    FrameRef& operator=(FrameRef&& obj);
+    ~FrameRef ()
+    {
+        reset ();
+    }
+
+    void reset ();
+    explicit operator bool () const
+    {
+        return m_pool != nullptr;
+    }
+    // other handles of the buffer exist
+    bool isShared () const;
+
+    // the whole buffer
+    uint8_t* buffer () const;
+    size_t size () const;
+    // the frame stored in the buffer
+    Frame frame () const;
+    void setFrame (size_t offset, size_t len);
+    // time the frame was received, set by its owner
+    uint64_t time () const;
+    void setTime (uint64_t time);
+    // the frame is preceded by its GsoHeader, set by its owner
+    bool isGso () const;
+    void setGso (bool gso);
+
+private:
+    friend class FramePool;
+    FrameRef (FramePool* pool, uint32_t index) : m_pool (pool), m_index (index) {}
+
+    FramePool* m_pool;
+    uint32_t   m_index;
+};
+
+// Fixed number of equally sized frame buffers in one memory mapping. The memory
+// is placed on the NUMA node of the creating thread. Buffers are allocated
+// by one thread only (the owner), but may be released by any thread.
+class FramePool
+{
+public:
+    FramePool (const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+    ~FramePool ();
+
+    // throws std::system_error if the memory can't be mapped
+    static std::unique_ptr<FramePool> create (const FramePoolConfig& config);
+
+    // owner thread only, returns an empty handle if all buffers are in use
+    FrameRef alloc ();
+    // allocates a buffer and copies the frame into it, leaving headroom bytes in front.
+    // The last prefix bytes of the headroom are copied from the bytes in front of the frame.
+    FrameRef copy (const Frame& frame, size_t headroom, size_t prefix = 0);
+
+    size_t bufferSize () const
+    {
+        return m_bufferSize;
+    }
+    bool hasHugePages () const
+    {
+        return m_hugePages;
+    }
+
+    void printStatistics () const;
+
+private:
+    friend class FrameRef;
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct Slot
+    {
+        std::atomic<uint32_t> refs;
+        uint32_t next;   // free list
+        uint32_t offset; // of the frame in the buffer
+        uint32_t len;
+        uint64_t time;
+        bool     gso;
+    };
+
+    FramePool (const FramePoolConfig& config, uint8_t* memory, size_t memorySize, bool hugePages);
+    void release (uint32_t index);
+
+    uint8_t* m_memory;
+    size_t   m_memorySize;
+    size_t   m_bufferSize;
+    unsigned m_count;
+    bool     m_hugePages;
+    std::unique_ptr<Slot[]> m_slots;
+
+    // released buffers are pushed by any thread, the owner takes all of them at once
+    alignas (64) std::atomic<uint32_t> m_released;
+    // used by the owner thread only
+    alignas (64) uint32_t m_free;
+    uint64_t m_allocs;
+    uint64_t m_exhausted;
+};
+
+inline FrameRef::FrameRef (const FrameRef& obj) : m_pool (obj.m_pool), m_index (obj.m_index)
+{
+    if (m_pool)
+        m_pool->m_slots[m_index].refs.fetch_add (1, std::memory_order_relaxed);
+}
+
+inline FrameRef& FrameRef::operator=(const FrameRef& obj)
+{
+    if (this != &obj)
+    {
+        FrameRef tmp (obj);
+        *this = std::move (tmp);
+    }
+    return *this;
+}
+
+inline FrameRef& FrameRef::operator=(FrameRef&& obj)
+{
+    if (this != &obj)
+    {
+        reset ();
+        m_pool  = obj.m_pool;
+        m_index = obj.m_index;
+        obj.m_pool = nullptr;
+    }
+    return *this;
+}
+
+inline void FrameRef::reset ()
+{
+    // the last one returns the buffer, acq_rel orders all accesses of the other handles before that
+    if (m_pool && m_pool->m_slots[m_index].refs.fetch_sub (1, std::memory_order_acq_rel) == 1)
+        m_pool->release (m_index);
+    m_pool = nullptr;
+}
+
+inline bool FrameRef::isShared () const
+{
+    return m_pool && m_pool->m_slots[m_index].refs.load (std::memory_order_acquire) > 1;
+}
+
+inline uint8_t* FrameRef::buffer () const
+{
+    return m_pool->m_memory + m_index * m_pool->m_bufferSize;
+}
+
+inline size_t FrameRef::size () const
+{
+    return m_pool->m_bufferSize;
+}
+
+inline Frame FrameRef::frame () const
+{
+    const FramePool::Slot& slot = m_pool->m_slots[m_index];
+    return Frame {buffer () + slot.offset, slot.len};
+}
+
+inline void FrameRef::setFrame (size_t offset, size_t len)
+{
+    FramePool::Slot& slot = m_pool->m_slots[m_index];
+    slot.offset = (uint32_t)offset;
+    slot.len    = (uint32_t)len;
+}
+
+inline uint64_t FrameRef::time () const
+{
+    return m_pool->m_slots[m_index].time;
+}
+
+inline void FrameRef::setTime (uint64_t time)
+{
+    m_pool->m_slots[m_index].time = time;
+}
+
+inline bool FrameRef::isGso () const
+{
+    return m_pool->m_slots[m_index].gso;
+}
+
+inline void FrameRef::setGso (bool gso)
+{
+    m_pool->m_slots[m_index].gso = gso;
+}
+
+#endif
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "framequeue.hpp"
+#include "console.hpp"
+
+
+FrameQueue::Class::Class (size_t depth, int64_t quantum) :
+    queue (depth),
+    quantum (quantum),
+    deficit (quantum),
+    frames (0),
+    drops (0),
+    maxSize (0)
+{
+}
+
+FrameQueue::FrameQueue (const FrameQueueConfig& config) :
+    m_policy (config.policy),
+    m_strict (0),
+    m_current (0),
+    m_closed (false),
+    m_waiting (false),
+    m_wakeup (0)
+{
+    // a quantum of at least one max. sized frame lets every class send after a single top up
+    const int64_t quantum = (int64_t)std::max<size_t> (config.mtu, 1);
+    for (unsigned n = 0; n < config.classes && n < FrameQueueConfig::MAX_CLASSES; n++)
+        m_classes.emplace_back (new Class (config.depth, quantum * (config.weights[n] ? config.weights[n] : 1)));
+    if (m_classes.empty ())
+        m_classes.emplace_back (new Class (config.depth, quantum));
+
+    // at least one class is weighted
+    m_strict  = std::min (config.strict, (unsigned)m_classes.size () - 1);
+    m_current = m_strict;
+}
+
+bool FrameQueue::push (FrameRef&& frame, unsigned cls)
+{
+    Class& c = *m_classes[cls < m_classes.size () ? cls : m_classes.size () - 1];
+
+    bool dropped = false;
+    if (!c.queue.push (std::move (frame)))
+    {
+        // make room by dropping the oldest frame, unless the consumer just took it
+        FrameRef oldest;
+        if (m_policy == FrameQueueConfig::TAIL_DROP || !c.queue.pop (oldest) || !c.queue.push (std::move (frame)))
+            frame.reset ();
+        dropped = true;
+        c.drops.store (c.drops.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    c.frames.store (c.frames.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    const size_t size = c.queue.size ();
+    if (size > c.maxSize.load (std::memory_order_relaxed))
+        c.maxSize.store (size, std::memory_order_relaxed);
+    return !dropped;
+}
+
+void FrameQueue::notify ()
+{
+    // pairs with the fence in pop: either the consumer sees the new frames, or we see it waiting
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (m_waiting.load (std::memory_order_relaxed) && m_waiting.exchange (false))
+        m_wakeup.release ();
+}
+
+size_t FrameQueue::pop (FrameRef* frames, size_t count, int timeout)
+{
+    size_t n = take (frames, count);
+    if (n || !timeout)
+        return n;
+
+    m_waiting.store (true, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    n = take (frames, count);
+    if (!n && !isClosed ())
+    {
+        // a wakeup of an earlier wait might be pending, so this can return early
+        if (timeout < 0)
+            m_wakeup.acquire ();
+        else
+            (void)m_wakeup.try_acquire_for (std::chrono::microseconds (timeout));
+    }
+    m_waiting.store (false, std::memory_order_relaxed);
+
+    return n ? n : take (frames, count);
+}
+
+size_t FrameQueue::take (FrameRef* frames, size_t count)
+{
+    size_t n = 0;
+    for (unsigned cls = 0; cls < m_strict; cls++)
+    {
+        while (n < count && m_classes[cls]->queue.pop (frames[n]))
+            n++;
+    }
+
+    // deficit round robin, a class is charged after a frame was taken, because
+    // the size of the next frame isn't known before
+    const unsigned last = (unsigned)m_classes.size () - 1;
+    unsigned idle = 0;
+    while (n < count && idle <= last - m_strict)
+    {
+        Class& c = *m_classes[m_current];
+        if (c.deficit > 0)
+        {
+            if (c.queue.pop (frames[n]))
+            {
+                c.deficit -= (int64_t)frames[n].frame ().len;
+                n++;
+                idle = 0;
+                continue;
+            }
+            // an empty class doesn't save up credit
+            c.deficit = 0;
+            idle++;
+        }
+        // a class with frames but no credit is topped up until it can send
+        else if (c.queue.size ())
+            idle = 0;
+        m_current = m_current < last ? m_current + 1 : m_strict;
+        m_classes[m_current]->deficit += m_classes[m_current]->quantum;
+    }
+    return n;
+}
+
+size_t FrameQueue::size () const
+{
+    size_t size = 0;
+    for (const auto& c : m_classes)
+        size += c->queue.size ();
+    return size;
+}
+
+void FrameQueue::close ()
+{
+    m_closed.store (true, std::memory_order_relaxed);
+    m_wakeup.release ();
+}
+
+void FrameQueue::printStatistics (const char* name) const
+{
+    for (size_t n = 0; n < m_classes.size (); n++)
+    {
+        const Class& c = *m_classes[n];
+        Console::Print ("%s queue", name);
+        if (m_classes.size () > 1)
+            Console::Print (" class %zu (%s)", n, n < m_strict ? "strict" : "weighted");
+        Console::Print (": %llu frames, %llu dropped, max. %zu of %zu queued\n",
+            (unsigned long long)c.frames.load (), (unsigned long long)c.drops.load (),
+            c.maxSize.load (), c.queue.capacity ());
+    }
+}
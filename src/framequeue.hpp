@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEQUEUE_HPP
+#define FRAMEQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <semaphore>
+#include <vector>
+
+#include "spscqueue.hpp"
+#include "framepool.hpp"
+
+struct FrameQueueConfig
+{
+    enum Policy
+    {
+        TAIL_DROP, // a full queue drops new frames
+        HEAD_DROP  // a full queue drops the oldest frame, which keeps the delay of fresh frames low
+    };
+
+    static const unsigned MAX_CLASSES = 4;
+
+    size_t   depth;   // max. number of queued frames per class (rounded up to a power of two), 0 disables the queue
+    size_t   mtu;     // max. frame length, one round of deficit round robin sends weight frames of it
+    Policy   policy;
+    unsigned classes; // number of traffic classes, 0 is the highest priority
+    unsigned strict;  // classes below are served by strict priority, the others share the rest by weight
+    unsigned weights[MAX_CLASSES];
+
+    FrameQueueConfig () :
+        depth (0),
+        mtu (1514),
+        policy (TAIL_DROP),
+        classes (1),
+        strict (0),
+        weights { 1, 1, 4, 1 }
+    {
+    }
+
+    bool isEnabled () const
+    {
+        return depth > 0;
+    }
+};
+
+// Frames passed from one thread to another, so that a stall of the consumer
+// (e.g. TCP backpressure) doesn't stall the producer. Either side closes the
+// queue when it terminates.
+// With several traffic classes, each has its own queue. The consumer takes frames
+// of the strict classes first and the frames of the others by deficit round robin.
+class FrameQueue
+{
+public:
+    explicit FrameQueue (const FrameQueueConfig& config);
+    FrameQueue (const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    // producer only, returns false if a frame had to be dropped
+    bool push (FrameRef&& frame, unsigned cls = 0);
+    // producer only, wakes up the consumer after a batch has been pushed
+    void notify ();
+
+    // consumer only, takes up to count frames. Waits up to timeout microseconds
+    // (-1 forever) if the queue is empty, 0 is returned if nothing arrived.
+    size_t pop (FrameRef* frames, size_t count, int timeout = -1);
+
+    void close ();
+    bool isClosed () const
+    {
+        return m_closed.load (std::memory_order_relaxed);
+    }
+
+    unsigned classes () const
+    {
+        return (unsigned)m_classes.size ();
+    }
+    size_t size () const;
+    size_t capacity () const
+    {
+        return m_classes.size () * m_classes[0]->queue.capacity ();
+    }
+
+    void printStatistics (const char* name) const;
+
+private:
+    struct Class
+    {
+        SpscQueue<FrameRef> queue;
+        int64_t quantum; // bytes per round
+        int64_t deficit; // consumer only
+
+        // written by the producer only
+        std::atomic<uint64_t> frames;
+        std::atomic<uint64_t> drops;
+        std::atomic<size_t>   maxSize;
+
+        Class (size_t depth, int64_t quantum);
+    };
+
+    std::vector<std::unique_ptr<Class>> m_classes;
+    FrameQueueConfig::Policy m_policy;
+    unsigned m_strict;
+    unsigned m_current; // weighted class the consumer serves
+    std::atomic<bool> m_closed;
+    std::atomic<bool> m_waiting; // the consumer is about to sleep
+    std::counting_semaphore<> m_wakeup;
+
+    size_t take (FrameRef* frames, size_t count);
+};
+
+#endif
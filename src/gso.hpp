@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GSO_HPP
+#define GSO_HPP
+
+#include <cstdint>
+
+#include "tunnel.hpp"
+
+// struct virtio_net_hdr, <linux/virtio_net.h> can't be included by C++ code.
+// It is passed in host byte order by TAP devices and PACKET_VNET_HDR sockets.
+struct VirtioNetHeader
+{
+    static const uint8_t NEEDS_CSUM = 1; // VIRTIO_NET_HDR_F_NEEDS_CSUM
+    static const uint8_t GSO_NONE   = 0; // VIRTIO_NET_HDR_GSO_NONE
+
+    uint8_t  flags;
+    uint8_t  gsoType;
+    uint16_t hdrLen;
+    uint16_t gsoSize;
+    uint16_t csumStart;
+    uint16_t csumOffset;
+
+    // plain frames are tunneled as PACKET, all others as GSO packet
+    bool isPlain () const
+    {
+        return !(flags & NEEDS_CSUM) && gsoType == GSO_NONE;
+    }
+
+    GsoHeader toTunnel () const
+    {
+        // only the flag which matters for sending is kept
+        GsoHeader h;
+        h.set (flags & NEEDS_CSUM ? GsoHeader::NEEDS_CSUM : 0, gsoType, hdrLen, gsoSize, csumStart, csumOffset);
+        return h;
+    }
+    static VirtioNetHeader fromTunnel (const GsoHeader& h)
+    {
+        VirtioNetHeader v;
+        v.flags      = h.getFlags () & GsoHeader::NEEDS_CSUM ? NEEDS_CSUM : 0;
+        v.gsoType    = h.getGsoType ();
+        v.hdrLen     = h.getHdrLen ();
+        v.gsoSize    = h.getGsoSize ();
+        v.csumStart  = h.getCsumStart ();
+        v.csumOffset = h.getCsumOffset ();
+        return v;
+    }
+};
+static_assert (sizeof (VirtioNetHeader) == 10, "VirtioNetHeader doesn't match struct virtio_net_hdr");
+
+#endif
@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <stdexcept>
+
+#include "headercompressor.hpp"
+#include "tunnel.hpp"
+#include "console.hpp"
+
+// context id of a frame sent without header compression
+static const uint8_t RAW  = 0x7f;
+// the context is defined by this record
+static const uint8_t FULL = 0x80;
+
+// the headers which are compressed
+enum Kind : uint8_t
+{
+    ETHERNET = 0,
+    IPV4     = 1,
+    UDP      = 2
+};
+
+// restored data of a record can be larger than the record by this many bytes
+static const size_t MAX_GROWTH = HeaderCompressor::MAX_HEADER;
+static const size_t BUFFER_SIZE = HeaderCompressor::MAX_PAYLOAD + HeaderCompressor::MAX_FRAMES * MAX_GROWTH;
+
+// ------------ local helper functions ------------
+static Kind parse (const uint8_t* frame, size_t len, size_t& ethLen, size_t& ipLen);
+static uint16_t ipChecksum (const uint8_t* ip, size_t len);
+static uint8_t* putVarint (uint8_t* p, uint32_t value);
+static const uint8_t* getVarint (const uint8_t* p, const uint8_t* end, uint32_t& value);
+static inline uint16_t get16 (const uint8_t* p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+static inline void put16 (uint8_t* p, uint16_t value)
+{
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+
+HeaderCompressor::HeaderCompressor () :
+    m_buffer (new uint8_t[sizeof (TunnelHeader) + MAX_PAYLOAD]),
+    m_len (0),
+    m_frames (0),
+    m_contexts (),
+    m_lookup (),
+    m_next (0),
+    m_bytesIn (0),
+    m_bytesOut (0),
+    m_full (0),
+    m_compressed (0),
+    m_raw (0)
+{
+}
+
+bool HeaderCompressor::add (const uint8_t* frame, size_t len)
+{
+    // worst case size of the record
+    if (m_frames >= MAX_FRAMES || m_len + len + MAX_HEADER + 16 > MAX_PAYLOAD)
+        return false;
+
+    uint8_t* const start = m_buffer.get () + sizeof (TunnelHeader) + m_len;
+    uint8_t* p = start;
+    m_frames++;
+    m_bytesIn += sizeof (TunnelHeader) + len;
+
+    size_t ethLen, ipLen;
+    const Kind kind = parse (frame, len, ethLen, ipLen);
+    const size_t hdrLen = kind == UDP ? ethLen + ipLen + 8 : kind == IPV4 ? ethLen + ipLen : ethLen;
+    if (!hdrLen)
+    {
+        *p++ = RAW;
+        p = putVarint (p, (uint32_t)len);
+        std::memcpy (p, frame, len);
+        p += len;
+        m_len += (size_t)(p - start);
+        m_raw++;
+        return true;
+    }
+
+    // the invariant part of the headers identifies the flow
+    uint8_t header[MAX_HEADER];
+    std::memcpy (header, frame, hdrLen);
+    if (kind != ETHERNET)
+    {
+        uint8_t* ip = header + ethLen;
+        std::memset (ip + 2, 0, 4);  // total length, identification
+        std::memset (ip + 10, 0, 2); // checksum
+        if (kind == UDP)
+            std::memset (ip + ipLen + 4, 0, 4); // length, checksum
+    }
+    uint32_t hash = 2166136261u;
+    for (size_t n = 0; n < hdrLen; n++)
+        hash = (hash ^ header[n]) * 16777619u;
+    hash ^= hash >> 16;
+    hash ^= hash >> 8;
+    uint8_t& slot = m_lookup[hash & 0xff];
+
+    const uint16_t id = kind != ETHERNET ? get16 (frame + ethLen + 4) : 0;
+    Context* ctx = slot ? &m_contexts[slot - 1] : nullptr;
+    if (ctx && ctx->kind == kind && ctx->len == hdrLen && !std::memcmp (ctx->header, header, hdrLen))
+    {
+        *p++ = (uint8_t)(slot - 1);
+        p = putVarint (p, (uint32_t)(len - hdrLen));
+        if (kind != ETHERNET)
+        {
+            // zigzag encoded, usually a single byte
+            const int16_t delta = (int16_t)(uint16_t)(id - ctx->id);
+            p = putVarint (p, (uint32_t)(uint16_t)((delta << 1) ^ (delta >> 15)));
+            ctx->id = id;
+        }
+        if (kind == UDP)
+        {
+            std::memcpy (p, frame + ethLen + ipLen + 6, 2);
+            p += 2;
+        }
+        m_compressed++;
+    }
+    else
+    {
+        // new flow, replace the contexts round robin
+        const unsigned n = m_next;
+        m_next = (m_next + 1) % CONTEXTS;
+        ctx = &m_contexts[n];
+        std::memcpy (ctx->header, header, hdrLen);
+        ctx->len  = (uint8_t)hdrLen;
+        ctx->kind = kind;
+        ctx->id   = id;
+        slot = (uint8_t)(n + 1);
+
+        *p++ = (uint8_t)(FULL | n);
+        *p++ = kind;
+        *p++ = (uint8_t)hdrLen;
+        std::memcpy (p, frame, hdrLen);
+        p += hdrLen;
+        p = putVarint (p, (uint32_t)(len - hdrLen));
+        m_full++;
+    }
+
+    std::memcpy (p, frame + hdrLen, len - hdrLen);
+    p += len - hdrLen;
+    m_len += (size_t)(p - start);
+    return true;
+}
+
+const uint8_t* HeaderCompressor::finish (size_t& packetLen)
+{
+    TunnelHeader::build (m_buffer.get (), Type::PACKED, (uint32_t)m_len);
+    packetLen = sizeof (TunnelHeader) + m_len;
+    m_bytesOut += packetLen;
+    m_len    = 0;
+    m_frames = 0;
+    return m_buffer.get ();
+}
+
+void HeaderCompressor::printStatistics () const
+{
+    if (!m_bytesIn)
+        return;
+
+    Console::Print ("header compression: %llu -> %llu bytes (%.1f%%), contexts defined %llu, used %llu, raw frames %llu\n",
+        (unsigned long long)m_bytesIn, (unsigned long long)m_bytesOut, 100.0 * (double)m_bytesOut / (double)m_bytesIn,
+        (unsigned long long)m_full, (unsigned long long)m_compressed, (unsigned long long)m_raw);
+}
+
+
+HeaderDecompressor::HeaderDecompressor () :
+    m_buffer (new uint8_t[BUFFER_SIZE]),
+    m_contexts ()
+{
+    m_frames.reserve (HeaderCompressor::MAX_FRAMES);
+}
+
+const std::vector<Frame>& HeaderDecompressor::decompress (const uint8_t* payload, size_t len)
+{
+    if (len > HeaderCompressor::MAX_PAYLOAD)
+        throw std::runtime_error ("Packed packet too large");
+
+    const uint8_t* p = payload;
+    const uint8_t* const end = payload + len;
+    uint8_t* out = m_buffer.get ();
+    m_frames.clear ();
+
+    while (p < end)
+    {
+        if (m_frames.size () >= HeaderCompressor::MAX_FRAMES)
+            throw std::runtime_error ("Too many frames in packed packet");
+
+        const uint8_t c = *p++;
+        uint32_t rest;
+        Frame frame;
+        frame.data = out;
+
+        if (c == RAW)
+        {
+            if (!(p = getVarint (p, end, rest)) || rest > (size_t)(end - p))
+                throw std::runtime_error ("Invalid packed packet");
+            std::memcpy (out, p, rest);
+            p += rest;
+            frame.len = rest;
+        }
+        else
+        {
+            // RAW | FULL isn't a valid context
+            if ((c & ~FULL) >= HeaderCompressor::CONTEXTS)
+                throw std::runtime_error ("Invalid packed packet");
+            Context& ctx = m_contexts[c & ~FULL];
+            if (c & FULL)
+            {
+                // context definition, the headers are checked once here
+                if (end - p < 2 || p[1] > HeaderCompressor::MAX_HEADER || (size_t)(end - p - 2) < p[1])
+                    throw std::runtime_error ("Invalid packed packet");
+                ctx.kind = p[0];
+                ctx.len  = p[1];
+                std::memcpy (ctx.header, p + 2, ctx.len);
+                p += 2 + ctx.len;
+
+                // the layout of the headers must match their kind
+                size_t ethLen = ctx.len >= 18 && get16 (ctx.header + 12) == 0x8100 ? 18 : 14;
+                size_t ipLen  = ctx.kind != ETHERNET && ctx.len > ethLen ? (size_t)(ctx.header[ethLen] & 0x0f) * 4 : 0;
+                if (ctx.kind > UDP || (ctx.kind != ETHERNET && ipLen < 20)
+                    || ctx.len != ethLen + ipLen + (ctx.kind == UDP ? 8 : 0))
+                {
+                    ctx.len = 0;
+                    throw std::runtime_error ("Invalid header context");
+                }
+                ctx.ethLen = (uint8_t)ethLen;
+                ctx.ipLen  = (uint8_t)ipLen;
+                if (ctx.kind != ETHERNET)
+                    ctx.id = get16 (ctx.header + ethLen + 4);
+
+                if (!(p = getVarint (p, end, rest)) || rest > (size_t)(end - p))
+                    throw std::runtime_error ("Invalid packed packet");
+                std::memcpy (out, ctx.header, ctx.len);
+            }
+            else
+            {
+                if (!ctx.len)
+                    throw std::runtime_error ("Undefined header context");
+                if (!(p = getVarint (p, end, rest)))
+                    throw std::runtime_error ("Invalid packed packet");
+
+                std::memcpy (out, ctx.header, ctx.len);
+                if (ctx.kind != ETHERNET)
+                {
+                    uint32_t zigzag;
+                    if (!(p = getVarint (p, end, zigzag)))
+                        throw std::runtime_error ("Invalid packed packet");
+                    ctx.id = (uint16_t)(ctx.id + (uint16_t)((zigzag >> 1) ^ -(zigzag & 1)));
+
+                    uint8_t* ip = out + ctx.ethLen;
+                    put16 (ip + 2, (uint16_t)(ctx.len - ctx.ethLen + rest));
+                    put16 (ip + 4, ctx.id);
+                    put16 (ip + 10, 0);
+                    put16 (ip + 10, ipChecksum (ip, ctx.ipLen));
+                    if (ctx.kind == UDP)
+                    {
+                        if (end - p < 2)
+                            throw std::runtime_error ("Invalid packed packet");
+                        put16 (ip + ctx.ipLen + 4, (uint16_t)(8 + rest));
+                        std::memcpy (ip + ctx.ipLen + 6, p, 2);
+                        p += 2;
+                    }
+                }
+                if (rest > (size_t)(end - p))
+                    throw std::runtime_error ("Invalid packed packet");
+            }
+            std::memcpy (out + ctx.len, p, rest);
+            p += rest;
+            frame.len = ctx.len + rest;
+        }
+
+        out += frame.len;
+        m_frames.push_back (frame);
+    }
+    return m_frames;
+}
+
+
+// ------------ local helper functions ------------
+
+// Returns the headers which can be compressed. Lengths and checksum are only
+// restored by the peer, so a frame is only treated as IPv4/UDP if they are valid,
+// e.g. Ethernet padding or checksums not yet calculated by an offload engine
+// are kept as they are.
+Kind parse (const uint8_t* frame, size_t len, size_t& ethLen, size_t& ipLen)
+{
+    ethLen = 0;
+    ipLen  = 0;
+    if (len < 14)
+        return ETHERNET;
+
+    ethLen = 14;
+    uint16_t type = get16 (frame + 12);
+    if (type == 0x8100 && len >= 18)
+    {
+        ethLen = 18;
+        type = get16 (frame + 16);
+    }
+    if (type != 0x0800 || len < ethLen + 20)
+        return ETHERNET;
+
+    const uint8_t* ip = frame + ethLen;
+    const size_t ihl = (size_t)(ip[0] & 0x0f) * 4;
+    if ((ip[0] >> 4) != 4 || ihl < 20 || len < ethLen + ihl || get16 (ip + 2) != len - ethLen
+        || ipChecksum (ip, ihl) != 0)
+        return ETHERNET;
+    ipLen = ihl;
+
+    // fragments don't have an UDP header
+    if (ip[9] != 17 || (ip[6] & 0x3f) || ip[7] || len < ethLen + ihl + 8
+        || get16 (ip + ihl + 4) != len - ethLen - ihl)
+        return IPV4;
+    return UDP;
+}
+
+// ones complement sum, 0 for a header with valid checksum
+uint16_t ipChecksum (const uint8_t* ip, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t n = 0; n + 1 < len; n += 2)
+        sum += get16 (ip + n);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+uint8_t* putVarint (uint8_t* p, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+const uint8_t* getVarint (const uint8_t* p, const uint8_t* end, uint32_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; p < end && shift < 32; shift += 7)
+    {
+        const uint8_t b = *p++;
+        value |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return p;
+    }
+    return nullptr;
+}
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEADERCOMPRESSOR_HPP
+#define HEADERCOMPRESSOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "frame.hpp"
+
+// Stateful compression of the Ethernet, IPv4 and UDP headers of the frames sent on
+// one stream, similar to ROHC. The first frame of a flow defines a context, which
+// holds its headers. Later frames of the flow only carry the context id and the
+// fields, which can't be derived: the delta of the IP identification and the
+// UDP checksum. Lengths and the IP header checksum are recalculated by the peer.
+// A batch of such records is sent as a single PACKED packet, so the tunnel header
+// is shared as well.
+//
+// The stream is reliable and ordered and both sides start with empty contexts
+// for every connection, so there is no need for acknowledgements or resyncs.
+//
+// record := ctx [header] varint(rest length) [fields] rest
+//   ctx    - context id; FULL set: the context is (re)defined and followed by
+//            kind, header length and the header; RAW: frame sent as it is
+class HeaderCompressor
+{
+public:
+    // max. payload of a PACKED packet
+    static constexpr size_t MAX_PAYLOAD = 64 * 1024;
+    // max. number of frames in a PACKED packet
+    static const unsigned MAX_FRAMES = 256;
+    static const unsigned CONTEXTS = 127;
+    // Ethernet with VLAN tag, IPv4 with options, UDP
+    static const size_t MAX_HEADER = 18 + 60 + 8;
+
+    HeaderCompressor ();
+    HeaderCompressor (const HeaderCompressor&) = delete;
+    HeaderCompressor& operator=(const HeaderCompressor&) = delete;
+
+    // false if the frame doesn't fit into the current packet anymore
+    bool add (const uint8_t* frame, size_t len);
+    bool empty () const
+    {
+        return !m_frames;
+    }
+    // the PACKED packet including its tunnel header, resets the packet
+    const uint8_t* finish (size_t& packetLen);
+
+    void printStatistics () const;
+
+private:
+    struct Context
+    {
+        uint8_t  header[MAX_HEADER]; // variable fields are zeroed
+        uint8_t  len;
+        uint8_t  kind;
+        uint16_t id;  // last IP identification
+    };
+
+    std::unique_ptr<uint8_t[]> m_buffer;
+    size_t   m_len;
+    unsigned m_frames;
+    Context  m_contexts[CONTEXTS];
+    uint8_t  m_lookup[256]; // hash of the header -> context id + 1
+    unsigned m_next;        // next context to be replaced
+
+    // statistics
+    uint64_t m_bytesIn;
+    uint64_t m_bytesOut;
+    uint64_t m_full;
+    uint64_t m_compressed;
+    uint64_t m_raw;
+};
+
+// Restores the frames of PACKED packets.
+class HeaderDecompressor
+{
+public:
+    HeaderDecompressor ();
+    HeaderDecompressor (const HeaderDecompressor&) = delete;
+    HeaderDecompressor& operator=(const HeaderDecompressor&) = delete;
+
+    // Restores all frames of the payload of a PACKED packet into an internal
+    // buffer, throws std::runtime_error on invalid data.
+    const std::vector<Frame>& decompress (const uint8_t* payload, size_t len);
+
+private:
+    struct Context
+    {
+        uint8_t  header[HeaderCompressor::MAX_HEADER];
+        uint8_t  len;   // 0 if the context is not defined
+        uint8_t  kind;
+        uint8_t  ethLen;
+        uint8_t  ipLen;
+        uint16_t id;
+    };
+
+    std::unique_ptr<uint8_t[]> m_buffer;
+    std::vector<Frame> m_frames;
+    Context m_contexts[HeaderCompressor::CONTEXTS];
+};
+
+#endif
@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+// Latency histogram with a constant relative resolution like an HDR histogram: the
+// values are grouped by their highest bit, each group is split into 64 linear
+// sub-buckets. Values up to 68 s are recorded with an error below 1/64.
+// Only one thread records values, others (also in other processes) may read them.
+class Histogram
+{
+public:
+    static const unsigned SUB_BITS = 7;
+    static const unsigned HALF     = 1u << (SUB_BITS - 1);
+    static const unsigned MAX_BITS = 36;
+    static const unsigned BUCKETS  = (1u << SUB_BITS) + (MAX_BITS - SUB_BITS) * HALF;
+
+    void record (uint64_t value)
+    {
+        // single writer, the counters are not modified atomically
+        std::atomic<uint64_t>& c = m_counts[index (value)];
+        c.store (c.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    uint64_t count () const
+    {
+        uint64_t total = 0;
+        for (const auto& c : m_counts)
+            total += c.load (std::memory_order_relaxed);
+        return total;
+    }
+    // highest value the given fraction (e.g. 0.99) of the recorded values doesn't exceed, 0 if empty
+    uint64_t percentile (double fraction) const
+    {
+        const uint64_t total = count ();
+        if (!total)
+            return 0;
+        uint64_t rank = (uint64_t)(fraction * (double)total + 0.5);
+        if (!rank)
+            rank = 1;
+
+        uint64_t sum = 0;
+        for (unsigned n = 0; n < BUCKETS; n++)
+        {
+            sum += m_counts[n].load (std::memory_order_relaxed);
+            if (sum >= rank)
+                return highest (n);
+        }
+        return highest (BUCKETS - 1);
+    }
+
+private:
+    static unsigned index (uint64_t value)
+    {
+        if (value >= (1ull << MAX_BITS))
+            value = (1ull << MAX_BITS) - 1;
+        if (value < (1u << SUB_BITS))
+            return (unsigned)value;
+        const unsigned shift = (unsigned)std::bit_width (value) - SUB_BITS;
+        return (1u << SUB_BITS) + (shift - 1) * HALF + (unsigned)(value >> shift) - HALF;
+    }
+    // largest value recorded in the bucket
+    static uint64_t highest (unsigned index)
+    {
+        if (index < (1u << SUB_BITS))
+            return index;
+        const unsigned shift = (index - (1u << SUB_BITS)) / HALF + 1;
+        const uint64_t top   = (index - (1u << SUB_BITS)) % HALF + HALF;
+        return ((top + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> m_counts[BUCKETS];
+};
+
+#endif
@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstring>
+#include <cerrno>
+
+#include "iouring.hpp"
+#include "socketexception.hpp"
+
+// there is no glibc wrapper for the io_uring system calls
+static int sysSetup (unsigned entries, struct io_uring_params* p)
+{
+    return (int)::syscall (__NR_io_uring_setup, entries, p);
+}
+
+static int sysEnter (int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)::syscall (__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int sysRegister (int fd, unsigned opcode, void* arg, unsigned nrArgs)
+{
+    return (int)::syscall (__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+
+IoUring::IoUring ()
+: m_fd (-1), m_sqMap (MAP_FAILED), m_sqMapSize (0), m_cqMap (MAP_FAILED), m_cqMapSize (0),
+  m_sqes ((struct io_uring_sqe*)MAP_FAILED), m_sqesSize (0), m_sqHead (nullptr), m_sqTail (nullptr), m_sqMask (0),
+  m_sqEntries (0), m_sqLocalTail (0), m_sqSubmitted (0), m_cqHead (nullptr), m_cqTail (nullptr), m_cqMask (0),
+  m_cqes (nullptr)
+{
+}
+
+IoUring::~IoUring ()
+{
+    if (m_sqes != MAP_FAILED)
+        ::munmap (m_sqes, m_sqesSize);
+    if (m_cqMap != MAP_FAILED && m_cqMap != m_sqMap)
+        ::munmap (m_cqMap, m_cqMapSize);
+    if (m_sqMap != MAP_FAILED)
+        ::munmap (m_sqMap, m_sqMapSize);
+    if (m_fd >= 0)
+        ::close (m_fd);
+}
+
+std::unique_ptr<IoUring> IoUring::create (unsigned entries)
+{
+    std::unique_ptr<IoUring> r (new IoUring);
+
+    // a single thread submits and reaps, so completions can be deferred until
+    // the next io_uring_enter (6.1+). The completion queue is larger, as every
+    // multishot receive produces an unknown number of completions.
+    struct io_uring_params p;
+    std::memset (&p, 0, sizeof (p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = entries * 8;
+    r->m_fd = sysSetup (entries, &p);
+    if (r->m_fd < 0 && errno == EINVAL)
+    {
+        std::memset (&p, 0, sizeof (p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 8;
+        r->m_fd = sysSetup (entries, &p);
+    }
+    if (r->m_fd < 0)
+        throw SocketException ();
+
+    r->m_sqMapSize = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    r->m_cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->m_cqMapSize > r->m_sqMapSize)
+            r->m_sqMapSize = r->m_cqMapSize;
+        r->m_cqMapSize = r->m_sqMapSize;
+    }
+
+    r->m_sqMap = ::mmap (nullptr, r->m_sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        r->m_fd, IORING_OFF_SQ_RING);
+    if (r->m_sqMap == MAP_FAILED)
+        throw SocketException ();
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        r->m_cqMap = r->m_sqMap;
+    }
+    else
+    {
+        r->m_cqMap = ::mmap (nullptr, r->m_cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            r->m_fd, IORING_OFF_CQ_RING);
+        if (r->m_cqMap == MAP_FAILED)
+            throw SocketException ();
+    }
+
+    r->m_sqesSize = p.sq_entries * sizeof (struct io_uring_sqe);
+    r->m_sqes = (struct io_uring_sqe*)::mmap (nullptr, r->m_sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->m_fd, IORING_OFF_SQES);
+    if (r->m_sqes == MAP_FAILED)
+        throw SocketException ();
+
+    uint8_t* sq = (uint8_t*)r->m_sqMap;
+    r->m_sqHead    = (unsigned*)(sq + p.sq_off.head);
+    r->m_sqTail    = (unsigned*)(sq + p.sq_off.tail);
+    r->m_sqMask    = *(unsigned*)(sq + p.sq_off.ring_mask);
+    r->m_sqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    r->m_sqLocalTail = r->m_sqSubmitted = *r->m_sqTail;
+
+    // the submission queue entries are always used in ring order
+    unsigned* array = (unsigned*)(sq + p.sq_off.array);
+    for (unsigned n = 0; n < r->m_sqEntries; n++)
+        array[n] = n;
+
+    uint8_t* cq = (uint8_t*)r->m_cqMap;
+    r->m_cqHead = (unsigned*)(cq + p.cq_off.head);
+    r->m_cqTail = (unsigned*)(cq + p.cq_off.tail);
+    r->m_cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    r->m_cqes   = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return r;
+}
+
+struct io_uring_sqe* IoUring::sqe ()
+{
+    if (m_sqLocalTail - __atomic_load_n (m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+        submit ();
+
+    struct io_uring_sqe* e = &m_sqes[m_sqLocalTail & m_sqMask];
+    std::memset (e, 0, sizeof (*e));
+    m_sqLocalTail++;
+    return e;
+}
+
+void IoUring::submit (unsigned waitCount)
+{
+    __atomic_store_n (m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+
+    while (1)
+    {
+        int ret = sysEnter (m_fd, m_sqLocalTail - m_sqSubmitted, waitCount, IORING_ENTER_GETEVENTS);
+        if (ret >= 0)
+        {
+            m_sqSubmitted += (unsigned)ret;
+            return;
+        }
+        if (errno != EINTR)
+            throw SocketException ();
+    }
+}
+
+const struct io_uring_cqe* IoUring::peek () const
+{
+    unsigned head = *m_cqHead;
+    if (head == __atomic_load_n (m_cqTail, __ATOMIC_ACQUIRE))
+        return nullptr;
+    return &m_cqes[head & m_cqMask];
+}
+
+void IoUring::advance ()
+{
+    __atomic_store_n (m_cqHead, *m_cqHead + 1, __ATOMIC_RELEASE);
+}
+
+
+UringBufferRing::UringBufferRing ()
+: m_ringFd (-1), m_group (0), m_ring ((struct io_uring_buf_ring*)MAP_FAILED), m_size (0), m_mask (0), m_tail (0)
+{
+}
+
+UringBufferRing::~UringBufferRing ()
+{
+    if (m_ring != MAP_FAILED)
+    {
+        struct io_uring_buf_reg reg;
+        std::memset (&reg, 0, sizeof (reg));
+        reg.bgid = m_group;
+        sysRegister (m_ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        ::munmap (m_ring, m_size);
+    }
+}
+
+std::unique_ptr<UringBufferRing> UringBufferRing::create (const IoUring& ring, uint16_t group, unsigned entries)
+{
+    std::unique_ptr<UringBufferRing> r (new UringBufferRing);
+    r->m_ringFd = ring.handle ();
+    r->m_group  = group;
+    r->m_mask   = entries - 1;
+    r->m_size   = entries * sizeof (struct io_uring_buf);
+
+    // the ring must be page aligned
+    void* map = ::mmap (nullptr, r->m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        throw SocketException ();
+    r->m_ring = (struct io_uring_buf_ring*)map;
+
+    struct io_uring_buf_reg reg;
+    std::memset (&reg, 0, sizeof (reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)map;
+    reg.ring_entries = entries;
+    reg.bgid         = group;
+    if (sysRegister (r->m_ringFd, IORING_REGISTER_PBUF_RING, &reg, 1))
+    {
+        int err = errno;
+        ::munmap (map, r->m_size);
+        r->m_ring = (struct io_uring_buf_ring*)MAP_FAILED;
+        errno = err;
+        throw SocketException ();
+    }
+
+    return r;
+}
+
+void UringBufferRing::add (void* addr, unsigned len, uint16_t id)
+{
+    // bufs[] of the uapi header is not at offset 0 in C++ (empty struct in front of the flexible array)
+    struct io_uring_buf* buf = (struct io_uring_buf*)m_ring + (m_tail & m_mask);
+    buf->addr = (uint64_t)(uintptr_t)addr;
+    buf->len  = len;
+    buf->bid  = id;
+    m_tail++;
+}
+
+void UringBufferRing::commit ()
+{
+    __atomic_store_n (&m_ring->tail, m_tail, __ATOMIC_RELEASE);
+}
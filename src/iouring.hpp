@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IOURING_HPP
+#define IOURING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper on top of the raw system calls.
+// Not thread safe, submissions and completions are handled by one thread.
+class IoUring
+{
+public:
+    IoUring (const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+    ~IoUring ();
+
+    // throws SocketException if io_uring is not available
+    static std::unique_ptr<IoUring> create (unsigned entries);
+
+    // next free submission queue entry (zeroed),
+    // the pending entries are submitted if the queue is full
+    struct io_uring_sqe* sqe ();
+    // submit all pending entries and wait for at least waitCount completions
+    void submit (unsigned waitCount = 0);
+
+    // oldest unprocessed completion, nullptr if there is none
+    const struct io_uring_cqe* peek () const;
+    // mark the completion returned by peek() as processed
+    void advance ();
+
+    int handle () const
+    {
+        return m_fd;
+    }
+
+private:
+    IoUring ();
+
+    int m_fd;
+
+    void*  m_sqMap;
+    size_t m_sqMapSize;
+    void*  m_cqMap;
+    size_t m_cqMapSize;
+    struct io_uring_sqe* m_sqes;
+    size_t m_sqesSize;
+
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned  m_sqMask;
+    unsigned  m_sqEntries;
+    unsigned  m_sqLocalTail; // entries handed out by sqe()
+    unsigned  m_sqSubmitted; // entries consumed by the kernel
+
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned  m_cqMask;
+    struct io_uring_cqe* m_cqes;
+};
+
+// Buffers provided to the kernel for receive operations with buffer selection
+// (IOSQE_BUFFER_SELECT). The ring is registered once, afterwards buffers are
+// returned to the kernel by a simple store to the shared tail.
+class UringBufferRing
+{
+public:
+    UringBufferRing (const UringBufferRing&) = delete;
+    UringBufferRing& operator=(const UringBufferRing&) = delete;
+    ~UringBufferRing ();
+
+    // entries must be a power of two
+    static std::unique_ptr<UringBufferRing> create (const IoUring& ring, uint16_t group, unsigned entries);
+
+    // hand a buffer (back) to the kernel, visible after commit()
+    void add (void* addr, unsigned len, uint16_t id);
+    void commit ();
+
+    uint16_t group () const
+    {
+        return m_group;
+    }
+
+private:
+    UringBufferRing ();
+
+    int      m_ringFd;
+    uint16_t m_group;
+    struct io_uring_buf_ring* m_ring;
+    size_t   m_size;
+    unsigned m_mask;
+    uint16_t m_tail;    // local tail including added buffers
+};
+
+#endif
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef L2SOCKET_HPP
+#define L2SOCKET_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "frame.hpp"
+#include "framepool.hpp"
+
+// common interface of all layer 2 backends used by Receiver and Sender
+class L2Socket
+{
+public:
+    virtual ~L2Socket () {}
+
+    // Receive up to count frames. Blocks until at least one frame is available
+    // or the timeout (in microseconds, -1 waits forever) expires, in that case 0 is returned.
+    // A timeout of 0 returns the frames already queued without waiting.
+    // The returned frames point to memory owned by the socket and remain valid
+    // until the next call. Each frame has the configured headroom writable bytes in front.
+    virtual size_t recvBatch (Frame* frames, size_t count, int timeout = -1) = 0;
+    // Keeps frame n of the last recvBatch call valid beyond the next call without copying it.
+    // Returns an empty reference if the backend doesn't receive into pool buffers, the frame
+    // must be copied then. The references must be released before the socket is destroyed.
+    virtual FrameRef hold (size_t n) const
+    {
+        (void)n;
+        return FrameRef ();
+    }
+    // Kernel timestamp (ns since the epoch) of the capture of frame n of the last recvBatch call,
+    // 0 if the backend doesn't timestamp frames.
+    virtual uint64_t timestamp (size_t n) const
+    {
+        (void)n;
+        return 0;
+    }
+    // Frame n of the last recvBatch call is a GSO frame or has a partial checksum. Its GsoHeader
+    // is stored in front of it, the headroom is in front of the GsoHeader.
+    virtual bool isGso (size_t n) const
+    {
+        (void)n;
+        return false;
+    }
+    // Number of frames dropped by recvBatch so far, because all buffers were held by the caller.
+    virtual uint64_t poolDrops () const
+    {
+        return 0;
+    }
+    // Send count frames. The frames are no longer referenced when the call returns.
+    virtual void sendBatch (const Frame* frames, size_t count) = 0;
+    // Send a frame preceded by its GsoHeader, the kernel segments or checksums it.
+    // Backends which can't send such frames drop it.
+    virtual void sendGso (const Frame& frame)
+    {
+        (void)frame;
+    }
+    // The kernel timestamps the first frame of the next sendBatch call when it is handed to
+    // the driver. Returns false if the backend can't timestamp sent frames.
+    virtual bool requestTimestamp ()
+    {
+        return false;
+    }
+    // Fetches the next available timestamp (ns since the epoch) of a requested frame, id counts
+    // the requests from 0. Returns false if none is available (yet).
+    virtual bool sentTimestamp (uint32_t& id, uint64_t& time)
+    {
+        (void)id;
+        (void)time;
+        return false;
+    }
+
+    // abort all blocking calls
+    virtual void cancel () const = 0;
+
+    // file descriptor which becomes readable when frames arrive
+    virtual int handle () const = 0;
+};
+
+#endif
@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// l2tun-perf gen IFC SIZE FLOWS SECONDS [PPS]
+// l2tun-perf sink IFC SECONDS
+// Traffic generator and sink of the benchmark (bench/l2tun-bench). The generator
+// sends IPv4/UDP frames of SIZE bytes (without FCS), spread round robin over FLOWS
+// source ports, as fast as possible or at PPS frames per second. Each frame carries
+// a sequence number and its send time, so the sink measures the one way latency,
+// which requires both to run on the same host. Both print their results as JSON.
+
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rawsocket.hpp"
+#include "histogram.hpp"
+
+static const size_t   BATCH_SIZE = 64;
+static const size_t   MIN_SIZE   = 60;
+static const size_t   MAX_SIZE   = 9216;
+static const uint32_t MAGIC      = 0x4c325442; // "L2TB"
+static const uint16_t PORT       = 9;          // discard
+// the sink stops this long after the last frame
+static const uint64_t IDLE_TIME  = 1000000000;
+
+// offsets in the generated frames
+static const size_t IP_OFFSET      = 14;
+static const size_t UDP_OFFSET     = IP_OFFSET + 20;
+static const size_t PAYLOAD_OFFSET = UDP_OFFSET + 8;
+
+struct Stamp
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t time;
+};
+
+
+static uint64_t now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void put16 (uint8_t* p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static uint16_t get16 (const uint8_t* p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Ethernet, IPv4 (198.18.0.1 -> 198.18.0.2, RFC 2544 range) and UDP header without checksum
+static void buildFrame (uint8_t* frame, size_t size)
+{
+    static const uint8_t dst[6] = {0x02, 0, 0, 0, 0, 0x02};
+    static const uint8_t src[6] = {0x02, 0, 0, 0, 0, 0x01};
+
+    std::memset (frame, 0, size);
+    std::memcpy (frame, dst, 6);
+    std::memcpy (frame + 6, src, 6);
+    put16 (frame + 12, 0x0800);
+
+    uint8_t* ip = frame + IP_OFFSET;
+    ip[0] = 0x45;
+    put16 (ip + 2, (uint16_t)(size - IP_OFFSET));
+    ip[8] = 64;
+    ip[9] = 17;
+    const uint8_t addr[8] = {198, 18, 0, 1, 198, 18, 0, 2};
+    std::memcpy (ip + 12, addr, sizeof (addr));
+    uint32_t sum = 0;
+    for (size_t n = 0; n < 20; n += 2)
+        sum += get16 (ip + n);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    put16 (ip + 10, (uint16_t)~sum);
+
+    put16 (frame + UDP_OFFSET + 2, PORT);
+    put16 (frame + UDP_OFFSET + 4, (uint16_t)(size - UDP_OFFSET));
+}
+
+static RawSocket openSocket (const char* interface, bool receive)
+{
+    RawSocketConfig config;
+    config.mtu = MAX_SIZE;
+    config.ignoreOutgoing = true;
+    if (!receive)
+    {
+        // the generator drops everything it would capture
+        config.filter.push_back ({0x06, 0, 0, 0});
+    }
+    return RawSocket::open (interface, config);
+}
+
+static int generate (const char* interface, size_t size, unsigned flows, unsigned seconds, uint64_t pps)
+{
+    RawSocket s = openSocket (interface, false);
+
+    std::vector<uint8_t> buffer (BATCH_SIZE * size);
+    Frame frames[BATCH_SIZE];
+    for (size_t n = 0; n < BATCH_SIZE; n++)
+    {
+        frames[n].data = buffer.data () + n * size;
+        frames[n].len  = size;
+        buildFrame (frames[n].data, size);
+    }
+
+    const uint64_t start = now ();
+    const uint64_t end   = start + (uint64_t)seconds * 1000000000;
+    uint64_t sent = 0;
+    uint64_t t = start;
+    while (t < end)
+    {
+        size_t count = BATCH_SIZE;
+        if (pps)
+        {
+            // frames due until now, sleep until the next one otherwise
+            const uint64_t due = (t - start) * pps / 1000000000 + 1;
+            if (due <= sent)
+            {
+                const uint64_t next = start + sent * 1000000000 / pps;
+                struct timespec ts = {(time_t)(next / 1000000000), (long)(next % 1000000000)};
+                clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+                t = now ();
+                continue;
+            }
+            if (due - sent < count)
+                count = (size_t)(due - sent);
+        }
+
+        for (size_t n = 0; n < count; n++)
+        {
+            const uint64_t seq = sent + n;
+            put16 (frames[n].data + UDP_OFFSET, (uint16_t)(1024 + seq % flows));
+            const Stamp stamp = {MAGIC, (uint32_t)seq, t};
+            std::memcpy (frames[n].data + PAYLOAD_OFFSET, &stamp, sizeof (stamp));
+        }
+        s.sendBatch (frames, count);
+        sent += count;
+        t = now ();
+    }
+
+    const double duration = (double)(t - start) / 1e9;
+    std::printf ("{\"frames\":%llu,\"bytes\":%llu,\"seconds\":%.3f,\"pps\":%.0f}\n",
+        (unsigned long long)sent, (unsigned long long)(sent * size), duration, (double)sent / duration);
+    return 0;
+}
+
+static int sink (const char* interface, unsigned seconds)
+{
+    RawSocket s = openSocket (interface, true);
+    std::unique_ptr<Histogram> latency (new Histogram ());
+
+    const uint64_t end = now () + (uint64_t)seconds * 1000000000;
+    uint64_t frames = 0;
+    uint64_t bytes  = 0;
+    uint64_t first  = 0;
+    uint64_t last   = 0;
+    Frame batch[BATCH_SIZE];
+
+    while (1)
+    {
+        const uint64_t t = now ();
+        if (t >= end || (frames && t >= last + IDLE_TIME))
+            break;
+
+        const size_t count = s.recvBatch (batch, BATCH_SIZE, 100000);
+        const uint64_t received = now ();
+        for (size_t n = 0; n < count; n++)
+        {
+            const Frame& f = batch[n];
+            if (f.len < PAYLOAD_OFFSET + sizeof (Stamp) || get16 (f.data + 12) != 0x0800
+                || f.data[IP_OFFSET + 9] != 17 || get16 (f.data + UDP_OFFSET + 2) != PORT)
+                continue;
+            Stamp stamp;
+            std::memcpy (&stamp, f.data + PAYLOAD_OFFSET, sizeof (stamp));
+            if (stamp.magic != MAGIC)
+                continue;
+
+            if (!frames)
+                first = received;
+            last = received;
+            frames++;
+            bytes += f.len;
+            latency->record (received > stamp.time ? received - stamp.time : 0);
+        }
+    }
+
+    // the rate is measured from the first until the last frame
+    const double duration = frames > 1 ? (double)(last - first) / 1e9 : 0;
+    std::printf ("{\"frames\":%llu,\"bytes\":%llu,\"seconds\":%.3f,\"pps\":%.0f,\"gbps\":%.3f,"
+        "\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f}}\n",
+        (unsigned long long)frames, (unsigned long long)bytes, duration,
+        duration > 0 ? (double)frames / duration : 0, duration > 0 ? (double)bytes * 8 / duration / 1e9 : 0,
+        (double)latency->percentile (0.5) / 1000, (double)latency->percentile (0.99) / 1000,
+        (double)latency->percentile (0.999) / 1000);
+    return 0;
+}
+
+int main (int argc, char** argv)
+{
+    const std::string mode = argc > 1 ? argv[1] : "";
+    try
+    {
+        if (mode == "gen" && (argc == 6 || argc == 7))
+        {
+            const long size = std::atol (argv[3]);
+            const long flows = std::atol (argv[4]);
+            const long seconds = std::atol (argv[5]);
+            const long long pps = argc == 7 ? std::atoll (argv[6]) : 0;
+            if (size < (long)MIN_SIZE || size > (long)MAX_SIZE || flows < 1 || flows > 65535 || seconds < 1 || pps < 0)
+            {
+                std::fprintf (stderr, "invalid parameters\n");
+                return 1;
+            }
+            return generate (argv[2], (size_t)size, (unsigned)flows, (unsigned)seconds, (uint64_t)pps);
+        }
+        if (mode == "sink" && argc == 4)
+        {
+            const long seconds = std::atol (argv[3]);
+            if (seconds < 1)
+            {
+                std::fprintf (stderr, "invalid parameters\n");
+                return 1;
+            }
+            return sink (argv[2], (unsigned)seconds);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf (stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    std::fprintf (stderr, "usage: %s gen IFC SIZE FLOWS SECONDS [PPS]\n"
+        "       %s sink IFC SECONDS\n", argv[0], argv[0]);
+    return 1;
+}
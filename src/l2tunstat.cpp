@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// l2tun-stat NAME [SECONDS]
+// Prints the statistics published by "l2tun --stats NAME". With SECONDS the
+// rates are printed periodically, otherwise all counters and latencies once.
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <vector>
+
+#include "stats.hpp"
+
+
+static void printMac (uint64_t mac)
+{
+    uint8_t b[8];
+    std::memcpy (b, &mac, sizeof (b));
+    std::printf ("%02x:%02x:%02x:%02x:%02x:%02x", b[0], b[1], b[2], b[3], b[4], b[5]);
+}
+
+static void printCounters (const ThreadStats& s)
+{
+    std::printf ("%s\n", s.name);
+    std::printf ("  frames %llu, bytes %llu, drops %llu, local %llu, errors %llu, batches %llu\n",
+        (unsigned long long)s.frames, (unsigned long long)s.bytes, (unsigned long long)s.drops,
+        (unsigned long long)s.local, (unsigned long long)s.errors, (unsigned long long)s.batches);
+    if (s.queueMax || s.queueDrops)
+        std::printf ("  queue length %llu (max. %llu), queue drops %llu\n", (unsigned long long)s.queueLength,
+            (unsigned long long)s.queueMax, (unsigned long long)s.queueDrops);
+    if (s.poolDrops)
+        std::printf ("  pool drops %llu (all receive buffers were held)\n", (unsigned long long)s.poolDrops);
+
+    std::printf ("  frame sizes:");
+    for (unsigned n = 0; n < ThreadStats::SIZE_BUCKETS; n++)
+    {
+        if (!s.frameSizes[n])
+            continue;
+        if (n == ThreadStats::SIZE_BUCKETS - 1)
+            std::printf (" >%u: %llu", 64u << (n - 1), (unsigned long long)s.frameSizes[n]);
+        else
+            std::printf (" <=%u: %llu", 64u << n, (unsigned long long)s.frameSizes[n]);
+    }
+    std::printf ("\n  batch sizes:");
+    for (unsigned n = 0; n < ThreadStats::BATCH_BUCKETS; n++)
+    {
+        if (!s.batchSizes[n])
+            continue;
+        if (n == ThreadStats::BATCH_BUCKETS - 1)
+            std::printf (" >=%u: %llu", 1u << n, (unsigned long long)s.batchSizes[n]);
+        else if (!n)
+            std::printf (" 1: %llu", (unsigned long long)s.batchSizes[n]);
+        else
+            std::printf (" %u-%u: %llu", 1u << n, (2u << n) - 1, (unsigned long long)s.batchSizes[n]);
+    }
+    std::printf ("\n  top source MACs:\n");
+
+    std::vector<MacCounter> macs (s.macs, s.macs + ThreadStats::TOP_MACS);
+    std::sort (macs.begin (), macs.end (), [](const MacCounter& a, const MacCounter& b) { return a.count > b.count; });
+    for (const MacCounter& m : macs)
+    {
+        if (!m.count)
+            break;
+        std::printf ("    ");
+        printMac (m.mac);
+        std::printf (" %llu\n", (unsigned long long)m.count);
+    }
+}
+
+static void printLatency (const char* name, const Histogram& h)
+{
+    const uint64_t count = h.count ();
+    if (!count)
+        return;
+    std::printf ("  %s: p50 %.1f us, p99 %.1f us, p99.9 %.1f us (%llu samples)\n", name,
+        (double)h.percentile (0.5) / 1000, (double)h.percentile (0.99) / 1000,
+        (double)h.percentile (0.999) / 1000, (unsigned long long)count);
+}
+
+static void printCoalesced (const StatsSlot& slot)
+{
+    uint64_t counts[StatsSlot::COALESCE_BUCKETS];
+    uint64_t total = 0;
+    for (unsigned n = 0; n < StatsSlot::COALESCE_BUCKETS; n++)
+        total += counts[n] = slot.coalesced[n].load (std::memory_order_relaxed);
+    if (!total)
+        return;
+
+    std::printf ("  coalesced sends:");
+    for (unsigned n = 0; n < StatsSlot::COALESCE_BUCKETS; n++)
+    {
+        if (!counts[n])
+            continue;
+        if (n == StatsSlot::COALESCE_BUCKETS - 1)
+            std::printf (" >=%u: %llu", 1u << n, (unsigned long long)counts[n]);
+        else if (!n)
+            std::printf (" 1: %llu", (unsigned long long)counts[n]);
+        else
+            std::printf (" %u-%u: %llu", 1u << n, (2u << n) - 1, (unsigned long long)counts[n]);
+    }
+    std::printf ("\n");
+}
+
+int main (int argc, char** argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::fprintf (stderr, "usage: %s NAME [SECONDS]\n", argv[0]);
+        return 1;
+    }
+    const int interval = argc == 3 ? std::atoi (argv[2]) : 0;
+
+    try
+    {
+        std::unique_ptr<StatsRegion> region = StatsRegion::open (argv[1]);
+        const StatsHeader& header = region->header ();
+        const bool running = !kill (header.pid, 0);
+        std::printf ("l2tun pid %d%s\n", header.pid, running ? "" : " (not running)");
+
+        std::vector<ThreadStats> last (header.slots);
+        for (unsigned n = 0; n < header.slots; n++)
+            region->read (n, last[n]);
+
+        if (!interval)
+        {
+            for (unsigned n = 0; n < header.slots; n++)
+            {
+                printCounters (last[n]);
+                // the histograms are read without the seqlock, they are only roughly consistent
+                const StatsSlot* slot = region->slot (n);
+                printLatency ("residence", slot->residence);
+                printLatency ("round trip", slot->rtt);
+                printCoalesced (*slot);
+            }
+            return 0;
+        }
+
+        while (1)
+        {
+            sleep ((unsigned)interval);
+            for (unsigned n = 0; n < header.slots; n++)
+            {
+                ThreadStats now;
+                region->read (n, now);
+                std::printf ("%-10s %10.0f frames/s %10.2f Mbit/s %8llu drops %8llu errors %6llu queued %8llu queue drops\n",
+                    now.name, (double)(now.frames - last[n].frames) / interval,
+                    (double)(now.bytes - last[n].bytes) * 8 / interval / 1e6,
+                    (unsigned long long)now.drops, (unsigned long long)now.errors,
+                    (unsigned long long)now.queueLength, (unsigned long long)now.queueDrops);
+                last[n] = now;
+            }
+            std::fflush (stdout);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf (stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctime>
+
+#include "latencymonitor.hpp"
+#include "stats.hpp"
+#include "console.hpp"
+
+// ------------ local helper functions ------------
+static void printHistogram (const char* name, const Histogram& h);
+
+
+LatencyMonitor::LatencyMonitor (unsigned interval, StatsSlot* receiver, StatsSlot* sender) :
+    m_interval ((uint64_t)interval * 1000000),
+    m_next (0),
+    m_sent (0),
+    m_received (0),
+    m_peerTime (0),
+    m_peerReceived (0)
+{
+    if (!receiver || !sender)
+    {
+        // value initialized, i.e. the histograms are empty
+        m_private.reset (new StatsSlot[2] ());
+        receiver = &m_private[0];
+        sender   = &m_private[1];
+    }
+    m_captured = &receiver->residence;
+    m_injected = &sender->residence;
+    m_rtt      = &sender->rtt;
+}
+
+uint64_t LatencyMonitor::now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t LatencyMonitor::wallClock ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+Probe LatencyMonitor::probe (uint64_t now)
+{
+    uint64_t echoTime = 0;
+    uint64_t echoDelay = 0;
+    {
+        std::lock_guard<std::mutex> lock (m_lock);
+        if (m_peerTime)
+        {
+            echoTime  = m_peerTime;
+            echoDelay = now - m_peerReceived;
+            m_peerTime = 0;
+        }
+    }
+    m_next = now + m_interval;
+    m_sent.fetch_add (1, std::memory_order_relaxed);
+
+    Probe p;
+    p.set (now, echoTime, echoDelay);
+    return p;
+}
+
+void LatencyMonitor::received (const Probe& probe)
+{
+    const uint64_t t = now ();
+    m_received++;
+
+    // the echo of one of our probes, the time the peer held it doesn't count
+    const uint64_t echoTime = probe.getEchoTime ();
+    if (echoTime && t > echoTime + probe.getEchoDelay ())
+        m_rtt->record (t - echoTime - probe.getEchoDelay ());
+
+    std::lock_guard<std::mutex> lock (m_lock);
+    m_peerTime     = probe.getTime ();
+    m_peerReceived = t;
+}
+
+void LatencyMonitor::printStatistics () const
+{
+    Console::Print ("latency probes: %llu sent, %llu received\n",
+        (unsigned long long)m_sent.load (std::memory_order_relaxed), (unsigned long long)m_received);
+    printHistogram ("round trip", *m_rtt);
+    printHistogram ("capture to tunnel", *m_captured);
+    printHistogram ("tunnel to inject", *m_injected);
+}
+
+
+// ------------ local helper functions ------------
+
+void printHistogram (const char* name, const Histogram& h)
+{
+    const uint64_t count = h.count ();
+    if (!count)
+        return;
+    Console::Print ("  %s: p50 %.1f us, p99 %.1f us, p99.9 %.1f us (%llu samples)\n", name,
+        (double)h.percentile (0.5) / 1000, (double)h.percentile (0.99) / 1000,
+        (double)h.percentile (0.999) / 1000, (unsigned long long)count);
+}
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCYMONITOR_HPP
+#define LATENCYMONITOR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "tunnel.hpp"
+
+struct StatsSlot;
+class Histogram;
+
+// Measures the latency of the tunnel with probes exchanged in band with the frames.
+// Each side sends a probe every interval and echoes the last probe of the peer in it,
+// so the round trip time includes the queues of both directions. Besides that, the
+// time frames spend in each direction (from capture until they are sent through the
+// tunnel, from leaving the tunnel until they are injected) is recorded.
+// The receiver thread sends the probes, the sender thread handles the received ones.
+class LatencyMonitor
+{
+public:
+    // interval in milliseconds, the histograms are published in the given stats slots
+    // (the receiver's and the sender's), without them they are kept in private memory
+    LatencyMonitor (unsigned interval, StatsSlot* receiver, StatsSlot* sender);
+    LatencyMonitor (const LatencyMonitor&) = delete;
+    LatencyMonitor& operator=(const LatencyMonitor&) = delete;
+
+    // ns of the monotonic clock, used for the probes
+    static uint64_t now ();
+    // ns since the epoch, the clock of the kernel timestamps of captured and sent frames
+    static uint64_t wallClock ();
+
+    // receiver thread: a probe is due, if now reached the send time of the next one
+    bool isDue (uint64_t now) const
+    {
+        return now >= m_next;
+    }
+    // microseconds until the next probe is due
+    int timeout (uint64_t now) const
+    {
+        return now >= m_next ? 0 : (int)((m_next - now + 999) / 1000);
+    }
+    Probe probe (uint64_t now);
+
+    // sender thread: a probe of the peer was received
+    void received (const Probe& probe);
+
+    // time from capture until the frame is sent through the tunnel
+    Histogram& captured () const
+    {
+        return *m_captured;
+    }
+    // time from leaving the tunnel until the frame is injected
+    Histogram& injected () const
+    {
+        return *m_injected;
+    }
+
+    void printStatistics () const;
+
+private:
+    uint64_t m_interval;
+    std::unique_ptr<StatsSlot[]> m_private;
+    Histogram* m_captured;
+    Histogram* m_injected;
+    Histogram* m_rtt;
+
+    // receiver thread only
+    uint64_t m_next;
+    std::atomic<uint64_t> m_sent;
+    // sender thread only
+    uint64_t m_received;
+
+    // last probe of the peer, echoed once with our next probe
+    std::mutex m_lock;
+    uint64_t m_peerTime;
+    uint64_t m_peerReceived;
+};
+
+#endif
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "mactable.hpp"
+
+
+MacTable::MacTable (const MacTableConfig& config) :
+    m_count (2),
+    m_shift (63),
+    m_aging (config.aging),
+    m_lastExpire (now ())
+{
+    while (m_count * BUCKET_SIZE < config.size)
+    {
+        m_count <<= 1;
+        m_shift--;
+    }
+    // value initialized, i.e. all entries are empty
+    m_buckets.reset (new Bucket[m_count] ());
+}
+
+uint64_t MacTable::now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+// Receiver and sender may insert the same address at the same time, so the bucket
+// is scanned again until the address has a single entry.
+void MacTable::insert (uint64_t key, uint64_t value, uint64_t now)
+{
+    Bucket& b = bucket (key);
+    while (1)
+    {
+        std::atomic<uint64_t>* victim = nullptr;
+        uint64_t victimValue = 0;
+        unsigned victimAge = 0;
+
+        for (std::atomic<uint64_t>& e : b.entries)
+        {
+            const uint64_t v = e.load (std::memory_order_relaxed);
+            if (v && (v >> 16 & ~GROUP_BIT) == key)
+            {
+                // the other thread was faster
+                if (v != value)
+                    e.store (value, std::memory_order_relaxed);
+                return;
+            }
+            const unsigned age = v ? this->age (v, now) : UINT16_MAX + 1;
+            if (!victim || age > victimAge)
+            {
+                victim      = &e;
+                victimValue = v;
+                victimAge   = age;
+            }
+        }
+        // an empty or the oldest entry is replaced, unless another thread took it in the meantime
+        if (!victim->compare_exchange_strong (victimValue, value, std::memory_order_relaxed))
+            continue;
+
+        // both threads may have taken different entries for the address, the first one is kept
+        for (std::atomic<uint64_t>& e : b.entries)
+        {
+            if (&e == victim)
+                return;
+            const uint64_t v = e.load (std::memory_order_relaxed);
+            if (v && (v >> 16 & ~GROUP_BIT) == key)
+            {
+                uint64_t mine = value;
+                victim->compare_exchange_strong (mine, 0, std::memory_order_relaxed);
+                if (v != value)
+                    e.store (value, std::memory_order_relaxed);
+                return;
+            }
+        }
+        return;
+    }
+}
+
+void MacTable::expire (uint64_t now)
+{
+    const uint64_t elapsed = now - m_lastExpire;
+    if (elapsed < m_aging)
+        return;
+    m_lastExpire = now;
+
+    // after a wrap of the time stamps the age of an entry is unknown
+    const bool all = elapsed > UINT16_MAX - m_aging;
+
+    for (size_t b = 0; b < m_count; b++)
+    {
+        for (std::atomic<uint64_t>& e : m_buckets[b].entries)
+        {
+            uint64_t v = e.load (std::memory_order_relaxed);
+            if (v && (all || age (v, now) > m_aging))
+                e.compare_exchange_strong (v, 0, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MACTABLE_HPP
+#define MACTABLE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+struct MacTableConfig
+{
+    size_t   size;  // number of entries, rounded up to a power of two
+    unsigned aging; // seconds until an entry expires
+
+    MacTableConfig () :
+        size (65536),
+        aging (300)
+    {
+    }
+};
+
+// Bridge style table of the side on which a MAC address was seen last.
+// The receiver learns local addresses, the sender remote ones, both without locks:
+// each entry is a single 64 bit word holding the address, the side and the time
+// it was seen last. Addresses are hashed to buckets of one cache line, so a lookup
+// touches exactly one cache line.
+class MacTable
+{
+public:
+    enum Location
+    {
+        UNKNOWN,
+        LOCAL,
+        REMOTE
+    };
+
+    explicit MacTable (const MacTableConfig& config = MacTableConfig());
+    MacTable (const MacTable&) = delete;
+    MacTable& operator=(const MacTable&) = delete;
+
+    // seconds of a coarse monotonic clock, passed to the other methods
+    static uint64_t now ();
+
+    void learn (const uint8_t* mac, Location where, uint64_t now)
+    {
+        const uint64_t key = pack (mac);
+        // source addresses are never group addresses, the bit is used for the side instead
+        if (key & GROUP_BIT)
+            return;
+
+        const uint64_t value = ((key | (where == REMOTE ? GROUP_BIT : 0)) << 16) | (now & 0xffff);
+        for (std::atomic<uint64_t>& e : bucket (key).entries)
+        {
+            const uint64_t v = e.load (std::memory_order_relaxed);
+            if (v && (v >> 16 & ~GROUP_BIT) == key)
+            {
+                // written at most once per second, so the cache line isn't bounced between the threads
+                if (v != value)
+                    e.store (value, std::memory_order_relaxed);
+                return;
+            }
+        }
+        insert (key, value, now);
+    }
+
+    Location lookup (const uint8_t* mac, uint64_t now) const
+    {
+        const uint64_t key = pack (mac);
+        for (const std::atomic<uint64_t>& e : bucket (key).entries)
+        {
+            const uint64_t v = e.load (std::memory_order_relaxed);
+            if (v && (v >> 16 & ~GROUP_BIT) == key)
+            {
+                if (age (v, now) > m_aging)
+                    return UNKNOWN;
+                return v >> 16 & GROUP_BIT ? REMOTE : LOCAL;
+            }
+        }
+        return UNKNOWN;
+    }
+
+    // Removes expired entries. The time stamps are 16 bits wide, so this must be
+    // called regularly by one thread, it only scans the table every aging seconds.
+    void expire (uint64_t now);
+
+    static bool isUnicast (const uint8_t* mac)
+    {
+        return !(mac[0] & 1);
+    }
+
+private:
+    static const unsigned BUCKET_SIZE = 8;
+    // group bit of the first address byte, in the packed address
+    static const uint64_t GROUP_BIT = (uint64_t)1 << 40;
+
+    struct alignas (64) Bucket
+    {
+        std::atomic<uint64_t> entries[BUCKET_SIZE];
+    };
+
+    static uint64_t pack (const uint8_t* mac)
+    {
+        return (uint64_t)mac[0] << 40 | (uint64_t)mac[1] << 32 | (uint64_t)mac[2] << 24
+            | (uint64_t)mac[3] << 16 | (uint64_t)mac[4] << 8 | (uint64_t)mac[5];
+    }
+    // adds an address which wasn't found in its bucket
+    void insert (uint64_t key, uint64_t value, uint64_t now);
+    static unsigned age (uint64_t value, uint64_t now)
+    {
+        return (unsigned)((now - value) & 0xffff);
+    }
+    Bucket& bucket (uint64_t key) const
+    {
+        return m_buckets[(key * 0x9e3779b97f4a7c15ull) >> m_shift];
+    }
+
+    std::unique_ptr<Bucket[]> m_buckets;
+    size_t   m_count;
+    unsigned m_shift;
+    unsigned m_aging;
+    uint64_t m_lastExpire;
+};
+
+#endif
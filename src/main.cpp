@@ -16,12 +16,41 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <iostream>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+#include <system_error>
 
 #include "main.hpp"
 #include "tcpsocket.hpp"
+#include "streamgroup.hpp"
+#include "udpsocket.hpp"
+#include "reactorengine.hpp"
 #include "rawsocket.hpp"
+#include "capturefilter.hpp"
 #include "receiver.hpp"
 #include "sender.hpp"
+#include "tunnel.hpp"
+#include "stats.hpp"
+#include "mactable.hpp"
+#include "latencymonitor.hpp"
+#include "compressor.hpp"
+#include "tlscontext.hpp"
+#if HAVE_AF_XDP
+#include "xdpsocket.hpp"
+#endif
+#if HAVE_TAP
+#include "tapsocket.hpp"
+#endif
+#if HAVE_IO_URING
+#include "uringengine.hpp"
+#endif
+
+// the MTU option is the max. length of the L3 packet, the frame has an Ethernet header
+// and one VLAN tag in front of it
+static const unsigned L2_HEADER_LEN = 18;
 
 
 Application::Application(const char* name, const char* brief, const char* usage, const char* description, const char* version,
@@ -39,6 +68,151 @@ Application::Application(const char* name, const char* brief, const char* usage,
             , &m_options.l2Interface);
     addCmdLineOption (true, 'l', "listen", "PORT",
             "Listen for incoming connections on PORT.", &m_options.serverPort);
+    addCmdLineOption (true, 'B', "backend", "NAME",
+            "Layer 2 backend used to capture and send frames:\n\t"
+            "packet   - PF_PACKET socket (default)\n\t"
+#if HAVE_AF_XDP
+            "xdp      - AF_XDP socket on queue 0 of the interface, zero copy\n\t"
+            "           if the driver supports it, otherwise copy mode.\n\t"
+            "           Captured frames don't reach the host network stack.\n\t"
+            "xdp-copy - AF_XDP socket in copy mode\n\t"
+#endif
+#if HAVE_TAP
+            "tap      - TAP device, created if it doesn't exist. With an MTU of 65535,\n\t"
+            "           the default of this backend, the host hands over GSO frames\n\t"
+            "           of up to 64 KB, which are segmented at the far end. The far\n\t"
+            "           end must use an MTU of 65535 as well.\n\t"
+#endif
+            , &m_options.backend);
+    addCmdLineOption (true, 'T', "transport", "NAME",
+            "Transport used between client and server, must be the same on both sides:\n\t"
+            "tcp - one or more TCP connections (default)\n\t"
+            "udp - one datagram per frame, frames are not retransmitted\n\t"
+            "      if they get lost. Uses GSO/GRO where available.", &m_options.transport);
+    addCmdLineOption (true, 'E', "engine", "NAME",
+            "Engine which moves the frames:\n\t"
+            "threads - one receiver and one sender thread (default)\n\t"
+            "reactor - single thread, both directions run as coroutines on\n\t"
+            "          an epoll reactor. Requires the tcp transport.\n\t"
+#if HAVE_IO_URING
+            "uring   - single thread driving all sockets via io_uring,\n\t"
+            "          requires the packet backend without rings and the\n\t"
+            "          tcp transport. Falls back to threads on older kernels.\n\t"
+#endif
+            , &m_options.engine);
+    addCmdLineOption (true, 'r', "rx-ring", "MB",
+            "Capture frames via a memory mapped receive ring of MB megabytes\n\t"
+            "instead of receiving them one by one.", &m_options.rxRing);
+    addCmdLineOption (true, 't', "tx-ring", "MB",
+            "Send frames via a memory mapped transmit ring of MB megabytes\n\t"
+            "instead of sending them one by one.", &m_options.txRing);
+    addCmdLineOption (true, 'n', "batch", "N",
+            "Receive and send up to N frames per system call, if no ring is used\n\t"
+            "(default 64).", &m_options.batchSize);
+    addCmdLineOption (true, 'P', "huge-pages",
+            "Receive captured frames into buffers backed by huge pages, if no\n\t"
+            "receive ring is used. Falls back to normal pages if none are reserved.", &m_options.hugePages);
+    addCmdLineOption (true, 'b', "qdisc-bypass",
+            "Send frames directly to the network driver, bypassing the\n\t"
+            "queuing discipline of the interface.", &m_options.qdiscBypass);
+    addCmdLineOption (true, 'f', "filter", "RULES",
+            "Capture only frames matching RULES, evaluated in the kernel (packet backend only).\n\t"
+            "RULES is a comma separated list of 'accept|drop TERM...', the first matching\n\t"
+            "rule decides. All terms of a rule must match, each may be prefixed with 'not':\n\t"
+            "type ETHERTYPE, vlan ID|any, src MAC, dst MAC, multicast, broadcast\n\t"
+            "Frames matching no rule are dropped if there is an accept rule.\n\t"
+            "Example: \"drop dst 01:80:c2:00:00:00, accept vlan 10\"", &m_options.filter);
+    addCmdLineOption (true, 'O', "capture-outgoing",
+            "Also capture frames sent by this host. By default only incoming frames\n\t"
+            "are captured, which also keeps frames received through the tunnel\n\t"
+            "from being captured again.", &m_options.captureOutgoing);
+    addCmdLineOption (true, 'c', "coalesce", "USEC[,BYTES[,FRAMES]]",
+            "Coalesce captured frames before sending them through the tunnel.\n\t"
+            "Buffered frames are sent after USEC microseconds at the latest or\n\t"
+            "earlier, if BYTES (default 65536) or FRAMES (default 256) are reached.", &m_options.coalesce);
+#if HAVE_MSG_ZEROCOPY
+    addCmdLineOption (true, 'Z', "zerocopy",
+            "Send coalesced batches of 16 KB and more with MSG_ZEROCOPY, the kernel\n\t"
+            "transmits them directly from our buffers. Requires coalescing and\n\t"
+            "can't be combined with TLS. Only helps with NICs that support\n\t"
+            "scatter-gather, the statistics show how many sends were copied anyway.", &m_options.zeroCopy);
+#endif
+    addCmdLineOption (true, 'z', "compress", "ALGO[,LEVEL]",
+            "Compress the frames of each batch sent through the tunnel, must be enabled\n\t"
+            "on both sides. Requires the tcp transport and the threads engine.\n\t"
+#if HAVE_LZ4
+            "lz4  - fast, LEVEL is the acceleration (default 1)\n\t"
+#endif
+#if HAVE_ZSTD
+            "zstd - better ratio, LEVEL is the compression level (default 1)\n\t"
+#endif
+            "Batches which don't shrink are sent uncompressed and compression is\n\t"
+            "paused for an increasing number of batches.", &m_options.compress);
+    addCmdLineOption (true, 'A', "compress-always",
+            "Don't pause compression for incompressible data.", &m_options.compressAlways);
+    addCmdLineOption (true, 'H', "header-compression",
+            "Compress the Ethernet, IPv4 and UDP headers of the frames of a flow and\n\t"
+            "send the frames of a batch with a single tunnel header. Saves most of the\n\t"
+            "overhead of small frames. Must be enabled on both sides, requires the\n\t"
+            "tcp transport and the threads engine.", &m_options.headerCompression);
+    addCmdLineOption (true, 'u', "mtu", "BYTES",
+            "MTU of the tunneled frames, the max. length of their payload without Ethernet\n\t"
+            "header and VLAN tag (default 1500, e.g. 9000 for jumbo frames, 65535 for the\n\t"
+            "GSO frames of the tap backend). Values above 9216 require the tcp transport.\n\t"
+            "Longer frames are dropped, both sides should use the same value.", &m_options.mtu);
+    addCmdLineOption (true, 'm', "stream-buffer", "KB",
+            "Size of the buffer each tunnel stream is received into (default 4096).", &m_options.streamBuffer);
+    addCmdLineOption (true, 's', "streams", "N",
+            "Open N parallel TCP connections to the server (default 1, max. 16).\n\t"
+            "Frames are distributed by flow, so frames of the same flow stay in order.", &m_options.streams);
+    addCmdLineOption (true, 'L', "learn", "SECONDS",
+            "Learn on which side of the tunnel MAC addresses are located and don't tunnel\n\t"
+            "unicast frames whose destination is on the local segment. Learned\n\t"
+            "addresses expire after SECONDS (e.g. 300). Requires the threads engine.", &m_options.macAging);
+    addCmdLineOption (true, 'q', "queue", "DEPTH[,POLICY]",
+            "Capture and send frames in separate threads connected by a queue of DEPTH\n\t"
+            "frames, same for receiving and injecting. A stalled tunnel connection\n\t"
+            "then fills the queue instead of the socket buffer of the interface.\n\t"
+            "POLICY selects what happens if the queue is full:\n\t"
+            "tail - drop new frames (default)\n\t"
+            "head - drop the oldest frame\n\t"
+            "Requires the threads engine.", &m_options.queue);
+    addCmdLineOption (true, 'p', "priority",
+            "Queue captured frames by priority, taken from the VLAN PCP or the IP DSCP.\n\t"
+            "Network control (PCP 6, 7, PTP, PROFINET) and realtime traffic (PCP 4, 5,\n\t"
+            "e.g. DSCP EF) are sent first, best effort (PCP 0, 2, 3) and background\n\t"
+            "(PCP 1) share the rest by weight. Each class gets a queue of DEPTH. Requires -q.", &m_options.priority);
+    addCmdLineOption (true, 'W', "weights", "BE,BK",
+            "Weights of best effort and background traffic (default 4,1).", &m_options.weights);
+    addCmdLineOption (true, 'F', "fq-codel", "TARGET[,INTERVAL]",
+            "Schedule the queued frames by fq_codel before sending them through the tunnel.\n\t"
+            "Each flow gets its own queue and a fair share, sparse flows are sent first.\n\t"
+            "If the frames of a flow wait longer than TARGET microseconds for at least\n\t"
+            "INTERVAL (default 100000), CoDel drops some of them, which makes TCP flows\n\t"
+            "in the tunnel slow down. The tunnel connections keep only 16 KB of unsent\n\t"
+            "data (TCP_NOTSENT_LOWAT), so that the frames wait in the flow queues\n\t"
+            "instead of the socket buffer. Up to DEPTH frames are queued. Requires -q.", &m_options.fqCodel);
+    addCmdLineOption (true, 'S', "stats", "NAME",
+            "Publish statistics of the receiver and sender thread in the shared memory\n\t"
+            "segment /dev/shm/l2tun-NAME, they can be read with 'l2tun-stat NAME'.\n\t"
+            "Requires the threads engine.", &m_options.stats);
+    addCmdLineOption (true, 'M', "latency", "MS",
+            "Measure the latency of the tunnel. Every MS milliseconds a probe is sent\n\t"
+            "with the frames, the peer echoes it in its next probe and must use this option\n\t"
+            "as well. Also records how long frames take from capture until they are sent\n\t"
+            "through the tunnel and from leaving the tunnel until they are injected, using\n\t"
+            "kernel timestamps with the packet backend. The percentiles are shown by\n\t"
+            "l2tun-stat (see -S) and at exit. Requires the tcp transport and the threads engine.", &m_options.latency);
+#if HAVE_KTLS
+    addCmdLineOption (true, 'C', "tls-cert", "FILE",
+            "Encrypt the tunnel with TLS 1.3. FILE contains the certificate chain and\n\t"
+            "private key in PEM format, it is required on the server. Only the handshake\n\t"
+            "is done in user space, the records are encrypted by the kernel (kTLS), which\n\t"
+            "must support it (module tls). Requires the tcp transport.", &m_options.tlsCert);
+    addCmdLineOption (true, 'a', "tls-ca", "FILE",
+            "Verify the certificate of the peer with the CA certificates in FILE. Required\n\t"
+            "on the client, the server requests a client certificate if it is given.", &m_options.tlsCa);
+#endif
     addCmdLineOption (true, '4', nullptr,
             "Force the use of IPv4 only.", &m_options.ipv4Only);
     addCmdLineOption (true, '6', nullptr,
@@ -56,20 +230,222 @@ int Application::execute (const std::list<std::string>& args)
 
     try
     {
-        RawSocket s = RawSocket::open (m_options.l2Interface);
+        ReceiverConfig receiverConfig;
+        SenderConfig senderConfig;
 
-        if (isServer)
+        const std::string transport = m_options.transport ? m_options.transport : "tcp";
+        if (transport != "tcp" && transport != "udp")
+        {
+            Console::PrintError ("Unknown transport '%s'.\n", transport.c_str());
+            return -1;
+        }
+        if (m_options.mtu && (m_options.mtu < 68 || m_options.mtu > (int)GsoHeader::MTU))
+        {
+            Console::PrintError ("Invalid MTU '%d'.\n", m_options.mtu);
+            return -1;
+        }
+        const bool tap = m_options.backend && std::string (m_options.backend) == "tap";
+        const unsigned mtu = m_options.mtu ? (unsigned)m_options.mtu : tap ? GsoHeader::MTU : 1500;
+        if (transport == "udp" && mtu > 9216)
+        {
+            Console::PrintError ("MTUs above 9216 require the tcp transport.\n");
+            return -1;
+        }
+        // all components limit the length of the whole frame
+        const unsigned maxFrame = mtu + L2_HEADER_LEN;
+        receiverConfig.mtu = maxFrame;
+        senderConfig.mtu   = maxFrame;
+        receiverConfig.queue.mtu = maxFrame; // copied to the sender queue below
+        receiverConfig.aqm.mtu   = maxFrame;
+
+        StreamGroupConfig streamConfig;
+        streamConfig.mtu = maxFrame;
+        if (!parseCoalescing (streamConfig.coalescing) || !parseCompression (streamConfig.compression))
+            return -1;
+        if (m_options.streamBuffer > 0)
+            streamConfig.bufferSize = (size_t)m_options.streamBuffer * 1024;
+        streamConfig.headerCompression = !!m_options.headerCompression;
+        streamConfig.coalescing.zeroCopy = !!m_options.zeroCopy;
+        if (m_options.zeroCopy && (!m_options.coalesce || m_options.tlsCert || m_options.tlsCa))
+        {
+            Console::PrintError ("Zero copy requires coalescing and can't be combined with TLS.\n");
+            return -1;
+        }
+        if (transport == "udp" && (m_options.streams > 1 || m_options.coalesce || m_options.compress
+            || m_options.headerCompression))
+        {
+            Console::PrintError ("Streams, coalescing and compression are only supported by the tcp transport.\n");
+            return -1;
+        }
+        UdpSocketConfig udpConfig;
+        udpConfig.mtu = maxFrame;
+
+        const std::string engine = m_options.engine ? m_options.engine : "threads";
+        if (engine != "threads" && engine != "reactor"
+#if HAVE_IO_URING
+            && engine != "uring"
+#endif
+            )
+        {
+            Console::PrintError ("Unknown engine '%s'.\n", engine.c_str());
+            return -1;
+        }
+        if (engine == "uring" && (transport != "tcp" || m_options.coalesce || m_options.rxRing || m_options.txRing
+            || (m_options.backend && std::string (m_options.backend) != "packet")))
+        {
+            Console::PrintError ("The uring engine requires the packet backend without rings and the tcp transport.\n");
+            return -1;
+        }
+        if (engine == "uring" && mtu >= GsoHeader::MTU)
+        {
+            Console::PrintError ("The uring engine doesn't support GSO frames.\n");
+            return -1;
+        }
+        if (engine == "reactor" && (transport != "tcp" || m_options.coalesce))
+        {
+            Console::PrintError ("The reactor engine requires the tcp transport without coalescing.\n");
+            return -1;
+        }
+
+        if ((m_options.compress || m_options.headerCompression) && engine != "threads")
+        {
+            Console::PrintError ("Compression is only supported by the threads engine.\n");
+            return -1;
+        }
+        if (m_options.stats && engine != "threads")
+        {
+            Console::PrintError ("Statistics are only collected by the threads engine.\n");
+            return -1;
+        }
+        std::unique_ptr<StatsRegion> stats;
+        if (m_options.stats)
+        {
+            try
+            {
+                stats = StatsRegion::create (m_options.stats, 2);
+            }
+            catch (const std::system_error& e)
+            {
+                Console::PrintError ("%s\n", e.what());
+                return -1;
+            }
+            receiverConfig.stats = stats->slot (0);
+            senderConfig.stats   = stats->slot (1);
+        }
+
+        std::unique_ptr<LatencyMonitor> monitor;
+        if (m_options.latency)
+        {
+            if (transport != "tcp" || engine != "threads")
+            {
+                Console::PrintError ("Latency probes require the tcp transport and the threads engine.\n");
+                return -1;
+            }
+            if (m_options.latency < 1 || m_options.latency > 60000)
+            {
+                Console::PrintError ("Invalid probe interval '%d'.\n", m_options.latency);
+                return -1;
+            }
+            monitor = std::make_unique<LatencyMonitor> ((unsigned)m_options.latency, receiverConfig.stats, senderConfig.stats);
+            receiverConfig.monitor = monitor.get ();
+            senderConfig.monitor   = monitor.get ();
+        }
+
+        if (!parseQueue (receiverConfig.queue))
+            return -1;
+        // frames from the tunnel are injected in the order they were sent
+        senderConfig.queue         = receiverConfig.queue;
+        senderConfig.queue.classes = 1;
+        senderConfig.queue.strict  = 0;
+        if (!parseFqCodel (receiverConfig.aqm, receiverConfig.queue.depth))
+            return -1;
+        if (receiverConfig.aqm.isEnabled ())
+            streamConfig.notSentLowat = receiverConfig.aqm.burst;
+        if (m_options.queue && engine != "threads")
         {
-            TcpSocket server = TcpSocket::listen (m_options.serverPort, 1);
+            Console::PrintError ("Queues are only supported by the threads engine.\n");
+            return -1;
+        }
 
+        if (m_options.macAging && engine != "threads")
+        {
+            Console::PrintError ("MAC learning is only supported by the threads engine.\n");
+            return -1;
+        }
+        if (m_options.macAging < 0 || m_options.macAging > 32767)
+        {
+            Console::PrintError ("Invalid aging time '%d'.\n", m_options.macAging);
+            return -1;
+        }
+        std::unique_ptr<MacTable> macTable;
+        if (m_options.macAging)
+        {
+            MacTableConfig config;
+            config.aging = (unsigned)m_options.macAging;
+            macTable = std::make_unique<MacTable> (config);
+            receiverConfig.macTable = macTable.get ();
+            senderConfig.macTable   = macTable.get ();
+        }
+
+#if HAVE_KTLS
+        std::unique_ptr<TlsContext> tls;
+        if (m_options.tlsCert || m_options.tlsCa)
+        {
+            if (transport != "tcp")
+            {
+                Console::PrintError ("TLS is only supported by the tcp transport.\n");
+                return -1;
+            }
+            if (isServer ? !m_options.tlsCert : !m_options.tlsCa)
+            {
+                Console::PrintError (isServer ? "The server requires a TLS certificate.\n"
+                    : "The client requires CA certificates to verify the server.\n");
+                return -1;
+            }
+            TlsConfig config;
+            if (m_options.tlsCert)
+                config.certificate = m_options.tlsCert;
+            if (m_options.tlsCa)
+                config.ca = m_options.tlsCa;
+            tls = TlsContext::create (config, isServer);
+            streamConfig.tls = tls.get ();
+        }
+#endif
+
+        std::unique_ptr<L2Socket> s = openL2Socket (receiverConfig.queue.depth * receiverConfig.queue.classes
+            + (receiverConfig.aqm.isEnabled () ? receiverConfig.aqm.limit : 0), mtu);
+        if (!s)
+            return -1;
+
+        if (isServer)
+        {
             std::string addr;
             uint16_t port;
+            std::unique_ptr<TunnelSocket> tunnel;
 
-            TcpSocket tcpConnection = server.accept (addr, port);
+            if (transport == "udp")
+            {
+                tunnel = UdpSocket::accept (m_options.serverPort, addr, port, udpConfig);
+            }
+            else
+            {
+                TcpSocket server = TcpSocket::listen (m_options.serverPort, Hello::MAX_STREAMS);
+                tunnel = std::make_unique<StreamGroup> (StreamGroup::accept (server, addr, port, streamConfig));
+            }
             std::cout << addr << ":" << port << std::endl;
+            tunnel->setLatencyMonitor (monitor.get ());
+            tunnel->setStats (receiverConfig.stats);
 
-            Receiver receiverThread (1500, &s, &tcpConnection);
-            Sender senderThread (1500, &s, &tcpConnection);
+            if (engine == "uring" && runUringEngine (s.get(), tunnel.get(), streamConfig))
+                return 0;
+            if (engine == "reactor")
+            {
+                runReactorEngine (s.get(), tunnel.get(), streamConfig);
+                return 0;
+            }
+
+            Receiver receiverThread (receiverConfig, s.get(), tunnel.get());
+            Sender senderThread (senderConfig, s.get(), tunnel.get());
             while (1)
             {
                 sleep (1);
@@ -95,15 +471,37 @@ int Application::execute (const std::list<std::string>& args)
                 Console::PrintError ("Invalid port numer '%s'.\n", args.back().c_str());
                 return -1;
             }
+            int count = m_options.streams ? m_options.streams : 1;
+            if (count < 1 || count > Hello::MAX_STREAMS)
+            {
+                Console::PrintError ("Invalid number of streams '%d'.\n", count);
+                return -1;
+            }
+
+            std::unique_ptr<TunnelSocket> tunnel;
+            if (transport == "udp")
+                tunnel = UdpSocket::connect (args.front(), port, udpConfig);
+            else
+                tunnel = std::make_unique<StreamGroup> (StreamGroup::connect (args.front(), port, (unsigned)count, streamConfig));
+            tunnel->setLatencyMonitor (monitor.get ());
+            tunnel->setStats (receiverConfig.stats);
+
+            if (engine == "uring" && runUringEngine (s.get(), tunnel.get(), streamConfig))
+                return 0;
+            if (engine == "reactor")
+            {
+                runReactorEngine (s.get(), tunnel.get(), streamConfig);
+                return 0;
+            }
+
 std::binary_semaphore sem(0);
-            TcpSocket tcpConnection = TcpSocket::connect (args.front(), port);
-            Receiver receiverThread (1500, &s, &tcpConnection, &sem);
-            Sender senderThread (1500, &s, &tcpConnection, &sem);
+            Receiver receiverThread (receiverConfig, s.get(), tunnel.get(), &sem);
+            Sender senderThread (senderConfig, s.get(), tunnel.get(), &sem);
 
             sem.acquire();
             Console::PrintDebug ("sender or receiver terminated\n");
-            tcpConnection.cancel ();
-            s.cancel ();
+            tunnel->cancel ();
+            s->cancel ();
 //            receiverThread.join ();
 //            senderThread.join ();
 
@@ -120,6 +518,241 @@ std::binary_semaphore sem(0);
     return 0;
 }
 
+bool Application::parseCompression (CompressorConfig& config) const
+{
+    if (!m_options.compress)
+        return true;
+
+    char algorithm[8];
+    int level = config.level;
+    if (std::sscanf (m_options.compress, "%7[a-z0-9],%d", algorithm, &level) < 1)
+    {
+        Console::PrintError ("Invalid compression parameters '%s'.\n", m_options.compress);
+        return false;
+    }
+    const std::string name = algorithm;
+    if (name == "lz4")
+        config.algorithm = CompressedHeader::LZ4;
+    else if (name == "zstd")
+        config.algorithm = CompressedHeader::ZSTD;
+    if (!Compressor::isSupported (config.algorithm))
+    {
+        Console::PrintError ("Unsupported compression algorithm '%s'.\n", algorithm);
+        return false;
+    }
+    config.level    = level;
+    config.adaptive = !m_options.compressAlways;
+    return true;
+}
+
+bool Application::parseQueue (FrameQueueConfig& config) const
+{
+    if (!m_options.queue)
+    {
+        if (m_options.priority || m_options.weights)
+        {
+            Console::PrintError ("Priority queueing requires a queue (-q).\n");
+            return false;
+        }
+        return true;
+    }
+
+    long depth = 0;
+    char policy[8] = "tail";
+    if (std::sscanf (m_options.queue, "%ld,%7s", &depth, policy) < 1 || depth < 1 || depth > 1024 * 1024
+        || (std::strcmp (policy, "tail") && std::strcmp (policy, "head")))
+    {
+        Console::PrintError ("Invalid queue parameters '%s'.\n", m_options.queue);
+        return false;
+    }
+    config.depth  = (size_t)depth;
+    config.policy = std::strcmp (policy, "head") ? FrameQueueConfig::TAIL_DROP : FrameQueueConfig::HEAD_DROP;
+
+    if (m_options.weights && !m_options.priority)
+    {
+        Console::PrintError ("Weights require priority queueing (-p).\n");
+        return false;
+    }
+    if (m_options.priority)
+    {
+        // classes as returned by trafficClass, network control and realtime are strict
+        config.classes = FrameQueueConfig::MAX_CLASSES;
+        config.strict  = 2;
+        if (m_options.weights)
+        {
+            unsigned be = 0, bk = 0;
+            if (std::sscanf (m_options.weights, "%u,%u", &be, &bk) != 2 || be < 1 || bk < 1 || be > 1000 || bk > 1000)
+            {
+                Console::PrintError ("Invalid weights '%s'.\n", m_options.weights);
+                return false;
+            }
+            config.weights[2] = be;
+            config.weights[3] = bk;
+        }
+    }
+    return true;
+}
+
+bool Application::parseFqCodel (FqCodelConfig& config, size_t limit) const
+{
+    if (!m_options.fqCodel)
+        return true;
+    if (!m_options.queue)
+    {
+        Console::PrintError ("fq_codel requires a queue (-q).\n");
+        return false;
+    }
+
+    long target = 0;
+    long interval = (long)config.interval;
+    if (std::sscanf (m_options.fqCodel, "%ld,%ld", &target, &interval) < 1 || target < 1 || target > 1000000
+        || interval < target || interval > 10000000)
+    {
+        Console::PrintError ("Invalid fq_codel parameters '%s'.\n", m_options.fqCodel);
+        return false;
+    }
+    config.target   = (uint32_t)target;
+    config.interval = (uint32_t)interval;
+    config.limit    = limit;
+    return true;
+}
+
+bool Application::parseCoalescing (CoalescerConfig& config) const
+{
+    if (!m_options.coalesce)
+        return true;
+
+    int latency = -1;
+    long bytes = (long)config.maxBytes;
+    int frames = (int)config.maxFrames;
+    if (std::sscanf (m_options.coalesce, "%d,%ld,%d", &latency, &bytes, &frames) < 1
+        || latency < 0 || bytes < 1 || frames < 1)
+    {
+        Console::PrintError ("Invalid coalescing parameters '%s'.\n", m_options.coalesce);
+        return false;
+    }
+    config.latency   = latency;
+    config.maxBytes  = (size_t)bytes;
+    config.maxFrames = (unsigned)frames;
+    return true;
+}
+
+bool Application::runUringEngine (L2Socket* l2Socket, TunnelSocket* tunnel, const StreamGroupConfig& streamConfig) const
+{
+#if HAVE_IO_URING
+    UringEngineConfig config;
+    config.mtu        = streamConfig.mtu;
+    config.bufferSize = streamConfig.bufferSize;
+
+    std::unique_ptr<UringEngine> e = UringEngine::create (config, *dynamic_cast<RawSocket*> (l2Socket),
+        *dynamic_cast<StreamGroup*> (tunnel));
+    if (e)
+    {
+        e->run ();
+        return true;
+    }
+    Console::PrintVerbose ("Falling back to threads\n");
+#else
+    (void)l2Socket;
+    (void)tunnel;
+    (void)streamConfig;
+#endif
+    return false;
+}
+
+void Application::runReactorEngine (L2Socket* l2Socket, TunnelSocket* tunnel, const StreamGroupConfig& streamConfig) const
+{
+    ReactorEngineConfig config;
+    config.mtu        = streamConfig.mtu;
+    config.bufferSize = streamConfig.bufferSize;
+
+    ReactorEngine e (config, l2Socket, dynamic_cast<StreamGroup*> (tunnel));
+    e.run ();
+}
+
+std::unique_ptr<L2Socket> Application::openL2Socket (size_t queueDepth, unsigned mtu) const
+{
+    const std::string backend = m_options.backend ? m_options.backend : "packet";
+
+    if (backend == "packet")
+    {
+        RawSocketConfig config;
+        config.mtu         = mtu + L2_HEADER_LEN;
+        config.headroom    = sizeof (TunnelHeader);
+        config.rxRingSize  = (size_t)m_options.rxRing * 1024 * 1024;
+        config.txRingSize  = (size_t)m_options.txRing * 1024 * 1024;
+        config.qdiscBypass = !!m_options.qdiscBypass;
+        config.hugePages   = !!m_options.hugePages;
+        if (m_options.batchSize > 0)
+            config.batchSize = (unsigned)m_options.batchSize;
+        config.ignoreOutgoing = !m_options.captureOutgoing;
+        config.timestamps     = m_options.latency > 0;
+        // only a tap backend at the far end sends GSO frames, it requires this MTU
+        config.gso            = mtu >= GsoHeader::MTU;
+        // queued frames stay in the receive buffers, besides them the receiver needs
+        // buffers for two batches and the frames it is sending
+        if (queueDepth)
+            config.rxPoolSize = (unsigned)(std::bit_ceil (queueDepth) + 3 * std::max (config.batchSize, 64u));
+        if (m_options.filter)
+        {
+            try
+            {
+                config.filter = CaptureFilter::compile (m_options.filter);
+            }
+            catch (const std::invalid_argument& e)
+            {
+                Console::PrintError ("%s.\n", e.what());
+                return nullptr;
+            }
+        }
+
+        return std::make_unique<RawSocket> (RawSocket::open (m_options.l2Interface, config));
+    }
+#if HAVE_AF_XDP
+    if (backend == "xdp" || backend == "xdp-copy")
+    {
+        if (m_options.filter)
+        {
+            Console::PrintError ("Capture filters are only supported by the packet backend.\n");
+            return nullptr;
+        }
+        XdpSocketConfig config;
+        config.mtu      = mtu + L2_HEADER_LEN;
+        config.headroom = sizeof (TunnelHeader);
+        config.copyMode = backend == "xdp-copy";
+
+        std::unique_ptr<XdpSocket> s = XdpSocket::open (m_options.l2Interface, config);
+        Console::PrintDebug ("AF_XDP socket in %s mode\n", s->isZeroCopy() ? "zero copy" : "copy");
+        return s;
+    }
+#endif
+#if HAVE_TAP
+    if (backend == "tap")
+    {
+        if (m_options.filter)
+        {
+            Console::PrintError ("Capture filters are only supported by the packet backend.\n");
+            return nullptr;
+        }
+        TapSocketConfig config;
+        config.mtu       = mtu + L2_HEADER_LEN;
+        config.headroom  = sizeof (TunnelHeader);
+        config.hugePages = !!m_options.hugePages;
+        config.offloads  = mtu >= GsoHeader::MTU;
+        if (m_options.batchSize > 0)
+            config.batchSize = (unsigned)m_options.batchSize;
+        // like with the packet backend, queued frames stay in the receive buffers
+        if (queueDepth)
+            config.rxPoolSize = (unsigned)(std::bit_ceil (queueDepth) + 3 * std::max (config.batchSize, 64u));
+
+        return TapSocket::open (m_options.l2Interface, config);
+    }
+#endif
+
+    Console::PrintError ("Unknown backend '%s'.\n", backend.c_str());
+    return nullptr;
+}
+
 
 int main (int argc, char** argv)
 {
@@ -24,9 +24,18 @@
 #include <list>
 #include <cstddef>
 #include <csignal>
+#include <memory>
 
 #include "cmdlineapp.hpp"
 
+class L2Socket;
+class TunnelSocket;
+struct CoalescerConfig;
+struct CompressorConfig;
+struct StreamGroupConfig;
+struct FrameQueueConfig;
+struct FqCodelConfig;
+
 struct appOptions
 {
     const char*  l2Interface;
@@ -34,13 +43,67 @@ struct appOptions
     int          serverPort;
     int          ipv4Only;
     int          ipv6Only;
+    int          rxRing;
+    int          txRing;
+    int          qdiscBypass;
+    int          batchSize;
+    const char*  backend;
+    const char*  coalesce;
+    int          streamBuffer;
+    int          streams;
+    const char*  transport;
+    const char*  engine;
+    const char*  filter;
+    int          captureOutgoing;
+    const char*  stats;
+    int          macAging;
+    const char*  compress;
+    int          compressAlways;
+    int          headerCompression;
+    const char*  tlsCert;
+    const char*  tlsCa;
+    int          zeroCopy;
+    int          hugePages;
+    const char*  queue;
+    int          priority;
+    const char*  weights;
+    const char*  fqCodel;
+    int          latency;
+    int          mtu;
 
     appOptions () :
         l2Interface (nullptr),
         serverIP (nullptr),
         serverPort (0),
         ipv4Only (0),
-        ipv6Only (0)
+        ipv6Only (0),
+        rxRing (0),
+        txRing (0),
+        qdiscBypass (0),
+        batchSize (0),
+        backend (nullptr),
+        coalesce (nullptr),
+        streamBuffer (0),
+        streams (0),
+        transport (nullptr),
+        engine (nullptr),
+        filter (nullptr),
+        captureOutgoing (0),
+        stats (nullptr),
+        macAging (0),
+        compress (nullptr),
+        compressAlways (0),
+        headerCompression (0),
+        tlsCert (nullptr),
+        tlsCa (nullptr),
+        zeroCopy (0),
+        hugePages (0),
+        queue (nullptr),
+        priority (0),
+        weights (nullptr),
+        fqCodel (nullptr),
+        latency (0),
+        mtu (0)
     {
     }
 };
@@ -56,6 +119,17 @@ public:
     int execute (const std::list<std::string>& args);
 
 private:
+    // queueDepth is the number of captured frames the receiver queues, mtu is the L3 MTU
+    std::unique_ptr<L2Socket> openL2Socket (size_t queueDepth, unsigned mtu) const;
+    bool parseCoalescing (CoalescerConfig& config) const;
+    bool parseQueue (FrameQueueConfig& config) const;
+    // limit is the max. number of frames in the flow queues
+    bool parseFqCodel (FqCodelConfig& config, size_t limit) const;
+    bool parseCompression (CompressorConfig& config) const;
+    // returns false if io_uring is not available
+    bool runUringEngine (L2Socket* l2Socket, TunnelSocket* tunnel, const StreamGroupConfig& streamConfig) const;
+    void runReactorEngine (L2Socket* l2Socket, TunnelSocket* tunnel, const StreamGroupConfig& streamConfig) const;
+
     appOptions m_options;
 
 };
@@ -23,39 +23,113 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include <cstring>
+#include <cerrno>
 
 #include "rawsocket.hpp"
+#include "gso.hpp"
 #include "bug.hpp"
 
-RawSocket::RawSocket (RAW_SOCKET s) : m_socket (s)
+// block size of the rings, must be a multiple of the page size
+static const size_t RING_BLOCK_SIZE = 256 * 1024;
+// max. time in ms until the kernel hands a partially filled block to us
+static const unsigned RX_RING_BLOCK_TIMEOUT = 1;
+// in tx ring frames, the frame data follows directly the aligned header
+static const size_t TX_RING_DATA_OFFSET = TPACKET_ALIGN (sizeof (struct tpacket3_hdr));
+// the kernel passes VLAN tags of received frames separately, they are put back in front of the frame
+static const size_t VLAN_TAG_LEN = 4;
+// room for the PACKET_AUXDATA message and the timestamp of a received frame
+static const size_t RX_CONTROL_SIZE = CMSG_SPACE (sizeof (struct tpacket_auxdata))
+    + CMSG_SPACE (sizeof (struct scm_timestamping));
+
+// ------------ local helper functions ------------
+static uint8_t* insertVlanTag (uint8_t* frame, size_t len, uint16_t tpid, uint16_t tci);
+static uint64_t nanoseconds (const struct timespec& ts);
+
+
+RawSocket::RawSocket (RAW_SOCKET s) :
+    m_socket (s),
+    m_poolDrops (0),
+    m_headroom (0),
+    m_mtu (0),
+    m_timestamps (false),
+    m_txSocket (INVALID_RAWSOCKET),
+    m_txStamp (false),
+    m_gsoSocket (INVALID_RAWSOCKET),
+    m_ringMap (nullptr),
+    m_ringMapSize (0),
+    m_rx (),
+    m_tx ()
 {
 }
 
-RawSocket::RawSocket (RawSocket&& obj)
+RawSocket::RawSocket (RawSocket&& obj) :
+    m_rxPoolConfig (obj.m_rxPoolConfig),
+    m_rxPool (std::move (obj.m_rxPool)),
+    m_rxRefs (std::move (obj.m_rxRefs)),
+    m_rxMsgs (std::move (obj.m_rxMsgs)),
+    m_rxIov (std::move (obj.m_rxIov)),
+    m_rxControl (std::move (obj.m_rxControl)),
+    m_rxTimes (std::move (obj.m_rxTimes)),
+    m_poolDrops (obj.m_poolDrops),
+    m_txMsgs (std::move (obj.m_txMsgs)),
+    m_txIov (std::move (obj.m_txIov)),
+    m_txControl (std::move (obj.m_txControl))
 {
-    m_socket = obj.m_socket;
-    obj.m_socket = INVALID_RAWSOCKET;
+    m_socket      = obj.m_socket;
+    m_headroom    = obj.m_headroom;
+    m_mtu         = obj.m_mtu;
+    m_timestamps  = obj.m_timestamps;
+    m_txSocket    = obj.m_txSocket;
+    m_txStamp     = obj.m_txStamp;
+    m_gsoSocket   = obj.m_gsoSocket;
+    m_ringMap     = obj.m_ringMap;
+    m_ringMapSize = obj.m_ringMapSize;
+    m_rx          = obj.m_rx;
+    m_tx          = obj.m_tx;
+    obj.m_socket  = INVALID_RAWSOCKET;
+    obj.m_txSocket = INVALID_RAWSOCKET;
+    obj.m_gsoSocket = INVALID_RAWSOCKET;
+    obj.m_ringMap = nullptr;
 }
 
 RawSocket::~RawSocket ()
 {
+    if (m_ringMap)
+    {
+        ::munmap (m_ringMap, m_ringMapSize);
+        m_ringMap = nullptr;
+    }
     if (m_socket != INVALID_RAWSOCKET)
     {
         // we directly call close becaus RawSocket::close might throw an exception
         ::close (m_socket);
         m_socket = INVALID_RAWSOCKET;
     }
+    if (m_txSocket != INVALID_RAWSOCKET)
+    {
+        ::close (m_txSocket);
+        m_txSocket = INVALID_RAWSOCKET;
+    }
+    if (m_gsoSocket != INVALID_RAWSOCKET)
+    {
+        ::close (m_gsoSocket);
+        m_gsoSocket = INVALID_RAWSOCKET;
+    }
 }
 
-RawSocket RawSocket::open (const std::string& interface)
+RawSocket RawSocket::open (const std::string& interface, const RawSocketConfig& config)
 {
     int ifIndex = if_nametoindex (interface.c_str ());
     if (!ifIndex)
         throw SocketException();
 
-    RawSocket s (socket (PF_PACKET, SOCK_RAW, htons(ETH_P_ALL)));
+    // no protocol until bind, so nothing is queued before the filter is attached
+    RawSocket s (socket (PF_PACKET, SOCK_RAW, 0));
     if (!s.isValid())
         throw SocketException();
 
@@ -65,12 +139,247 @@ RawSocket RawSocket::open (const std::string& interface)
     sll.sll_protocol = htons(ETH_P_ALL);
     sll.sll_ifindex = ifIndex;
 
+    s.m_headroom = config.headroom;
+    s.m_mtu      = config.mtu;
+
+    if (config.qdiscBypass)
+    {
+        const int enable = 1;
+        if (::setsockopt (s.m_socket, SOL_PACKET, PACKET_QDISC_BYPASS, &enable, sizeof (enable)))
+            throw SocketException ();
+    }
+
+    if (!config.filter.empty ())
+    {
+        struct sock_fprog prog;
+        prog.len    = (unsigned short)config.filter.size ();
+        prog.filter = const_cast<struct sock_filter*> (config.filter.data ());
+        if (::setsockopt (s.m_socket, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof (prog)))
+            throw SocketException ();
+    }
+#if HAVE_PACKET_IGNORE_OUTGOING
+    if (config.ignoreOutgoing)
+    {
+        // otherwise every frame we inject is captured again and sent back through the tunnel
+        const int enable = 1;
+        if (::setsockopt (s.m_socket, SOL_PACKET, PACKET_IGNORE_OUTGOING, &enable, sizeof (enable)))
+            throw SocketException ();
+    }
+#endif
+    if (config.timestamps)
+    {
+        // software timestamps, taken when the frame enters the network stack
+        const int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (::setsockopt (s.m_socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof (flags)))
+            throw SocketException ();
+        s.m_timestamps = true;
+    }
+
+    // the rings are set up before binding, as recommended by the kernel documentation
+    if (config.rxRingSize || config.txRingSize)
+        s.setupRings (config);
+    if (!config.rxRingSize || !config.txRingSize)
+        s.setupMsgs (config);
+
     if (bind(s.m_socket, (struct sockaddr *)&sll, sizeof(sll)) < 0)
         throw SocketException();
 
+    // frames sent via the tx ring can't carry a timestamp request
+    if (config.timestamps && !config.txRingSize)
+        s.setupTxTimestamps (ifIndex, config);
+    if (config.gso)
+        s.setupGso (ifIndex, config);
+
     return s;
 }
 
+void RawSocket::setupMsgs (const RawSocketConfig& config)
+{
+    const unsigned batch = config.batchSize ? config.batchSize : 1;
+
+    if (!config.rxRingSize)
+    {
+        const int enable = 1;
+        if (::setsockopt (m_socket, SOL_PACKET, PACKET_AUXDATA, &enable, sizeof (enable)))
+            throw SocketException ();
+
+        m_rxPoolConfig.count      = config.rxPoolSize ? config.rxPoolSize : 2 * batch;
+        // one byte more than the MTU, so longer frames are recognized although they are truncated
+        m_rxPoolConfig.bufferSize = config.headroom + VLAN_TAG_LEN + config.mtu + 1;
+        m_rxPoolConfig.hugePages  = config.hugePages;
+        m_rxRefs.resize (batch);
+        m_rxMsgs.resize (batch);
+        m_rxIov.resize (batch);
+        m_rxControl.resize (batch * RX_CONTROL_SIZE);
+        if (config.timestamps)
+            m_rxTimes.resize (batch);
+
+        for (unsigned n = 0; n < batch; n++)
+        {
+            m_rxIov[n].iov_base = nullptr;
+            m_rxIov[n].iov_len  = config.mtu + 1;
+            std::memset (&m_rxMsgs[n], 0, sizeof (m_rxMsgs[n]));
+            m_rxMsgs[n].msg_hdr.msg_iov     = &m_rxIov[n];
+            m_rxMsgs[n].msg_hdr.msg_iovlen  = 1;
+            m_rxMsgs[n].msg_hdr.msg_control = m_rxControl.data () + n * RX_CONTROL_SIZE;
+        }
+    }
+    if (!config.txRingSize)
+    {
+        m_txMsgs.resize (batch);
+        m_txIov.resize (batch);
+
+        for (unsigned n = 0; n < batch; n++)
+        {
+            std::memset (&m_txMsgs[n], 0, sizeof (m_txMsgs[n]));
+            m_txMsgs[n].msg_hdr.msg_iov    = &m_txIov[n];
+            m_txMsgs[n].msg_hdr.msg_iovlen = 1;
+        }
+    }
+}
+
+void RawSocket::setupRings (const RawSocketConfig& config)
+{
+    const int version = TPACKET_V3;
+    if (::setsockopt (m_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof (version)))
+        throw SocketException ();
+
+    struct tpacket_req3 rxReq;
+    struct tpacket_req3 txReq;
+    std::memset (&rxReq, 0, sizeof (rxReq));
+    std::memset (&txReq, 0, sizeof (txReq));
+
+    // all ring options must be set before the first ring is created
+    if (config.rxRingSize)
+    {
+        // reserve space in front of each frame, so that the caller can prepend its own header
+        const unsigned reserve = (unsigned)(config.headroom + VLAN_TAG_LEN);
+        if (::setsockopt (m_socket, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof (reserve)))
+            throw SocketException ();
+    }
+    if (config.txRingSize)
+    {
+        // drop malformed frames instead of stopping the transmission
+        const int loss = 1;
+        if (::setsockopt (m_socket, SOL_PACKET, PACKET_LOSS, &loss, sizeof (loss)))
+            throw SocketException ();
+    }
+
+    if (config.rxRingSize)
+    {
+        rxReq.tp_block_size = RING_BLOCK_SIZE;
+        rxReq.tp_block_nr   = (unsigned)(config.rxRingSize / RING_BLOCK_SIZE);
+        if (rxReq.tp_block_nr < 2)
+            rxReq.tp_block_nr = 2;
+        // in V3 the rx frames are variable sized, tp_frame_size is only used for sanity checks
+        rxReq.tp_frame_size = TPACKET_ALIGN (TPACKET3_HDRLEN + config.headroom + VLAN_TAG_LEN + config.mtu + 1);
+        rxReq.tp_frame_nr   = (rxReq.tp_block_size / rxReq.tp_frame_size) * rxReq.tp_block_nr;
+        rxReq.tp_retire_blk_tov = RX_RING_BLOCK_TIMEOUT;
+
+        if (::setsockopt (m_socket, SOL_PACKET, PACKET_RX_RING, &rxReq, sizeof (rxReq)))
+            throw SocketException ();
+    }
+
+    if (config.txRingSize)
+    {
+        // tx frames have a fixed size
+        txReq.tp_block_size = RING_BLOCK_SIZE;
+        txReq.tp_block_nr   = (unsigned)(config.txRingSize / RING_BLOCK_SIZE);
+        if (txReq.tp_block_nr < 2)
+            txReq.tp_block_nr = 2;
+        txReq.tp_frame_size = TPACKET_ALIGN (TX_RING_DATA_OFFSET + config.mtu);
+        txReq.tp_frame_nr   = (txReq.tp_block_size / txReq.tp_frame_size) * txReq.tp_block_nr;
+
+        if (::setsockopt (m_socket, SOL_PACKET, PACKET_TX_RING, &txReq, sizeof (txReq)))
+            throw SocketException ();
+    }
+
+    // the tx ring is mapped directly behind the rx ring
+    const size_t rxSize = (size_t)rxReq.tp_block_size * rxReq.tp_block_nr;
+    const size_t txSize = (size_t)txReq.tp_block_size * txReq.tp_block_nr;
+
+    void* map = ::mmap (nullptr, rxSize + txSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_socket, 0);
+    if (map == MAP_FAILED)
+        throw SocketException ();
+    m_ringMap     = (uint8_t*)map;
+    m_ringMapSize = rxSize + txSize;
+
+    if (rxSize)
+    {
+        m_rx.base       = m_ringMap;
+        m_rx.blockSize  = rxReq.tp_block_size;
+        m_rx.blockCount = rxReq.tp_block_nr;
+    }
+    if (txSize)
+    {
+        m_tx.base           = m_ringMap + rxSize;
+        m_tx.blockSize      = txReq.tp_block_size;
+        m_tx.frameSize      = txReq.tp_frame_size;
+        m_tx.framesPerBlock = txReq.tp_block_size / txReq.tp_frame_size;
+        m_tx.frameCount     = txReq.tp_frame_nr;
+    }
+}
+
+void RawSocket::setupTxTimestamps (int ifIndex, const RawSocketConfig& config)
+{
+    m_txSocket = socket (PF_PACKET, SOCK_RAW, 0);
+    if (m_txSocket == INVALID_RAWSOCKET)
+        throw SocketException ();
+
+    if (config.qdiscBypass)
+    {
+        const int enable = 1;
+        if (::setsockopt (m_txSocket, SOL_PACKET, PACKET_QDISC_BYPASS, &enable, sizeof (enable)))
+            throw SocketException ();
+    }
+    // only frames requesting it in their control message are timestamped, the
+    // timestamps carry the number of the request instead of a copy of the frame
+    const int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (::setsockopt (m_txSocket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof (flags)))
+        throw SocketException ();
+
+    // without a protocol the socket doesn't receive any frames
+    struct sockaddr_ll sll;
+    std::memset (&sll, 0, sizeof (sll));
+    sll.sll_family  = AF_PACKET;
+    sll.sll_ifindex = ifIndex;
+    if (bind (m_txSocket, (struct sockaddr *)&sll, sizeof (sll)) < 0)
+        throw SocketException ();
+
+    m_txControl.resize (CMSG_SPACE (sizeof (uint32_t)));
+    struct cmsghdr* cmsg = (struct cmsghdr*)m_txControl.data ();
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SO_TIMESTAMPING;
+    cmsg->cmsg_len   = CMSG_LEN (sizeof (uint32_t));
+    const uint32_t request = SOF_TIMESTAMPING_TX_SOFTWARE;
+    std::memcpy (CMSG_DATA (cmsg), &request, sizeof (request));
+}
+
+void RawSocket::setupGso (int ifIndex, const RawSocketConfig& config)
+{
+    m_gsoSocket = socket (PF_PACKET, SOCK_RAW, 0);
+    if (m_gsoSocket == INVALID_RAWSOCKET)
+        throw SocketException ();
+
+    if (config.qdiscBypass)
+    {
+        const int enable = 1;
+        if (::setsockopt (m_gsoSocket, SOL_PACKET, PACKET_QDISC_BYPASS, &enable, sizeof (enable)))
+            throw SocketException ();
+    }
+    const int enable = 1;
+    if (::setsockopt (m_gsoSocket, SOL_PACKET, PACKET_VNET_HDR, &enable, sizeof (enable)))
+        throw SocketException ();
+
+    // without a protocol the socket doesn't receive any frames
+    struct sockaddr_ll sll;
+    std::memset (&sll, 0, sizeof (sll));
+    sll.sll_family  = AF_PACKET;
+    sll.sll_ifindex = ifIndex;
+    if (bind (m_gsoSocket, (struct sockaddr *)&sll, sizeof (sll)) < 0)
+        throw SocketException ();
+}
+
 void RawSocket::close ()
 {
     if (::close (m_socket))
@@ -87,6 +396,9 @@ void RawSocket::cancel () const
 
 size_t RawSocket::recv (void *buf, size_t len) const
 {
+    // in ring mode, the frames don't end up in the socket queue
+    BUG_ON (m_rx.base);
+
     if (!m_event.waitRecv (m_socket))
         return 0; // if no timeout is provided, this must not happen
 
@@ -100,6 +412,9 @@ size_t RawSocket::recv (void *buf, size_t len) const
 
 size_t RawSocket::send (const void *buf, size_t len) const
 {
+    // in ring mode, the ring must be used for sending
+    BUG_ON (m_tx.base);
+
     auto ret = ::send (m_socket, buf, len, 0); // auto because on windows the return value is int
     if (ret <= 0)
         throw SocketException ();
@@ -109,3 +424,383 @@ size_t RawSocket::send (const void *buf, size_t len) const
 
     return (size_t)ret;
 }
+
+size_t RawSocket::recvBatch (Frame* frames, size_t count, int timeout)
+{
+    BUG_ON (!count);
+
+    if (m_rx.base)
+        return recvRing (frames, count, timeout);
+
+    return recvMsgs (frames, count, timeout);
+}
+
+size_t RawSocket::recvMsgs (Frame* frames, size_t count, int timeout)
+{
+    if (count > m_rxMsgs.size ())
+        count = m_rxMsgs.size ();
+
+    if (!m_rxPool)
+        m_rxPool = FramePool::create (m_rxPoolConfig);
+
+    // buffers still held by the caller are replaced by new ones
+    for (size_t n = 0; n < count; n++)
+    {
+        if (!m_rxRefs[n] || m_rxRefs[n].isShared ())
+        {
+            m_rxRefs[n] = m_rxPool->alloc ();
+            if (!m_rxRefs[n])
+            {
+                count = n;
+                break;
+            }
+            m_rxIov[n].iov_base = m_rxRefs[n].buffer () + m_headroom + VLAN_TAG_LEN;
+        }
+        m_rxMsgs[n].msg_hdr.msg_controllen = RX_CONTROL_SIZE;
+    }
+    // Like a NIC without free descriptors, the next frame is dropped instead
+    // of returning at once, so the caller doesn't spin until buffers come back.
+    if (!count)
+    {
+        discard (timeout);
+        return 0;
+    }
+
+    int ret;
+    do
+    {
+        if (timeout && !m_event.waitRecv (m_socket, timeout))
+            return 0;
+
+        // fetch everything that is already queued, but don't wait for more
+        ret = ::recvmmsg (m_socket, m_rxMsgs.data(), (unsigned)count, MSG_DONTWAIT, nullptr);
+        if (ret < 0 && errno == EAGAIN && !timeout)
+            return 0;
+    } while (ret < 0 && (errno == EAGAIN || errno == EINTR));
+
+    if (ret <= 0)
+        throw SocketException ();
+
+    for (int n = 0; n < ret; n++)
+    {
+        frames[n].data = (uint8_t*)m_rxIov[n].iov_base;
+        frames[n].len  = m_rxMsgs[n].msg_len;
+
+        if (m_timestamps)
+            m_rxTimes[n] = 0;
+        struct msghdr& msg = m_rxMsgs[n].msg_hdr;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+            {
+                struct scm_timestamping ts;
+                std::memcpy (&ts, CMSG_DATA (cmsg), sizeof (ts));
+                m_rxTimes[n] = nanoseconds (ts.ts[0]);
+                continue;
+            }
+            if (cmsg->cmsg_level != SOL_PACKET || cmsg->cmsg_type != PACKET_AUXDATA)
+                continue;
+            struct tpacket_auxdata aux;
+            std::memcpy (&aux, CMSG_DATA (cmsg), sizeof (aux));
+            if (aux.tp_status & TP_STATUS_VLAN_VALID)
+            {
+                frames[n].data = insertVlanTag (frames[n].data, frames[n].len,
+                    (aux.tp_status & TP_STATUS_VLAN_TPID_VALID) ? aux.tp_vlan_tpid : ETH_P_8021Q, aux.tp_vlan_tci);
+                frames[n].len += VLAN_TAG_LEN;
+            }
+        }
+        m_rxRefs[n].setFrame ((size_t)(frames[n].data - m_rxRefs[n].buffer ()), frames[n].len);
+    }
+    return (size_t)ret;
+}
+
+FrameRef RawSocket::hold (size_t n) const
+{
+    // frames in the rx ring are returned to the kernel with their block
+    if (m_rx.base || n >= m_rxRefs.size ())
+        return FrameRef ();
+    return m_rxRefs[n];
+}
+
+void RawSocket::discard (int timeout)
+{
+    uint8_t buf;
+    while (::recv (m_socket, &buf, 1, MSG_DONTWAIT | MSG_TRUNC) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            throw SocketException ();
+        if (!timeout || !m_event.waitRecv (m_socket, timeout))
+            return;
+    }
+    m_poolDrops++;
+}
+
+size_t RawSocket::recvRing (Frame* frames, size_t count, int timeout)
+{
+    // all frames of the current block were handed out on the last call,
+    // so they are not used anymore and the block can be returned to the kernel
+    if (m_rx.release)
+    {
+        auto* block = (struct tpacket_block_desc*)(m_rx.base + m_rx.block * m_rx.blockSize);
+        __atomic_store_n (&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        m_rx.block   = (m_rx.block + 1) % m_rx.blockCount;
+        m_rx.release = false;
+    }
+
+    auto* block = (struct tpacket_block_desc*)(m_rx.base + m_rx.block * m_rx.blockSize);
+
+    if (!m_rx.remaining)
+    {
+        // wait until the kernel passes the block to user space
+        while (!(__atomic_load_n (&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+        {
+            if (!m_event.waitRecv (m_socket, timeout))
+                return 0;
+        }
+
+        m_rx.remaining = block->hdr.bh1.num_pkts;
+        m_rx.next      = (uint8_t*)block + block->hdr.bh1.offset_to_first_pkt;
+
+        // a block retired by timeout might be empty
+        if (!m_rx.remaining)
+        {
+            m_rx.release = true;
+            return recvRing (frames, count, timeout);
+        }
+    }
+
+    if (m_timestamps && m_rxTimes.size () < count)
+        m_rxTimes.resize (count);
+
+    size_t n = 0;
+    while (n < count && m_rx.remaining)
+    {
+        auto* hdr = (struct tpacket3_hdr*)m_rx.next;
+        if (m_timestamps)
+            m_rxTimes[n] = (uint64_t)hdr->tp_sec * 1000000000 + hdr->tp_nsec;
+
+        frames[n].data = m_rx.next + hdr->tp_mac;
+        frames[n].len  = hdr->tp_snaplen;
+        // truncated frames are passed on longer than the MTU, so they are dropped by the caller
+        if (hdr->tp_len > hdr->tp_snaplen && frames[n].len <= m_mtu)
+            frames[n].len = m_mtu + 1;
+        if (hdr->tp_status & TP_STATUS_VLAN_VALID)
+        {
+            frames[n].data = insertVlanTag (frames[n].data, frames[n].len,
+                (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) ? hdr->hv1.tp_vlan_tpid : ETH_P_8021Q, hdr->hv1.tp_vlan_tci);
+            frames[n].len += VLAN_TAG_LEN;
+        }
+        n++;
+
+        m_rx.next += hdr->tp_next_offset;
+        m_rx.remaining--;
+    }
+
+    if (!m_rx.remaining)
+        m_rx.release = true;
+
+    return n;
+}
+
+void RawSocket::sendBatch (const Frame* frames, size_t count)
+{
+    if (m_tx.base)
+        sendRing (frames, count);
+    else
+        sendMsgs (frames, count);
+}
+
+void RawSocket::sendGso (const Frame& frame)
+{
+    if (m_gsoSocket == INVALID_RAWSOCKET)
+        return;
+
+    VirtioNetHeader hdr = VirtioNetHeader::fromTunnel (GsoHeader::of (frame));
+    struct iovec iov[2];
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len  = sizeof (hdr);
+    iov[1].iov_base = frame.data;
+    iov[1].iov_len  = frame.len;
+    struct msghdr msg;
+    std::memset (&msg, 0, sizeof (msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+
+    while (::sendmsg (m_gsoSocket, &msg, 0) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        // dropped if the device queue is full, frames with an invalid virtio-net header as well
+        if (errno == ENOBUFS || errno == EINVAL || errno == EMSGSIZE)
+            return;
+        throw SocketException ();
+    }
+}
+
+void RawSocket::sendMsgs (const Frame* frames, size_t count)
+{
+    const RAW_SOCKET s = m_txSocket != INVALID_RAWSOCKET ? m_txSocket : m_socket;
+
+    while (count)
+    {
+        size_t batch = count < m_txMsgs.size () ? count : m_txMsgs.size ();
+        for (size_t n = 0; n < batch; n++)
+        {
+            m_txIov[n].iov_base = frames[n].data;
+            m_txIov[n].iov_len  = frames[n].len;
+        }
+        // a requested timestamp is taken of the first frame only
+        struct msghdr& first = m_txMsgs[0].msg_hdr;
+        first.msg_control    = m_txStamp ? m_txControl.data () : nullptr;
+        first.msg_controllen = m_txStamp ? m_txControl.size () : 0;
+        m_txStamp = false;
+
+        // sendmmsg might return before all messages are sent
+        size_t sent = 0;
+        while (sent < batch)
+        {
+            int ret = ::sendmmsg (s, m_txMsgs.data() + sent, (unsigned)(batch - sent), 0);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                // like the qdisc would do, drop the frame if the device queue is full,
+                // frames longer than the MTU of the device are dropped as well
+                if (errno == ENOBUFS || errno == EMSGSIZE)
+                {
+                    sent++;
+                    continue;
+                }
+                throw SocketException ();
+            }
+            sent += (size_t)ret;
+        }
+
+        frames += batch;
+        count  -= batch;
+    }
+}
+
+bool RawSocket::requestTimestamp ()
+{
+    if (m_txSocket == INVALID_RAWSOCKET)
+        return false;
+    m_txStamp = true;
+    return true;
+}
+
+bool RawSocket::sentTimestamp (uint32_t& id, uint64_t& time)
+{
+    if (m_txSocket == INVALID_RAWSOCKET)
+        return false;
+
+    while (1)
+    {
+        alignas (struct cmsghdr) uint8_t control[256];
+        struct msghdr msg;
+        std::memset (&msg, 0, sizeof (msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof (control);
+        if (::recvmsg (m_txSocket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                return false;
+            throw SocketException ();
+        }
+
+        bool hasId = false;
+        time = 0;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+            {
+                struct scm_timestamping ts;
+                std::memcpy (&ts, CMSG_DATA (cmsg), sizeof (ts));
+                time = nanoseconds (ts.ts[0]);
+            }
+            else if (cmsg->cmsg_level == SOL_PACKET && cmsg->cmsg_type == PACKET_TX_TIMESTAMP)
+            {
+                struct sock_extended_err err;
+                std::memcpy (&err, CMSG_DATA (cmsg), sizeof (err));
+                if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                {
+                    id    = err.ee_data;
+                    hasId = true;
+                }
+            }
+        }
+        if (hasId && time)
+            return true;
+    }
+}
+
+void RawSocket::sendRing (const Frame* frames, size_t count)
+{
+    const size_t maxLen = m_tx.frameSize - TX_RING_DATA_OFFSET;
+    bool kicked = false;
+
+    for (size_t n = 0; n < count; n++)
+    {
+        BUG_ON (frames[n].len > maxLen);
+
+        uint8_t* slot = m_tx.base + (m_tx.frame / m_tx.framesPerBlock) * m_tx.blockSize
+                                  + (m_tx.frame % m_tx.framesPerBlock) * m_tx.frameSize;
+        auto* hdr = (struct tpacket3_hdr*)slot;
+
+        // ring is full, let the kernel send the pending frames and wait for a free slot
+        while (__atomic_load_n (&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE)
+        {
+            if (!kicked)
+            {
+                kickRing ();
+                kicked = true;
+            }
+            else
+            {
+                m_event.waitSend (m_socket);
+            }
+        }
+        kicked = false;
+
+        std::memcpy (slot + TX_RING_DATA_OFFSET, frames[n].data, frames[n].len);
+        hdr->tp_len = (uint32_t)frames[n].len;
+        __atomic_store_n (&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+        m_tx.frame = (m_tx.frame + 1) % m_tx.frameCount;
+    }
+
+    kickRing ();
+}
+
+void RawSocket::kickRing () const
+{
+    // a blocking send returns after all pending frames have been processed
+    if (::send (m_socket, nullptr, 0, 0) < 0 && errno != ENOBUFS)
+        throw SocketException ();
+}
+
+
+// ------------ local helper functions ------------
+
+// moves the MAC addresses in front of the frame to make room for the tag,
+// there must be VLAN_TAG_LEN bytes of headroom
+uint8_t* insertVlanTag (uint8_t* frame, size_t len, uint16_t tpid, uint16_t tci)
+{
+    if (len < 12)
+        return frame;
+
+    uint8_t* tagged = frame - VLAN_TAG_LEN;
+    std::memmove (tagged, frame, 12);
+    tagged[12] = (uint8_t)(tpid >> 8);
+    tagged[13] = (uint8_t)tpid;
+    tagged[14] = (uint8_t)(tci >> 8);
+    tagged[15] = (uint8_t)tci;
+    return tagged;
+}
+
+uint64_t nanoseconds (const struct timespec& ts)
+{
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
@@ -22,10 +22,16 @@
 #include <stdexcept>
 #include <string>
 #include <cstdint>
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/filter.h>
 
 #include "socketexception.hpp"
 #include "sockettype.h"
 #include "socketevent.hpp"
+#include "l2socket.hpp"
 
 
 #if USE_PCAP
@@ -36,7 +42,39 @@
     #define INVALID_RAWSOCKET (-1)
 #endif
 
-class RawSocket
+struct RawSocketConfig
+{
+    unsigned mtu;        // max. length of a received frame
+    size_t   headroom;   // free bytes in front of each frame returned by recvBatch
+    size_t   rxRingSize; // size of the memory mapped receive ring, 0 disables it
+    size_t   txRingSize; // size of the memory mapped transmit ring, 0 disables it
+    bool     qdiscBypass;// send frames directly to the driver, bypassing the qdisc layer
+    unsigned batchSize;  // max. number of frames per recvmmsg/sendmmsg call if rings are disabled
+    unsigned rxPoolSize; // buffers frames are received into if the rx ring is disabled, 0 for 2 * batchSize.
+                         // Buffers held by the caller aren't reused, so it limits the frames held at once.
+    bool     hugePages;  // receive buffers in huge pages
+    bool     ignoreOutgoing; // don't capture frames sent by this host, including our own
+    bool     timestamps; // kernel timestamps of captured frames and, without tx ring, of sent frames
+    bool     gso;        // send GSO frames received by a tap backend at the far end, see GsoHeader
+    std::vector<struct sock_filter> filter; // classic BPF capture filter, empty captures everything
+
+    RawSocketConfig () :
+        mtu (1500),
+        headroom (0),
+        rxRingSize (0),
+        txRingSize (0),
+        qdiscBypass (false),
+        batchSize (64),
+        rxPoolSize (0),
+        hugePages (false),
+        ignoreOutgoing (true),
+        timestamps (false),
+        gso (false)
+    {
+    }
+};
+
+class RawSocket : public L2Socket
 {
 public:
     RawSocket () = delete;
@@ -47,24 +85,111 @@ public:
     RawSocket (RawSocket&& obj);
     ~RawSocket ();
 
-    static RawSocket open (const std::string& interface);
+    static RawSocket open (const std::string& interface, const RawSocketConfig& config = RawSocketConfig());
     void close ();
 
     size_t recv (void *buf, size_t len) const;
     size_t send (const void *buf, size_t len) const;
 
+    // without rx ring, the frames are received into pool buffers which can be held by the caller.
+    // If all of them are held, the next frame is dropped and 0 is returned.
+    size_t recvBatch (Frame* frames, size_t count, int timeout = -1) override;
+    FrameRef hold (size_t n) const override;
+    uint64_t timestamp (size_t n) const override
+    {
+        return n < m_rxTimes.size () ? m_rxTimes[n] : 0;
+    }
+    uint64_t poolDrops () const override
+    {
+        return m_poolDrops;
+    }
+    // in ring mode the frames are copied into the transmit ring and the kernel
+    // is kicked only once for the whole batch
+    void sendBatch (const Frame* frames, size_t count) override;
+    // without gso, the frame is dropped
+    void sendGso (const Frame& frame) override;
+    bool requestTimestamp () override;
+    bool sentTimestamp (uint32_t& id, uint64_t& time) override;
+
     bool isValid () const
     {
         return m_socket != INVALID_RAWSOCKET;
     }
 
-    void cancel () const;
+    RAW_SOCKET handle () const override
+    {
+        return m_socket;
+    }
+
+    void cancel () const override;
 
 private:
     RawSocket (RAW_SOCKET s);
 
+    void setupMsgs (const RawSocketConfig& config);
+    void setupRings (const RawSocketConfig& config);
+    void setupTxTimestamps (int ifIndex, const RawSocketConfig& config);
+    void setupGso (int ifIndex, const RawSocketConfig& config);
+    size_t recvMsgs (Frame* frames, size_t count, int timeout);
+    size_t recvRing (Frame* frames, size_t count, int timeout);
+    void discard (int timeout);
+    void sendMsgs (const Frame* frames, size_t count);
+    void sendRing (const Frame* frames, size_t count);
+    void kickRing () const;
+
     RAW_SOCKET m_socket;
     SocketEvent m_event;
+
+    // copy mode receive buffers (one per batch entry) and message vectors. The pool is
+    // created by the first recvBatch call, so it is local to the receiving thread.
+    FramePoolConfig m_rxPoolConfig;
+    std::unique_ptr<FramePool> m_rxPool;
+    std::vector<FrameRef> m_rxRefs;
+    std::vector<struct mmsghdr> m_rxMsgs;
+    std::vector<struct iovec> m_rxIov;
+    std::vector<uint8_t> m_rxControl; // PACKET_AUXDATA and timestamp of each message
+    std::vector<uint64_t> m_rxTimes;  // capture timestamps of the last batch
+    uint64_t m_poolDrops;
+    std::vector<struct mmsghdr> m_txMsgs;
+    std::vector<struct iovec> m_txIov;
+    size_t m_headroom;
+    unsigned m_mtu;
+    bool m_timestamps;
+
+    // with timestamps the frames are sent through a socket of their own, so the timestamps
+    // on its error queue don't wake up the thread waiting for captured frames
+    RAW_SOCKET m_txSocket;
+    std::vector<uint8_t> m_txControl; // timestamp request of the first frame of a batch
+    bool m_txStamp;                   // the next batch requests a timestamp
+
+    // GSO frames are sent through a socket of their own, which expects a virtio-net
+    // header in front of every frame
+    RAW_SOCKET m_gsoSocket;
+
+    // TPACKET_V3 rings, both are located in one memory mapping
+    uint8_t* m_ringMap;
+    size_t   m_ringMapSize;
+
+    struct RxRing
+    {
+        uint8_t* base;          // nullptr if disabled
+        size_t   blockSize;
+        unsigned blockCount;
+        unsigned block;         // index of the current block
+        unsigned remaining;     // number of unprocessed frames in current block
+        uint8_t* next;          // next unprocessed frame in current block
+        bool     release;       // current block must be returned to the kernel
+    } m_rx;
+
+    struct TxRing
+    {
+        uint8_t* base;          // nullptr if disabled
+        size_t   blockSize;
+        size_t   frameSize;
+        unsigned framesPerBlock;
+        unsigned frameCount;
+        unsigned frame;         // index of the next frame to be filled
+    } m_tx;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <cerrno>
+
+#include "reactor.hpp"
+#include "socketexception.hpp"
+
+// max. number of events fetched per epoll_wait
+static const int MAX_EVENTS = 64;
+
+
+void Trigger::notify ()
+{
+    if (m_waiter)
+    {
+        m_reactor.schedule (m_waiter);
+        m_waiter = nullptr;
+    }
+    else
+    {
+        m_set = true;
+    }
+}
+
+Reactor::Reactor ()
+{
+    m_epoll = ::epoll_create1 (EPOLL_CLOEXEC);
+    if (m_epoll < 0)
+        throw SocketException ();
+}
+
+Reactor::~Reactor ()
+{
+    // the coroutines are destroyed before the triggers they might wait for
+    m_tasks.clear ();
+    ::close (m_epoll);
+}
+
+void Reactor::add (int fd)
+{
+    auto& w = m_watches[fd];
+    if (w)
+        return;
+    w.reset (new Watch (*this));
+
+    // edge triggered: readiness was not observed yet, so the first attempt must try the I/O
+    w->in.notify ();
+    w->out.notify ();
+
+    struct epoll_event ev;
+    ev.events   = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = w.get ();
+    if (::epoll_ctl (m_epoll, EPOLL_CTL_ADD, fd, &ev))
+        throw SocketException ();
+}
+
+void Reactor::spawn (Task&& task)
+{
+    schedule (task.m_handle);
+    m_tasks.push_back (std::move (task));
+}
+
+void Reactor::run ()
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1)
+    {
+        while (!m_ready.empty ())
+        {
+            std::coroutine_handle<> h = m_ready.front ();
+            m_ready.pop_front ();
+            h.resume ();
+        }
+
+        bool running = false;
+        for (const auto& t : m_tasks)
+        {
+            if (!t.m_handle.done ())
+                running = true;
+            else if (t.m_handle.promise ().exception)
+                std::rethrow_exception (t.m_handle.promise ().exception);
+        }
+        if (!running)
+            return;
+
+        int n = ::epoll_wait (m_epoll, events, MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw SocketException ();
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            Watch* w = (Watch*)events[i].data.ptr;
+            // errors are reported by the next I/O call of the waiting coroutine
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+                w->in.notify ();
+            if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                w->out.notify ();
+        }
+    }
+}
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+
+class Reactor;
+
+// Coroutine started by Reactor::spawn. Exceptions are passed to Reactor::run.
+class Task
+{
+public:
+    struct promise_type
+    {
+        std::exception_ptr exception;
+
+        Task get_return_object ()
+        {
+            return Task (std::coroutine_handle<promise_type>::from_promise (*this));
+        }
+        std::suspend_always initial_suspend () noexcept
+        {
+            return {};
+        }
+        std::suspend_always final_suspend () noexcept
+        {
+            return {};
+        }
+        void return_void ()
+        {
+        }
+        void unhandled_exception ()
+        {
+            exception = std::current_exception ();
+        }
+    };
+
+    Task (const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task (Task&& obj) : m_handle (obj.m_handle)
+    {
+        obj.m_handle = nullptr;
+    }
+    ~Task ()
+    {
+        if (m_handle)
+            m_handle.destroy ();
+    }
+
+private:
+    friend class Reactor;
+    explicit Task (std::coroutine_handle<promise_type> h) : m_handle (h)
+    {
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+// Wakes up one waiting coroutine. A notification without waiter is kept until the next wait.
+class Trigger
+{
+public:
+    explicit Trigger (Reactor& reactor) : m_reactor (reactor), m_set (false)
+    {
+    }
+    Trigger (const Trigger&) = delete;
+    Trigger& operator=(const Trigger&) = delete;
+
+    void notify ();
+
+    struct Awaiter
+    {
+        Trigger& trigger;
+
+        bool await_ready () const noexcept
+        {
+            if (!trigger.m_set)
+                return false;
+            trigger.m_set = false;
+            return true;
+        }
+        void await_suspend (std::coroutine_handle<> h) noexcept
+        {
+            trigger.m_waiter = h;
+        }
+        void await_resume () const noexcept
+        {
+        }
+    };
+    Awaiter wait ()
+    {
+        return Awaiter {*this};
+    }
+
+private:
+    Reactor& m_reactor;
+    std::coroutine_handle<> m_waiter;
+    bool m_set;
+};
+
+// Single threaded event loop on top of an edge triggered epoll set.
+// A coroutine tries its I/O first and awaits readable()/writable() only
+// after the socket reported EAGAIN.
+class Reactor
+{
+public:
+    Reactor ();
+    Reactor (const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+    ~Reactor ();
+
+    // add a file descriptor to the epoll set, once
+    void add (int fd);
+
+    Trigger::Awaiter readable (int fd)
+    {
+        return m_watches.at (fd)->in.wait ();
+    }
+    Trigger::Awaiter writable (int fd)
+    {
+        return m_watches.at (fd)->out.wait ();
+    }
+
+    void spawn (Task&& task);
+    // resume h from the event loop
+    void schedule (std::coroutine_handle<> h)
+    {
+        m_ready.push_back (h);
+    }
+
+    // runs until all tasks finished, rethrows the first exception of a task
+    void run ();
+
+private:
+    struct Watch
+    {
+        explicit Watch (Reactor& r) : in (r), out (r)
+        {
+        }
+        Trigger in;
+        Trigger out;
+    };
+
+    int m_epoll;
+    std::unordered_map<int, std::unique_ptr<Watch>> m_watches;
+    std::vector<Task> m_tasks;
+    std::deque<std::coroutine_handle<>> m_ready;
+};
+
+#endif
@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/uio.h>
+
+#include "reactorengine.hpp"
+#include "l2socket.hpp"
+#include "streamgroup.hpp"
+#include "deframer.hpp"
+#include "tunnel.hpp"
+#include "frame.hpp"
+#include "console.hpp"
+
+// max. number of frames fetched from the raw socket at once
+static const size_t BATCH_SIZE = 64;
+
+
+ReactorEngine::ReactorEngine (const ReactorEngineConfig& config, L2Socket* l2Socket, const StreamGroup* streams)
+: m_config (config), m_l2Socket (l2Socket), m_streams (streams)
+{
+    m_reactor.add (l2Socket->handle ());
+    for (size_t n = 0; n < streams->size (); n++)
+    {
+        m_reactor.add ((*streams)[n].handle ());
+        m_backlogs.emplace_back (new Backlog (m_reactor));
+    }
+}
+
+void ReactorEngine::run ()
+{
+    Console::PrintDebug ("Reactor engine started\n");
+
+    try
+    {
+        m_reactor.spawn (capture ());
+        for (size_t n = 0; n < m_streams->size (); n++)
+        {
+            m_reactor.spawn (streamWriter (n));
+            m_reactor.spawn (streamReader (n));
+        }
+        m_reactor.run ();
+    }
+    catch (const std::exception& e)
+    {
+        Console::PrintError ("%s\n", e.what());
+    }
+
+    Console::PrintDebug ("Reactor engine terminated\n");
+}
+
+Task ReactorEngine::capture ()
+{
+    Frame frames[BATCH_SIZE];
+    std::vector<std::vector<struct iovec>> iov (m_streams->size ());
+
+    while (1)
+    {
+        size_t count = m_l2Socket->recvBatch (frames, BATCH_SIZE, 0);
+        if (!count)
+        {
+            co_await m_reactor.readable (m_l2Socket->handle ());
+            continue;
+        }
+
+        for (auto& v : iov)
+            v.clear ();
+
+        for (size_t n = 0; n < count; n++)
+        {
+            // the peer would reject it anyway
+            if (frames[n].len > m_config.mtu || !frames[n].len)
+                continue;
+
+            // all frames of a flow take the same stream to keep their order
+            size_t stream = m_streams->select (frames[n].data, frames[n].len);
+            const Frame packet = TunnelHeader::encapsulate (frames[n], m_l2Socket->isGso (n));
+            iov[stream].push_back ({packet.data, packet.len});
+        }
+
+        for (size_t s = 0; s < iov.size (); s++)
+        {
+            if (iov[s].empty ())
+                continue;
+
+            // behind a backlog nothing can be sent directly without reordering
+            Backlog& b = *m_backlogs[s];
+            size_t sent = b.size () ? 0 : (*m_streams)[s].trySend (iov[s].data (), iov[s].size ());
+
+            // the frames are overwritten by the next recvBatch, keep what is left
+            for (const auto& v : iov[s])
+            {
+                size_t skip = sent < v.iov_len ? sent : v.iov_len;
+                sent -= skip;
+                b.data.insert (b.data.end (), (uint8_t*)v.iov_base + skip, (uint8_t*)v.iov_base + v.iov_len);
+            }
+            if (b.size ())
+                b.pending.notify ();
+
+            // the stream is too slow, let the raw socket drop frames instead of growing without limit
+            while (b.size () > m_config.maxBacklog)
+                co_await b.drained.wait ();
+        }
+    }
+}
+
+Task ReactorEngine::streamWriter (size_t stream)
+{
+    Backlog& b = *m_backlogs[stream];
+    const TcpSocket& s = (*m_streams)[stream];
+
+    while (1)
+    {
+        if (!b.size ())
+        {
+            b.data.clear ();
+            b.offset = 0;
+            b.drained.notify ();
+            co_await b.pending.wait ();
+            continue;
+        }
+
+        struct iovec v = {b.data.data () + b.offset, b.size ()};
+        size_t sent = s.trySend (&v, 1);
+        if (!sent)
+        {
+            co_await m_reactor.writable (s.handle ());
+            continue;
+        }
+        b.offset += sent;
+
+        // the backlog might never run empty under load
+        if (b.offset >= m_config.maxBacklog)
+        {
+            b.data.erase (b.data.begin (), b.data.begin () + (long)b.offset);
+            b.offset = 0;
+        }
+    }
+}
+
+Task ReactorEngine::streamReader (size_t stream)
+{
+    const TcpSocket& s = (*m_streams)[stream];
+    Deframer deframer (m_config.bufferSize, (uint32_t)(m_config.mtu + sizeof (GsoHeader)));
+    Frame frames[BATCH_SIZE];
+
+    while (1)
+    {
+        // there is always room for at least one packet, as all complete packets
+        // were released at the end of the last iteration
+        size_t len = s.tryRecv (deframer.writePtr (), deframer.writable ());
+        if (!len)
+        {
+            co_await m_reactor.readable (s.handle ());
+            continue;
+        }
+        deframer.commit (len);
+
+        size_t count = 0;
+        const TunnelHeader* pHeader;
+        while ((pHeader = deframer.next ()) != nullptr)
+        {
+            // GSO frames are sent on their own, behind the frames received before
+            if (pHeader->getType () == Type::GSO && pHeader->getLength () > sizeof (GsoHeader))
+            {
+                if (count)
+                    m_l2Socket->sendBatch (frames, count);
+                count = 0;
+                m_l2Socket->sendGso (Frame {(uint8_t*)pHeader->payload () + sizeof (GsoHeader),
+                    pHeader->getLength () - sizeof (GsoHeader)});
+                continue;
+            }
+            if (!pHeader->isPacket() || !pHeader->getLength())
+                continue;
+
+            frames[count].data = (uint8_t*)pHeader->payload();
+            frames[count].len  = pHeader->getLength();
+            if (++count == BATCH_SIZE)
+            {
+                m_l2Socket->sendBatch (frames, count);
+                count = 0;
+            }
+        }
+
+        if (count)
+            m_l2Socket->sendBatch (frames, count);
+
+        deframer.release ();
+    }
+}
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REACTORENGINE_HPP
+#define REACTORENGINE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "reactor.hpp"
+
+class L2Socket;
+class StreamGroup;
+
+struct ReactorEngineConfig
+{
+    unsigned mtu;
+    size_t   bufferSize;  // size of the tunnel receive buffer of each stream
+    size_t   maxBacklog;  // unsent bytes per stream before capturing pauses
+
+    ReactorEngineConfig () :
+        mtu (1500),
+        bufferSize (4 * 1024 * 1024),
+        maxBacklog (4 * 1024 * 1024)
+    {
+    }
+};
+
+// Single threaded data plane, replaces the Receiver and Sender threads.
+// Both directions run as coroutines on one epoll reactor:
+// - capture: raw socket -> streams, frames a stream doesn't accept right
+//   away are copied into its backlog
+// - one writer per stream sends the backlog as soon as the stream is writable
+// - one reader per stream: stream -> raw socket
+class ReactorEngine
+{
+public:
+    ReactorEngine (const ReactorEngineConfig& config, L2Socket* l2Socket, const StreamGroup* streams);
+    ReactorEngine (const ReactorEngine&) = delete;
+    ReactorEngine& operator=(const ReactorEngine&) = delete;
+
+    // returns when a socket fails or the peer closes the connection
+    void run ();
+
+private:
+    struct Backlog
+    {
+        explicit Backlog (Reactor& r) : offset (0), pending (r), drained (r)
+        {
+        }
+        size_t size () const
+        {
+            return data.size () - offset;
+        }
+
+        std::vector<uint8_t> data;
+        size_t  offset;   // first unsent byte
+        Trigger pending;  // new data for the writer
+        Trigger drained;  // everything sent
+    };
+
+    Task capture ();
+    Task streamWriter (size_t stream);
+    Task streamReader (size_t stream);
+
+    ReactorEngineConfig m_config;
+    L2Socket* m_l2Socket;
+    const StreamGroup* m_streams;
+    Reactor m_reactor;
+    std::vector<std::unique_ptr<Backlog>> m_backlogs;
+};
+
+#endif
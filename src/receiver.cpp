@@ -16,49 +16,332 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <memory>
-
 #include "receiver.hpp"
-#include "tcpsocket.hpp"
-#include "rawsocket.hpp"
+#include "tunnelsocket.hpp"
+#include "socketexception.hpp"
+#include "l2socket.hpp"
 #include "console.hpp"
 #include "tunnel.hpp"
+#include "frame.hpp"
+#include "stats.hpp"
+#include "mactable.hpp"
+#include "framepool.hpp"
+#include "classifier.hpp"
+#include "latencymonitor.hpp"
 
+// max. number of frames fetched from the raw socket at once
+static const size_t BATCH_SIZE = 64;
+// the capture thread checks this often whether the transmit thread is still alive (in us)
+static const int CAPTURE_TIMEOUT = 100000;
 
-Receiver::Receiver (unsigned mtu, const RawSocket* inputSocket, const TcpSocket* outputSocket, std::binary_semaphore* finished)
-: m_thread (&Receiver::threadFunc, this, mtu, inputSocket, outputSocket, finished)
-{
 
+Receiver::Receiver (const ReceiverConfig& config, L2Socket* inputSocket, TunnelSocket* outputSocket, std::binary_semaphore* finished)
+: m_finished (finished),
+  m_transmitFailed (false)
+{
+    if (config.queue.isEnabled ())
+    {
+        m_queue.reset (new FrameQueue (config.queue));
+        m_thread = std::thread (&Receiver::captureFunc, this, config, inputSocket);
+        m_transmitThread = std::thread (&Receiver::transmitFunc, this, config, outputSocket);
+    }
+    else
+    {
+        m_thread = std::thread (&Receiver::threadFunc, this, config, inputSocket, outputSocket);
+    }
 }
 
 Receiver::~Receiver ()
 {
-    m_thread.join ();
+    join ();
+}
+
+void Receiver::terminated ()
+{
+    if (m_finished && !m_terminated.test_and_set ())
+        m_finished->release ();
+}
+
+// false if the frame is not sent through the tunnel
+bool Receiver::filter (const ReceiverConfig& config, StatsWriter& stats, const Frame& frame, uint64_t now)
+{
+    // the peer would reject it anyway
+    if (frame.len > config.mtu || !frame.len)
+    {
+        stats.drop ();
+        return false;
+    }
+    MacTable* macTable = config.macTable;
+    if (macTable && frame.len >= 12)
+    {
+        // unicast between two local hosts doesn't need to cross the tunnel
+        macTable->learn (frame.data + 6, MacTable::LOCAL, now);
+        if (MacTable::isUnicast (frame.data) && macTable->lookup (frame.data, now) == MacTable::LOCAL)
+        {
+            stats.local ();
+            return false;
+        }
+    }
+    stats.frame (frame);
+    return true;
+}
+
+int Receiver::sendProbe (const ReceiverConfig& config, TunnelSocket* outputSocket)
+{
+    int timeout = outputSocket->timeout ();
+    LatencyMonitor* monitor = config.monitor;
+    if (!monitor)
+        return timeout;
+
+    const uint64_t now = LatencyMonitor::now ();
+    if (monitor->isDue (now))
+        outputSocket->sendProbe (monitor->probe (now));
+    // the probe might be buffered as well
+    timeout = outputSocket->timeout ();
+    const int next = monitor->timeout (now);
+    return timeout < 0 || next < timeout ? next : timeout;
 }
 
-void Receiver::threadFunc (unsigned mtu, const RawSocket* inputSocket, const TcpSocket* outputSocket, std::binary_semaphore* finished)
+void Receiver::threadFunc (ReceiverConfig config, L2Socket* inputSocket, TunnelSocket* outputSocket)
 {
     Console::PrintDebug ("Receiver started\n");
+
+    StatsWriter stats (config.stats, "receiver");
     try
     {
-        const size_t headerLen = sizeof (TunnelHeader);
-        std::unique_ptr<uint8_t[]> data (new uint8_t[headerLen + mtu]);
-        ssize_t payloadLen;
+        Frame frames[BATCH_SIZE];
+        Frame packets[BATCH_SIZE];
+        uint64_t times[BATCH_SIZE];
+        LatencyMonitor* monitor = config.monitor;
 
-        while ((payloadLen = inputSocket->recv (data.get() + headerLen, mtu)) > 0)
+        while (1)
         {
-            outputSocket->send (
-                TunnelHeader::packet(data.get(), (uint32_t) payloadLen),
-                headerLen + payloadLen);
+            size_t count = inputSocket->recvBatch (frames, BATCH_SIZE, sendProbe (config, outputSocket));
+
+            // latency budget of the buffered packets expired
+            if (!count)
+            {
+                outputSocket->flush ();
+                continue;
+            }
+
+            MacTable* macTable = config.macTable;
+            const uint64_t now = macTable ? MacTable::now () : 0;
+            if (macTable)
+                macTable->expire (now);
+
+            // without kernel timestamps, the frames count as captured now
+            const uint64_t captured = monitor ? LatencyMonitor::wallClock () : 0;
+
+            stats.begin ();
+            stats.batch (count);
+            size_t packetCount = 0;
+            for (size_t n = 0; n < count; n++)
+            {
+                if (!filter (config, stats, frames[n], now))
+                    continue;
+                if (monitor)
+                {
+                    const uint64_t t = inputSocket->timestamp (n);
+                    times[packetCount] = t ? t : captured;
+                }
+
+                // the raw socket reserves room for the tunnel header in front of each frame,
+                // so the tunnel header is built in place without copying the frame
+                packets[packetCount++] = TunnelHeader::encapsulate (frames[n], inputSocket->isGso (n));
+            }
+            stats.end ();
+
+            if (packetCount)
+            {
+                outputSocket->sendBatch (packets, packetCount);
+                if (monitor)
+                {
+                    const uint64_t sent = LatencyMonitor::wallClock ();
+                    for (size_t n = 0; n < packetCount; n++)
+                        monitor->captured ().record (sent > times[n] ? sent - times[n] : 0);
+                }
+            }
         }
     }
-    catch(const SocketException& e)
+    catch(const std::exception& e)
     {
+        stats.begin ();
+        stats.error ();
+        stats.end ();
         Console::PrintError ("%s\n", e.what());
     }
 
+    outputSocket->printStatistics ();
+
     Console::PrintDebug ("Receiver terminated\n");
 
-    if (finished)
-        finished->release ();
-}
\ No newline at end of file
+    terminated ();
+}
+
+void Receiver::captureFunc (ReceiverConfig config, L2Socket* inputSocket)
+{
+    Console::PrintDebug ("Receiver capture started\n");
+
+    StatsWriter stats (config.stats, "receiver");
+    try
+    {
+        Frame frames[BATCH_SIZE];
+        const bool classify = m_queue->classes () > 1;
+        LatencyMonitor* monitor = config.monitor;
+        uint64_t poolDrops = 0;
+
+        while (!m_queue->isClosed ())
+        {
+            size_t count = inputSocket->recvBatch (frames, BATCH_SIZE, CAPTURE_TIMEOUT);
+            if (!count)
+            {
+                // the socket drops frames while the queue holds all of its buffers
+                if (inputSocket->poolDrops () != poolDrops)
+                {
+                    poolDrops = inputSocket->poolDrops ();
+                    stats.begin ();
+                    stats.poolDrops (poolDrops);
+                    stats.end ();
+                }
+                continue;
+            }
+
+            MacTable* macTable = config.macTable;
+            const uint64_t now = macTable ? MacTable::now () : 0;
+            if (macTable)
+                macTable->expire (now);
+            const uint64_t captured = monitor ? LatencyMonitor::wallClock () : 0;
+
+            stats.begin ();
+            stats.batch (count);
+            for (size_t n = 0; n < count; n++)
+            {
+                if (!filter (config, stats, frames[n], now))
+                    continue;
+
+                const bool gso = inputSocket->isGso (n);
+                FrameRef frame = inputSocket->hold (n);
+                if (!frame)
+                {
+                    // frames the socket can't hold are copied, only this thread allocates from the pool
+                    if (!m_pool)
+                    {
+                        FramePoolConfig poolConfig;
+                        poolConfig.count      = (unsigned)(m_queue->capacity () + 2 * BATCH_SIZE
+                            + (config.aqm.isEnabled () ? config.aqm.limit : 0));
+                        poolConfig.bufferSize = sizeof (TunnelHeader) + sizeof (GsoHeader) + config.mtu;
+                        m_pool = FramePool::create (poolConfig);
+                    }
+                    // room for the tunnel header in front of the frame, a GSO frame keeps its GsoHeader
+                    frame = m_pool->copy (frames[n], sizeof (TunnelHeader) + sizeof (GsoHeader), gso ? sizeof (GsoHeader) : 0);
+                }
+                if (frame)
+                    frame.setGso (gso);
+                if (frame && monitor)
+                {
+                    const uint64_t t = inputSocket->timestamp (n);
+                    frame.setTime (t ? t : captured);
+                }
+                const unsigned cls = classify ? trafficClass (framePriority (frames[n].data, frames[n].len)) : 0;
+                if (!frame || !m_queue->push (std::move (frame), cls))
+                    stats.queueDrop ();
+            }
+            stats.queue (m_queue->size ());
+            stats.end ();
+            m_queue->notify ();
+        }
+    }
+    catch(const std::exception& e)
+    {
+        stats.begin ();
+        stats.error ();
+        stats.end ();
+        Console::PrintError ("%s\n", e.what());
+    }
+    m_queue->close ();
+    // only this thread writes the statistics, it counts the error of the transmit thread
+    if (m_transmitFailed.exchange (false))
+    {
+        stats.begin ();
+        stats.error ();
+        stats.end ();
+    }
+
+    Console::PrintDebug ("Receiver capture terminated\n");
+
+    terminated ();
+}
+
+void Receiver::transmitFunc (ReceiverConfig config, TunnelSocket* outputSocket)
+{
+    Console::PrintDebug ("Receiver transmit started\n");
+
+    std::unique_ptr<FqCodel> aqm;
+    try
+    {
+        FrameRef refs[BATCH_SIZE];
+        Frame packets[BATCH_SIZE];
+        LatencyMonitor* monitor = config.monitor;
+
+        if (config.aqm.isEnabled ())
+            aqm.reset (new FqCodel (config.aqm));
+
+        while (1)
+        {
+            const int timeout = sendProbe (config, outputSocket);
+            size_t count = m_queue->pop (refs, BATCH_SIZE, aqm && !aqm->empty () ? 0 : timeout);
+            if (aqm)
+            {
+                // all queued frames go into the flow queues, the frame queue only
+                // buffers the frames captured while we are sending
+                const uint64_t now = FqCodel::now ();
+                while (count)
+                {
+                    for (size_t n = 0; n < count; n++)
+                        aqm->enqueue (std::move (refs[n]), now);
+                    count = m_queue->pop (refs, BATCH_SIZE, 0);
+                }
+                count = aqm->dequeue (refs, BATCH_SIZE, config.aqm.burst, now);
+            }
+            if (!count)
+            {
+                if (m_queue->isClosed ())
+                    break;
+                // latency budget of the buffered packets expired
+                outputSocket->flush ();
+                continue;
+            }
+
+            // the buffers have room for the tunnel header in front of the frame
+            for (size_t n = 0; n < count; n++)
+                packets[n] = TunnelHeader::encapsulate (refs[n].frame (), refs[n].isGso ());
+            outputSocket->sendBatch (packets, count);
+            if (monitor)
+            {
+                const uint64_t sent = LatencyMonitor::wallClock ();
+                for (size_t n = 0; n < count; n++)
+                    monitor->captured ().record (sent > refs[n].time () ? sent - refs[n].time () : 0);
+            }
+
+            // the tunnel copied or sent them, the buffers can be reused
+            for (size_t n = 0; n < count; n++)
+                refs[n].reset ();
+        }
+    }
+    catch(const std::exception& e)
+    {
+        m_transmitFailed = true;
+        Console::PrintError ("%s\n", e.what());
+    }
+    m_queue->close ();
+
+    outputSocket->printStatistics ();
+    m_queue->printStatistics ("receiver");
+    if (aqm)
+        aqm->printStatistics ();
+
+    Console::PrintDebug ("Receiver transmit terminated\n");
+
+    terminated ();
+}
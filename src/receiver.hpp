@@ -20,25 +20,73 @@
 #ifndef RECEIVER_HPP
 #define RECEIVER_HPP
 
+#include <atomic>
+#include <memory>
 #include <thread>
+#include <semaphore>
 
-class RawSocket;
-class TcpSocket;
+#include "framequeue.hpp"
+#include "fqcodel.hpp"
 
+class L2Socket;
+class TunnelSocket;
+struct StatsSlot;
+class MacTable;
+class StatsWriter;
+class LatencyMonitor;
+struct Frame;
+
+struct ReceiverConfig
+{
+    unsigned   mtu;
+    StatsSlot* stats; // shared memory slot for the statistics, may be null
+    MacTable*  macTable; // learned addresses, may be null
+    FrameQueueConfig queue; // capture and send in separate threads
+    FqCodelConfig aqm;      // schedules the queued frames, requires the queue
+    LatencyMonitor* monitor; // sends latency probes and records the residence time of the frames, may be null
+
+    ReceiverConfig () :
+        mtu (1500),
+        stats (nullptr),
+        macTable (nullptr),
+        monitor (nullptr)
+    {
+    }
+};
+
+// Captures frames and sends them through the tunnel. With a queue, capturing and
+// sending are done by two threads, so TCP backpressure doesn't stall the capture.
 class Receiver
 {
 public:
-    Receiver (unsigned mtu, const RawSocket* inputSocket, const TcpSocket* outputSocket, std::binary_semaphore* finished = nullptr);
+    // finished is released when the first thread terminates
+    Receiver (const ReceiverConfig& config, L2Socket* inputSocket, TunnelSocket* outputSocket, std::binary_semaphore* finished = nullptr);
     ~Receiver ();
     void join ()
     {
         m_thread.join ();
+        if (m_transmitThread.joinable ())
+            m_transmitThread.join ();
     }
 
-    void threadFunc (unsigned mtu, const RawSocket* inputSocket, const TcpSocket* outputSocket, std::binary_semaphore* finished);
+    void threadFunc (ReceiverConfig config, L2Socket* inputSocket, TunnelSocket* outputSocket);
+    void captureFunc (ReceiverConfig config, L2Socket* inputSocket);
+    void transmitFunc (ReceiverConfig config, TunnelSocket* outputSocket);
 
 private:
+    static bool filter (const ReceiverConfig& config, StatsWriter& stats, const Frame& frame, uint64_t now);
+    // sends a latency probe if one is due, returns how long to wait for frames
+    static int sendProbe (const ReceiverConfig& config, TunnelSocket* outputSocket);
+    void terminated ();
+
+    // copies of captured frames, destroyed after the queue and the threads, which hold frames of it
+    std::unique_ptr<FramePool> m_pool;
+    std::unique_ptr<FrameQueue> m_queue;
+    std::binary_semaphore* m_finished;
+    std::atomic_flag m_terminated;
+    std::atomic<bool> m_transmitFailed; // set before the queue is closed
     std::thread m_thread;
+    std::thread m_transmitThread;
 };
 
 
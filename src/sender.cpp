@@ -16,122 +16,226 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <memory>
-#include <cstring>
 #include <stdexcept>
 
 #include "sender.hpp"
-#include "tcpsocket.hpp"
-#include "rawsocket.hpp"
+#include "tunnelsocket.hpp"
+#include "l2socket.hpp"
 #include "console.hpp"
+#include "frame.hpp"
+#include "stats.hpp"
+#include "mactable.hpp"
+#include "framepool.hpp"
+#include "latencymonitor.hpp"
 #include "tunnel.hpp"
 
+// max. number of frames handed over to the raw socket at once
+static const size_t BATCH_SIZE = 64;
 
-static inline size_t ptrdiff_to_len (const void* p1, const void* p2)
+// GSO frames are sent one by one in between the others, so the order of the frames is kept
+static void sendFrames (L2Socket* outputSocket, const Frame* frames, const bool* gso, size_t count)
 {
-    BUG_ON (p2 > p1);
-    return (size_t)((uint8_t*)p1 - (uint8_t*)p2);
+    size_t first = 0;
+    for (size_t n = 0; n < count; n++)
+    {
+        if (!gso[n])
+            continue;
+        if (n > first)
+            outputSocket->sendBatch (frames + first, n - first);
+        outputSocket->sendGso (frames[n]);
+        first = n + 1;
+    }
+    if (count > first)
+        outputSocket->sendBatch (frames + first, count - first);
 }
 
 
-Sender::Sender (unsigned mtu, const RawSocket* outputSocket, const TcpSocket* inputSocket, std::binary_semaphore* finished)
-: m_thread (&Sender::threadFunc, this, mtu, outputSocket, inputSocket, finished)
+Sender::Sender (const SenderConfig& config, L2Socket* outputSocket, TunnelSocket* inputSocket, std::binary_semaphore* finished)
+: m_finished (finished)
 {
-
+    if (config.queue.isEnabled ())
+    {
+        m_queue.reset (new FrameQueue (config.queue));
+        m_injectThread = std::thread (&Sender::injectFunc, this, outputSocket, config.monitor);
+    }
+    m_thread = std::thread (&Sender::threadFunc, this, config, outputSocket, inputSocket);
 }
 
 Sender::~Sender ()
 {
-    m_thread.join ();
+    join ();
 }
 
-void Sender::threadFunc (unsigned mtu, const RawSocket* outputSocket, const TcpSocket* inputSocket, std::binary_semaphore* finished)
+void Sender::terminated ()
 {
-    Console::PrintDebug ("Sender started\n");
+    if (m_finished && !m_terminated.test_and_set ())
+        m_finished->release ();
+}
 
-    try
+void Sender::inject (L2Socket* outputSocket, LatencyMonitor* monitor, const Frame* frames, const bool* gso, size_t count,
+    uint64_t received)
+{
+    if (!monitor)
+    {
+        sendFrames (outputSocket, frames, gso, count);
+        return;
+    }
+
+    const bool requested = outputSocket->requestTimestamp ();
+    if (requested)
+        m_stampTimes[m_stamps++ % TIMESTAMPS] = received;
+    sendFrames (outputSocket, frames, gso, count);
+    if (!requested)
     {
-        const size_t headerLen = sizeof (TunnelHeader);
-        const size_t bufSize = (headerLen + mtu) * 10;
-        std::unique_ptr<uint8_t[]> data (new uint8_t[bufSize]);
+        // the backend can't timestamp sent frames, they are sent when the call returns
+        const uint64_t sent = LatencyMonitor::wallClock ();
+        monitor->injected ().record (sent > received ? sent - received : 0);
+        return;
+    }
 
-        uint8_t* buf = data.get();
-        uint8_t* in = buf;
+    // the timestamps usually arrive during the send call, those of queued frames with a later batch
+    uint32_t id;
+    uint64_t time;
+    while (outputSocket->sentTimestamp (id, time))
+    {
+        // unknown or overwritten by later requests
+        if (m_stamps - id - 1 >= TIMESTAMPS)
+            continue;
+        const uint64_t r = m_stampTimes[id % TIMESTAMPS];
+        monitor->injected ().record (time > r ? time - r : 0);
+    }
+}
 
-        while (1)
+void Sender::threadFunc (SenderConfig config, L2Socket* outputSocket, TunnelSocket* inputSocket)
+{
+    Console::PrintDebug ("Sender started\n");
+
+    StatsWriter stats (config.stats, "sender");
+    try
+    {
+        Frame frames[BATCH_SIZE];
+        bool gso[BATCH_SIZE];
+        LatencyMonitor* monitor = config.monitor;
+        // with a queue, the frames are copied out of the receive buffer of the tunnel
+        if (m_queue)
         {
-            const TunnelHeader* pHeader = (TunnelHeader*)buf;
+            FramePoolConfig poolConfig;
+            poolConfig.count      = (unsigned)(m_queue->capacity () + 2 * BATCH_SIZE);
+            poolConfig.bufferSize = sizeof (GsoHeader) + config.mtu;
+            m_pool = FramePool::create (poolConfig);
+        }
 
-            // receive until we have a full header
-            while (ptrdiff_to_len (in, buf) < headerLen)
-                in += inputSocket->recv (in, bufSize - ptrdiff_to_len (in, buf));
+        while (!m_queue || !m_queue->isClosed ())
+        {
+            // the transport splits the received data into frames,
+            // all of them are handed over to the layer 2 socket at once
+            size_t count = inputSocket->recvBatch (frames, BATCH_SIZE);
 
-            // check the payload size
-            uint32_t payloadLen = pHeader->getLength();
-            if (payloadLen > mtu)
-                throw std::length_error ("Length exceeds MTU of interface");
+            if (!count)
+                continue;
 
-            // receive until we have a full payload
-            while (ptrdiff_to_len (in, buf) < payloadLen + headerLen)
-                in += inputSocket->recv (in, bufSize - ptrdiff_to_len (in, buf));
+            MacTable* macTable = config.macTable;
+            const uint64_t now = macTable ? MacTable::now () : 0;
+            const uint64_t received = monitor ? LatencyMonitor::wallClock () : 0;
 
-            // process the received stuff (might contain multiple packets)
-            do
+            stats.begin ();
+            stats.batch (count);
+            size_t valid = 0;
+            for (size_t n = 0; n < count; n++)
             {
-                if (pHeader->isPacket())
-                    outputSocket->send (pHeader->payload(), pHeader->getLength());
-                pHeader = pHeader->next ();
+                if (frames[n].len <= config.mtu)
+                {
+                    if (macTable && frames[n].len >= 12)
+                        macTable->learn (frames[n].data + 6, MacTable::REMOTE, now);
+                    stats.frame (frames[n]);
+                    const bool isGso = inputSocket->isGso (n);
+                    if (m_pool)
+                    {
+                        // a GSO frame is copied with its GsoHeader
+                        FrameRef frame = m_pool->copy (frames[n], sizeof (GsoHeader), isGso ? sizeof (GsoHeader) : 0);
+                        if (frame)
+                        {
+                            frame.setTime (received);
+                            frame.setGso (isGso);
+                        }
+                        if (!frame || !m_queue->push (std::move (frame)))
+                            stats.queueDrop ();
+                    }
+                    else
+                    {
+                        gso[valid]      = isGso;
+                        frames[valid++] = frames[n];
+                    }
+                }
+                else
+                {
+                    stats.drop ();
+                }
+            }
+            if (m_queue)
+                stats.queue (m_queue->size ());
+            stats.end ();
+
+            if (m_queue)
+                m_queue->notify ();
+            else if (valid)
+                inject (outputSocket, monitor, frames, gso, valid, received);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        stats.begin ();
+        stats.error ();
+        stats.end ();
+        Console::PrintError ("%s\n", e.what());
+    }
+    if (m_queue)
+        m_queue->close ();
+    if (config.monitor)
+        config.monitor->printStatistics ();
+    Console::PrintDebug ("Sender terminated\n");
 
-            } while ((uint8_t*)pHeader + headerLen < in && pHeader->payload() + pHeader->getLength() < in);
+    terminated ();
+}
+
+void Sender::injectFunc (L2Socket* outputSocket, LatencyMonitor* monitor)
+{
+    Console::PrintDebug ("Sender inject started\n");
 
-            BUG_ON (in < (uint8_t*)pHeader);
+    try
+    {
+        FrameRef refs[BATCH_SIZE];
+        Frame frames[BATCH_SIZE];
+        bool gso[BATCH_SIZE];
 
-            if ((uint8_t*)pHeader == in)
+        while (1)
+        {
+            size_t count = m_queue->pop (refs, BATCH_SIZE);
+            if (!count)
             {
-                // no fragments left, reset pointer
-                in = buf;
+                if (m_queue->isClosed ())
+                    break;
+                continue;
             }
-            else
+
+            for (size_t n = 0; n < count; n++)
             {
-                // copy fragments to to start of buffer
-                // processing will be finished on next loop iteration
-                std::memmove (buf, pHeader, in - (uint8_t*)pHeader);
-                in = buf + (in - (uint8_t*)pHeader);
+                frames[n] = refs[n].frame ();
+                gso[n]    = refs[n].isGso ();
             }
+            inject (outputSocket, monitor, frames, gso, count, refs[0].time ());
+            for (size_t n = 0; n < count; n++)
+                refs[n].reset ();
         }
-
-        /*
-        while ()
-        {
-            // hier sind wir immer am Puffer Anfang, es kann aber schon ein Fragment vorhanden sein
-            // --> header passt immer rein
-            // --> header könnte schon teilweise oder vollständig vorhanden sein
-            // --> auf offset 0 liegt immer ein Header
-            // --> payload passt immer rein
-            // --> payload könnte schon teilweise vorhanden sein
-
-            empfangen so lange bis mindestens ein packet vollständig ist ()
-                so lange empfangen, bis inIndex >= headerLen
-                Header auswerten
-                so lange empfangen, bis mindestens eine payload vollständig ist
-                inIndex in allen Schritten aktualisieren
-            alle empfangenen Packete versenden ()
-                outIndex setzen
-            puffer auf Anfang setzen ()
-                if (fragmente vorhanden)
-                    fragmente auf Anfang kopieren
-                    in und out Index entsprechend setzen
-                else
-                    inIndex = outIndex = 0
-        }
-        */
     }
     catch(const std::exception& e)
     {
         Console::PrintError ("%s\n", e.what());
     }
-    Console::PrintDebug ("Sender terminated\n");
+    m_queue->close ();
+    m_queue->printStatistics ("sender");
+
+    Console::PrintDebug ("Sender inject terminated\n");
 
-    if (finished)
-        finished->release ();
-}
\ No newline at end of file
+    terminated ();
+}
@@ -20,26 +20,75 @@
 #ifndef SENDER_HPP
 #define SENDER_HPP
 
+#include <atomic>
+#include <memory>
 #include <thread>
 #include <semaphore>
 
-class RawSocket;
-class TcpSocket;
+#include "framequeue.hpp"
 
+class L2Socket;
+class TunnelSocket;
+struct StatsSlot;
+class MacTable;
+class LatencyMonitor;
+struct Frame;
+
+struct SenderConfig
+{
+    unsigned   mtu;
+    StatsSlot* stats; // shared memory slot for the statistics, may be null
+    MacTable*  macTable; // learned addresses, may be null
+    FrameQueueConfig queue; // receive and inject in separate threads
+    LatencyMonitor* monitor; // records the residence time of the frames, may be null
+
+    SenderConfig () :
+        mtu (1500),
+        stats (nullptr),
+        macTable (nullptr),
+        monitor (nullptr)
+    {
+    }
+};
+
+// Receives frames from the tunnel and injects them. With a queue, receiving and
+// injecting are done by two threads.
 class Sender
 {
 public:
-    Sender (unsigned mtu, const RawSocket* outputSocket, const TcpSocket* inputSocket, std::binary_semaphore* finished = nullptr);
+    // finished is released when the first thread terminates
+    Sender (const SenderConfig& config, L2Socket* outputSocket, TunnelSocket* inputSocket, std::binary_semaphore* finished = nullptr);
     ~Sender ();
     void join ()
     {
         m_thread.join ();
+        if (m_injectThread.joinable ())
+            m_injectThread.join ();
     }
 
-    void threadFunc (unsigned mtu, const RawSocket* outputSocket, const TcpSocket* inputSocket, std::binary_semaphore* finished);
+    void threadFunc (SenderConfig config, L2Socket* outputSocket, TunnelSocket* inputSocket);
+    void injectFunc (L2Socket* outputSocket, LatencyMonitor* monitor);
 
 private:
+    void terminated ();
+    // sends the frames and records the time the first one took from leaving the tunnel (received) until it was injected.
+    // gso flags the frames which are preceded by their GsoHeader.
+    void inject (L2Socket* outputSocket, LatencyMonitor* monitor, const Frame* frames, const bool* gso, size_t count,
+        uint64_t received);
+
+    // copies of received frames, destroyed after the queue and the threads, which hold frames of it
+    std::unique_ptr<FramePool> m_pool;
+    std::unique_ptr<FrameQueue> m_queue;
+    std::binary_semaphore* m_finished;
+    std::atomic_flag m_terminated;
     std::thread m_thread;
+    std::thread m_injectThread;
+
+    // received times of the frames whose injection is timestamped by the kernel, indexed by
+    // the number of the request. Used by the thread injecting the frames only.
+    static const unsigned TIMESTAMPS = 64;
+    uint64_t m_stampTimes[TIMESTAMPS];
+    uint32_t m_stamps = 0;
 };
 
 
@@ -23,12 +23,16 @@
 #else
 #include <unistd.h>
 #include <poll.h>
+#include <sys/socket.h>
 #endif
 
 #include "bug.hpp"
 #include "socketevent.hpp"
 #include "socketexception.hpp"
 
+// ------------ local helper functions ------------
+static bool isTerminated (SOCKET s, short revents);
+
 
 SocketEvent::SocketEvent () : m_cancel (INVALID_EVENT)
 {
@@ -71,7 +75,11 @@ bool SocketEvent::wait (SOCKET s, bool &recv, bool &send, int timeout) const
         }
     };
 
-    int ret = poll (pollfd, sizeof (pollfd) / sizeof (struct pollfd), timeout);
+    struct timespec ts;
+    ts.tv_sec  = timeout / 1000000;
+    ts.tv_nsec = (timeout % 1000000) * 1000;
+
+    int ret = ppoll (pollfd, sizeof (pollfd) / sizeof (struct pollfd), timeout < 0 ? nullptr : &ts, nullptr);
     if (ret < 0)
         throw SocketException();
 
@@ -92,18 +100,68 @@ bool SocketEvent::wait (SOCKET s, bool &recv, bool &send, int timeout) const
     }
 
     // connection terminated
-    if (pollfd[1].revents & (POLLERR | POLLHUP | POLLNVAL))
+    if (isTerminated (s, pollfd[1].revents))
     {
         throw SocketException ("Connection reset by peer");
     }
-    // data received
-    recv = pollfd[1].revents & POLLIN;
+    // data received, or a pending zero copy notification
+    recv = recv && (pollfd[1].revents & (POLLIN | POLLERR));
     // ready for send
     send = pollfd[1].revents & POLLOUT;
 
     return recv || send;
 }
 
+bool SocketEvent::waitRecv (const SOCKET* sockets, bool* ready, size_t count, int timeout) const
+{
+    BUG_ON (count > MAX_SOCKETS);
+
+    struct pollfd pollfd[1 + MAX_SOCKETS];
+    pollfd[0].fd      = m_cancel;
+    pollfd[0].events  = POLLIN;
+    pollfd[0].revents = 0;
+    for (size_t n = 0; n < count; n++)
+    {
+        pollfd[n + 1].fd      = sockets[n];
+        pollfd[n + 1].events  = POLLIN;
+        pollfd[n + 1].revents = 0;
+    }
+
+    struct timespec ts;
+    ts.tv_sec  = timeout / 1000000;
+    ts.tv_nsec = (timeout % 1000000) * 1000;
+
+    int ret = ppoll (pollfd, count + 1, timeout < 0 ? nullptr : &ts, nullptr);
+    if (ret < 0)
+        throw SocketException();
+
+    // timeout
+    if (ret == 0)
+    {
+        BUG_ON (timeout < 0);
+        for (size_t n = 0; n < count; n++)
+            ready[n] = false;
+        return false;
+    }
+
+    // cancel request
+    if (pollfd[0].revents & POLLIN)
+    {
+        throw SocketException ("");
+    }
+
+    for (size_t n = 0; n < count; n++)
+    {
+        // connection terminated
+        if (isTerminated (sockets[n], pollfd[n + 1].revents))
+        {
+            throw SocketException ("Connection reset by peer");
+        }
+        ready[n] = pollfd[n + 1].revents & (POLLIN | POLLERR);
+    }
+
+    return true;
+}
 
 void SocketEvent::cancel () const
 {
@@ -113,3 +171,20 @@ void SocketEvent::cancel () const
         throw SocketException();
 #endif
 }
+
+
+// ------------ local helper functions ------------
+
+// POLLERR is also signaled for zero copy completions in the error queue,
+// the connection is only broken if there is a socket error
+bool isTerminated (SOCKET s, short revents)
+{
+    if (revents & (POLLHUP | POLLNVAL))
+        return true;
+    if (!(revents & POLLERR))
+        return false;
+
+    int error = 0;
+    socklen_t len = sizeof (error);
+    return ::getsockopt (s, SOL_SOCKET, SO_ERROR, &error, &len) || error;
+}
@@ -19,6 +19,8 @@
 #ifndef SOCKETEVENT_HPP
 #define SOCKETEVENT_HPP
 
+#include <cstddef>
+
 #include "sockettype.h"
 
 typedef int EVENT;
@@ -34,6 +36,7 @@ public:
     SocketEvent (SocketEvent&& obj);
     ~SocketEvent ();
 
+    // timeout in microseconds, -1 waits forever
     bool wait (SOCKET s, bool &recv, bool &send, int timeout = -1) const;
     bool waitRecv (SOCKET s, int timeout = -1) const
     {
@@ -47,8 +50,12 @@ public:
         bool out = true;
         return wait (s, in, out, timeout);
     }
+    // wait until at least one of the sockets is readable, ready[i] is set accordingly
+    bool waitRecv (const SOCKET* sockets, bool* ready, size_t count, int timeout = -1) const;
     void cancel () const;
 
+    static const size_t MAX_SOCKETS = 32;
+
 private:
     EVENT  m_cancel;
 };
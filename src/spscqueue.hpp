@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPSCQUEUE_HPP
+#define SPSCQUEUE_HPP
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+
+// Bounded lock-free queue between one producer and one consumer thread. Each slot
+// carries a sequence number telling whether it is free for the producer or filled
+// for the consumer, so besides the consumer the producer may remove the oldest
+// entry as well (head drop) without racing with a concurrent pop.
+template <typename T>
+class SpscQueue
+{
+public:
+    // the capacity is rounded up to a power of two
+    explicit SpscQueue (size_t capacity) :
+        m_mask (std::bit_ceil (capacity < 2 ? 2 : capacity) - 1),
+        m_slots (new Slot[m_mask + 1]),
+        m_head (0),
+        m_tail (0)
+    {
+        for (size_t n = 0; n <= m_mask; n++)
+            m_slots[n].seq.store (n, std::memory_order_relaxed);
+    }
+    SpscQueue (const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer only, returns false if the queue is full
+    bool push (T&& item)
+    {
+        const size_t tail = m_tail.load (std::memory_order_relaxed);
+        Slot& slot = m_slots[tail & m_mask];
+        // not yet released by the consumer
+        if (slot.seq.load (std::memory_order_acquire) != tail)
+            return false;
+        slot.item = std::move (item);
+        slot.seq.store (tail + 1, std::memory_order_release);
+        m_tail.store (tail + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // consumer, or the producer to drop the oldest entry. Returns false if the queue is empty.
+    bool pop (T& item)
+    {
+        size_t head = m_head.load (std::memory_order_relaxed);
+        while (1)
+        {
+            Slot& slot = m_slots[head & m_mask];
+            const ptrdiff_t diff = (ptrdiff_t)(slot.seq.load (std::memory_order_acquire) - (head + 1));
+            if (diff < 0)
+                return false;
+            if (diff > 0)
+            {
+                // the other side popped it meanwhile
+                head = m_head.load (std::memory_order_relaxed);
+                continue;
+            }
+            if (m_head.compare_exchange_weak (head, head + 1, std::memory_order_relaxed))
+            {
+                item = std::move (slot.item);
+                // the slot can be filled again in the next round
+                slot.seq.store (head + m_mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    // approximate number of entries
+    size_t size () const
+    {
+        const size_t head = m_head.load (std::memory_order_relaxed);
+        const size_t tail = m_tail.load (std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+    size_t capacity () const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        T item;
+    };
+
+    const size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+    alignas (64) std::atomic<size_t> m_head;
+    alignas (64) std::atomic<size_t> m_tail;
+};
+
+#endif
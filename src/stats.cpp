@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <new>
+#include <system_error>
+#include <thread>
+
+#include "stats.hpp"
+
+
+StatsWriter::StatsWriter (StatsSlot* slot, const char* name) :
+    m_slot (slot),
+    m_seq (0)
+{
+    if (!m_slot)
+    {
+        m_private = std::make_unique<StatsSlot> ();
+        m_slot = m_private.get ();
+    }
+    m_seq = m_slot->seq.load (std::memory_order_relaxed) & ~1u;
+
+    begin ();
+    std::memset (&m_slot->stats, 0, sizeof (m_slot->stats));
+    std::strncpy (m_slot->stats.name, name, sizeof (m_slot->stats.name) - 1);
+    end ();
+}
+
+
+static size_t regionSize (unsigned slots)
+{
+    return sizeof (StatsHeader) + slots * sizeof (StatsSlot);
+}
+
+static std::string shmName (const std::string& name)
+{
+    return "/l2tun-" + name;
+}
+
+StatsRegion::StatsRegion (const std::string& name, bool owner, void* map, size_t size) :
+    m_name (name),
+    m_owner (owner),
+    m_map (map),
+    m_size (size),
+    m_header ((StatsHeader*)map),
+    m_slots ((StatsSlot*)((uint8_t*)map + sizeof (StatsHeader)))
+{
+}
+
+StatsRegion::~StatsRegion ()
+{
+    ::munmap (m_map, m_size);
+    if (m_owner)
+        ::shm_unlink (shmName (m_name).c_str ());
+}
+
+std::unique_ptr<StatsRegion> StatsRegion::create (const std::string& name, unsigned slots)
+{
+    const std::string path = shmName (name);
+    const size_t size = regionSize (slots);
+
+    ::shm_unlink (path.c_str ());
+    int fd = ::shm_open (path.c_str (), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw std::system_error (errno, std::generic_category(), "shm_open " + path);
+
+    if (ftruncate (fd, (off_t)size))
+    {
+        int error = errno;
+        ::close (fd);
+        ::shm_unlink (path.c_str ());
+        throw std::system_error (error, std::generic_category(), "ftruncate");
+    }
+    void* map = ::mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close (fd);
+    if (map == MAP_FAILED)
+    {
+        ::shm_unlink (path.c_str ());
+        throw std::system_error (error, std::generic_category(), "mmap");
+    }
+
+    // the memory is zeroed, so all sequence counters start even
+    std::unique_ptr<StatsRegion> r (new StatsRegion (name, true, map, size));
+    for (unsigned n = 0; n < slots; n++)
+        new (r->m_slots + n) StatsSlot ();
+    r->m_header->pid     = (int32_t)getpid ();
+    r->m_header->slots   = slots;
+    r->m_header->version = StatsHeader::VERSION;
+    std::atomic_thread_fence (std::memory_order_release);
+    r->m_header->magic   = StatsHeader::MAGIC;
+    return r;
+}
+
+std::unique_ptr<StatsRegion> StatsRegion::open (const std::string& name)
+{
+    const std::string path = shmName (name);
+    int fd = ::shm_open (path.c_str (), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::system_error (errno, std::generic_category(), "shm_open " + path);
+
+    struct stat st;
+    if (fstat (fd, &st))
+    {
+        int error = errno;
+        ::close (fd);
+        throw std::system_error (error, std::generic_category(), "fstat");
+    }
+    const size_t size = (size_t)st.st_size;
+    void* map = size >= sizeof (StatsHeader) ? ::mmap (nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    int error = size >= sizeof (StatsHeader) ? errno : EINVAL;
+    ::close (fd);
+    if (map == MAP_FAILED)
+        throw std::system_error (error, std::generic_category(), "mmap");
+
+    std::unique_ptr<StatsRegion> r (new StatsRegion (name, false, map, size));
+    const StatsHeader& h = r->header ();
+    if (h.magic != StatsHeader::MAGIC || h.version != StatsHeader::VERSION || regionSize (h.slots) > size)
+        throw std::system_error (EPROTO, std::generic_category(), path);
+    return r;
+}
+
+bool StatsRegion::read (unsigned index, ThreadStats& stats) const
+{
+    const StatsSlot* s = slot (index);
+    if (!s)
+        return false;
+
+    while (1)
+    {
+        const uint32_t seq = s->seq.load (std::memory_order_acquire);
+        if (!(seq & 1))
+        {
+            std::memcpy (&stats, (const void*)&s->stats, sizeof (stats));
+            std::atomic_thread_fence (std::memory_order_acquire);
+            if (s->seq.load (std::memory_order_relaxed) == seq)
+                return true;
+        }
+        std::this_thread::yield ();
+    }
+}
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "frame.hpp"
+#include "histogram.hpp"
+
+struct MacCounter
+{
+    uint64_t mac;   // the 6 address bytes in memory order
+    uint64_t count;
+};
+
+// counters of one data plane thread
+struct ThreadStats
+{
+    static const unsigned SIZE_BUCKETS  = 12; // up to 64 bytes, 65-128, ..., more than 64k
+    static const unsigned BATCH_BUCKETS = 8;  // 1 frame, 2-3, 4-7, ..., 128 and more
+    static const unsigned TOP_MACS      = 16;
+
+    char       name[16];
+    uint64_t   frames;
+    uint64_t   bytes;
+    uint64_t   drops;
+    uint64_t   local;  // unicast frames not tunneled, because the destination is local
+    uint64_t   errors;
+    uint64_t   batches;
+    uint64_t   queueDrops;  // frames dropped, because the queue to the next thread was full
+    uint64_t   queueLength; // frames in the queue after the last batch
+    uint64_t   queueMax;
+    uint64_t   poolDrops;   // frames dropped by the layer 2 socket, because all of its buffers were held
+    uint64_t   frameSizes[SIZE_BUCKETS];
+    uint64_t   batchSizes[BATCH_BUCKETS];
+    MacCounter macs[TOP_MACS]; // most frequent source addresses, approximated
+};
+
+// one thread's statistics in the shared memory segment, protected by a seqlock
+struct alignas (64) StatsSlot
+{
+    static const unsigned COALESCE_BUCKETS = 16; // 1 frame, 2-3, 4-7, ..., 16384 and more
+
+    std::atomic<uint32_t> seq;
+    alignas (64) ThreadStats stats;
+    // latencies in ns, recorded by the LatencyMonitor outside of the seqlock
+    Histogram residence; // from capture (receiver) or leaving the tunnel (sender) until the frame is passed on
+    Histogram rtt;       // round trip time of the probes (sender)
+    // frames per send of the coalescers (receiver), recorded by the thread sending
+    // through the tunnel outside of the seqlock
+    std::atomic<uint64_t> coalesced[COALESCE_BUCKETS];
+};
+
+struct alignas (64) StatsHeader
+{
+    static const uint32_t MAGIC   = 0x4c325453; // "L2TS"
+    static const uint32_t VERSION = 5;
+
+    uint32_t magic;
+    uint32_t version;
+    int32_t  pid;
+    uint32_t slots;
+};
+
+// Updates the statistics of the calling thread. Only this thread writes to the
+// slot, so the counters are plain memory. All updates of one batch are bracketed
+// by begin() and end(), a reader retries if it sees the sequence change.
+class StatsWriter
+{
+public:
+    // without a slot the statistics are collected in private memory
+    StatsWriter (StatsSlot* slot, const char* name);
+    StatsWriter (const StatsWriter&) = delete;
+    StatsWriter& operator=(const StatsWriter&) = delete;
+
+    void begin ()
+    {
+        m_slot->seq.store (++m_seq, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+    }
+    void end ()
+    {
+        m_slot->seq.store (++m_seq, std::memory_order_release);
+    }
+
+    void frame (const Frame& frame)
+    {
+        ThreadStats& s = m_slot->stats;
+        s.frames++;
+        s.bytes += frame.len;
+        s.frameSizes[bucket (frame.len <= 64 ? 0 : std::bit_width (frame.len - 1) - 6, ThreadStats::SIZE_BUCKETS)]++;
+        if (frame.len >= 12)
+            countMac (frame.data + 6);
+    }
+    void batch (size_t count)
+    {
+        ThreadStats& s = m_slot->stats;
+        s.batches++;
+        s.batchSizes[bucket (std::bit_width (count) - 1, ThreadStats::BATCH_BUCKETS)]++;
+    }
+    void drop ()
+    {
+        m_slot->stats.drops++;
+    }
+    void local ()
+    {
+        m_slot->stats.local++;
+    }
+    void error ()
+    {
+        m_slot->stats.errors++;
+    }
+    void queueDrop ()
+    {
+        m_slot->stats.queueDrops++;
+    }
+    void queue (size_t length)
+    {
+        ThreadStats& s = m_slot->stats;
+        s.queueLength = length;
+        if (length > s.queueMax)
+            s.queueMax = length;
+    }
+    void poolDrops (uint64_t total)
+    {
+        m_slot->stats.poolDrops = total;
+    }
+
+private:
+    static unsigned bucket (size_t n, unsigned buckets)
+    {
+        return n < buckets ? (unsigned)n : buckets - 1;
+    }
+
+    // space saving algorithm: an unknown address replaces the least frequent one
+    // and inherits its count, so heavy hitters are never evicted
+    void countMac (const uint8_t* addr)
+    {
+        uint64_t mac = 0;
+        std::memcpy (&mac, addr, 6);
+
+        MacCounter* min = m_slot->stats.macs;
+        for (MacCounter& m : m_slot->stats.macs)
+        {
+            if (m.mac == mac && m.count)
+            {
+                m.count++;
+                return;
+            }
+            if (m.count < min->count)
+                min = &m;
+        }
+        min->mac = mac;
+        min->count++;
+    }
+
+    std::unique_ptr<StatsSlot> m_private;
+    StatsSlot* m_slot;
+    uint32_t   m_seq;
+};
+
+// Shared memory segment /dev/shm/l2tun-NAME holding the statistics of all threads,
+// so they can be read by l2tun-stat without disturbing the data plane.
+class StatsRegion
+{
+public:
+    StatsRegion (const StatsRegion&) = delete;
+    StatsRegion& operator=(const StatsRegion&) = delete;
+    ~StatsRegion ();
+
+    // creates the segment, replacing a stale one of the same name
+    static std::unique_ptr<StatsRegion> create (const std::string& name, unsigned slots);
+    // maps an existing segment read only
+    static std::unique_ptr<StatsRegion> open (const std::string& name);
+
+    const StatsHeader& header () const
+    {
+        return *m_header;
+    }
+    StatsSlot* slot (unsigned index) const
+    {
+        return index < m_header->slots ? m_slots + index : nullptr;
+    }
+    // consistent copy of a slot, returns false if the slot doesn't exist
+    bool read (unsigned index, ThreadStats& stats) const;
+
+private:
+    StatsRegion (const std::string& name, bool owner, void* map, size_t size);
+
+    std::string  m_name;
+    bool         m_owner;
+    void*        m_map;
+    size_t       m_size;
+    StatsHeader* m_header;
+    StatsSlot*   m_slots;
+};
+
+#endif
@@ -0,0 +1,466 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include "streamgroup.hpp"
+#include "tunnel.hpp"
+#include "console.hpp"
+#include "latencymonitor.hpp"
+
+// ------------ local helper functions ------------
+static void sendHello (const TcpSocket& s, uint32_t group, uint16_t index, uint16_t count);
+static Hello recvHello (const TcpSocket& s);
+
+
+void StreamGroup::add (TcpSocket&& s)
+{
+    m_handles.push_back (s.handle ());
+    m_streams.push_back (std::move (s));
+}
+
+void StreamGroup::init (const StreamGroupConfig& config)
+{
+    // compressed batches are larger than a frame and collected by a coalescer,
+    // even if coalescing across sendBatch calls is disabled
+    const bool compress = config.compression.isEnabled ();
+    size_t maxPayload = config.mtu + sizeof (GsoHeader);
+    if (compress)
+        maxPayload = std::max (maxPayload, Compressor::MAX_PAYLOAD);
+    if (config.headerCompression)
+        maxPayload = std::max (maxPayload, HeaderCompressor::MAX_PAYLOAD);
+    CoalescerConfig coalescing = config.coalescing;
+    if (compress)
+    {
+        m_flushBatch = !coalescing.isEnabled ();
+        if (m_flushBatch)
+        {
+            coalescing.maxFrames = UINT_MAX;
+            coalescing.latency   = INT_MAX;
+        }
+        coalescing.maxBytes = std::min (coalescing.maxBytes, Compressor::MAX_BATCH);
+    }
+
+    unsigned notSentLowat = config.notSentLowat;
+
+    for (auto& s : m_streams)
+    {
+        if (coalescing.zeroCopy && !s.enableZeroCopy ())
+        {
+            Console::PrintError ("MSG_ZEROCOPY is not supported, batches are copied\n");
+            coalescing.zeroCopy = false;
+        }
+        if (notSentLowat && !s.setNotSentLowat (notSentLowat))
+        {
+            Console::PrintError ("TCP_NOTSENT_LOWAT is not supported\n");
+            notSentLowat = 0;
+        }
+        m_deframers.emplace_back (new Deframer (config.bufferSize, (uint32_t)maxPayload));
+        m_inflated.emplace_back ();
+        m_unpacked.emplace_back ();
+        if (config.headerCompression)
+        {
+            m_packers.emplace_back (new HeaderCompressor ());
+            m_packedFlows.push_back (0);
+        }
+        if (compress)
+            m_compressors.emplace_back (new Compressor (config.compression));
+        // each stream has its own coalescer, the latency budget applies per stream
+        if (coalescing.isEnabled ())
+            m_coalescers.emplace_back (new Coalescer (coalescing, &s, compress ? m_compressors.back ().get () : nullptr));
+    }
+}
+
+void StreamGroup::setStats (StatsSlot* stats)
+{
+    for (const auto& c : m_coalescers)
+        c->setStats (stats);
+}
+
+void StreamGroup::cancel () const
+{
+    m_event.cancel ();
+    for (const auto& s : m_streams)
+        s.cancel ();
+}
+
+void StreamGroup::sendBatch (const Frame* packets, size_t count)
+{
+    for (size_t n = 0; n < count; n++)
+    {
+        // the GsoHeader of a GSO packet isn't part of the frame
+        const bool gso = ((const TunnelHeader*)packets[n].data)->getType () == Type::GSO;
+        const size_t skip = sizeof (TunnelHeader) + (gso ? sizeof (GsoHeader) : 0);
+        const uint8_t* frame = packets[n].data + skip;
+        const size_t len = packets[n].len - skip;
+        // all frames of a flow take the same stream to keep their order,
+        // the compressor adapts to the flows
+        const uint32_t hash = m_streams.size () == 1 && m_compressors.empty () ? 0 : flowHash (frame, len);
+        const size_t stream = m_streams.size () == 1 ? 0 : select (hash);
+        const uint64_t flows = Compressor::flowSet (hash);
+
+        if (!m_packers.empty () && !gso)
+        {
+            // the frames are collected without their tunnel headers
+            bool packed = m_packers[stream]->add (frame, len);
+            if (!packed)
+            {
+                if (!m_packers[stream]->empty ())
+                    sendPacked (stream);
+                packed = m_packers[stream]->add (frame, len);
+            }
+            if (packed)
+                m_packedFlows[stream] |= flows;
+            // a frame too long for a PACKED packet is sent as it is
+            else
+                sendPacket (stream, packets[n].data, packets[n].len, flows);
+        }
+        else
+        {
+            // GSO packets aren't packed, the frames packed so far go first to keep the order
+            if (!m_packers.empty () && !m_packers[stream]->empty ())
+                sendPacked (stream);
+            sendPacket (stream, packets[n].data, packets[n].len, flows);
+        }
+    }
+
+    // one PACKED packet per stream and batch
+    for (size_t s = 0; s < m_packers.size (); s++)
+    {
+        if (!m_packers[s]->empty ())
+            sendPacked (s);
+    }
+    if (m_flushBatch)
+    {
+        for (const auto& c : m_coalescers)
+            c->flush ();
+    }
+}
+
+void StreamGroup::sendPacked (size_t stream)
+{
+    size_t len;
+    const uint8_t* packet = m_packers[stream]->finish (len);
+    sendPacket (stream, packet, len, m_packedFlows[stream]);
+    m_packedFlows[stream] = 0;
+}
+
+void StreamGroup::sendPacket (size_t stream, const uint8_t* packet, size_t len, uint64_t flows)
+{
+    if (!m_coalescers.empty ())
+    {
+        m_coalescers[stream]->add (packet, len, flows);
+    }
+    else
+    {
+        for (size_t sent = 0; sent < len; )
+            sent += m_streams[stream].send (packet + sent, len - sent);
+    }
+}
+
+void StreamGroup::sendProbe (const Probe& probe)
+{
+    uint8_t buf[sizeof (TunnelHeader) + sizeof (Probe)];
+    TunnelHeader::build (buf, Type::PROBE, sizeof (Probe));
+    std::memcpy (buf + sizeof (TunnelHeader), &probe, sizeof (Probe));
+
+    // it takes the same way as the frames, besides the header compression
+    if (!m_coalescers.empty ())
+    {
+        m_coalescers[0]->add (buf, sizeof (buf));
+        // without coalescing, the batch would wait for the next sendBatch call
+        if (m_flushBatch)
+            m_coalescers[0]->flush ();
+    }
+    else
+    {
+        for (size_t sent = 0; sent < sizeof (buf); )
+            sent += m_streams[0].send (buf + sent, sizeof (buf) - sent);
+    }
+}
+
+int StreamGroup::timeout () const
+{
+    int timeout = -1;
+    for (const auto& c : m_coalescers)
+    {
+        int t = c->timeout ();
+        if (t >= 0 && (timeout < 0 || t < timeout))
+            timeout = t;
+    }
+    return timeout;
+}
+
+void StreamGroup::flush ()
+{
+    for (const auto& c : m_coalescers)
+    {
+        if (c->timeout () == 0)
+            c->flush ();
+    }
+}
+
+size_t StreamGroup::recvBatch (Frame* frames, size_t count)
+{
+    // the frames returned by the last call are not used anymore
+    for (const auto& d : m_deframers)
+        d->release ();
+    for (auto& i : m_inflated)
+        i.busy = false;
+    for (auto& u : m_unpacked)
+        u.busy = false;
+    if (m_gso.size () < count)
+        m_gso.resize (count);
+
+    bool ready[Hello::MAX_STREAMS];
+    while (1)
+    {
+        // complete packets left over from the last call come first, new data is
+        // only received when all of them are consumed, so there is always room
+        // for at least one packet
+        size_t received = 0;
+        for (size_t s = 0; s < m_deframers.size () && received < count; s++)
+        {
+            Inflated& inflated = m_inflated[s];
+            Unpacked& unpacked = m_unpacked[s];
+            while (received < count)
+            {
+                if (unpacked.frames && unpacked.pos < unpacked.frames->size ())
+                {
+                    m_gso[received] = false;
+                    frames[received++] = (*unpacked.frames)[unpacked.pos++];
+                    unpacked.busy = true;
+                    continue;
+                }
+                // the next packet might be PACKED as well
+                if (unpacked.busy)
+                    break;
+
+                const TunnelHeader* pHeader;
+                const bool fromInflated = inflated.pos < inflated.len;
+                if (fromInflated)
+                {
+                    // packets of a decompressed batch are parsed in place
+                    pHeader = (const TunnelHeader*)(inflated.decompressor->data () + inflated.pos);
+                    if (inflated.len - inflated.pos < sizeof (TunnelHeader)
+                        || pHeader->getLength () > inflated.len - inflated.pos - sizeof (TunnelHeader))
+                        throw std::runtime_error ("Corrupted compressed batch");
+                    inflated.pos += sizeof (TunnelHeader) + pHeader->getLength ();
+                }
+                else
+                {
+                    // the next batch can't be decompressed before the frames of this one are used
+                    if (inflated.busy)
+                        break;
+                    if ((pHeader = m_deframers[s]->next ()) == nullptr)
+                        break;
+
+                    if (pHeader->getType () == Type::COMPRESSED && pHeader->getLength ())
+                    {
+                        if (!inflated.decompressor)
+                            inflated.decompressor.reset (new Decompressor ());
+                        inflated.pos = 0;
+                        inflated.len = inflated.decompressor->decompress (pHeader->payload (), pHeader->getLength ());
+                        continue;
+                    }
+                }
+                if (pHeader->getType () == Type::PACKED && pHeader->getLength ())
+                {
+                    if (!unpacked.decompressor)
+                        unpacked.decompressor.reset (new HeaderDecompressor ());
+                    unpacked.frames = &unpacked.decompressor->decompress (pHeader->payload (), pHeader->getLength ());
+                    unpacked.pos = 0;
+                    continue;
+                }
+                if (pHeader->getType () == Type::PROBE && pHeader->getLength () == sizeof (Probe))
+                {
+                    // the payload isn't necessarily aligned
+                    Probe probe;
+                    std::memcpy (&probe, pHeader->payload (), sizeof (probe));
+                    if (m_monitor)
+                        m_monitor->received (probe);
+                    continue;
+                }
+                const bool gso = pHeader->getType () == Type::GSO && pHeader->getLength () > sizeof (GsoHeader);
+                if (!gso && (!pHeader->isPacket() || !pHeader->getLength()))
+                    continue;
+
+                // a GSO frame is returned behind its GsoHeader
+                const size_t skip = gso ? sizeof (GsoHeader) : 0;
+                frames[received].data = (uint8_t*)pHeader->payload() + skip;
+                frames[received].len  = pHeader->getLength() - skip;
+                m_gso[received] = gso;
+                received++;
+                // only a returned frame keeps the decompressed batch from being overwritten
+                if (fromInflated)
+                    inflated.busy = true;
+            }
+        }
+        if (received)
+            return received;
+
+        m_event.waitRecv (m_handles.data (), ready, m_handles.size ());
+        for (size_t s = 0; s < m_streams.size (); s++)
+        {
+            if (!ready[s])
+                continue;
+
+            // zero copy completions are signaled as well
+            m_streams[s].reapZeroCopy ();
+            Deframer& deframer = *m_deframers[s];
+            deframer.release ();
+            deframer.commit (m_streams[s].tryRecv (deframer.writePtr (), deframer.writable ()));
+        }
+    }
+}
+
+void StreamGroup::printStatistics () const
+{
+    if (!m_flushBatch)
+    {
+        for (const auto& c : m_coalescers)
+            c->printStatistics ();
+    }
+    for (const auto& p : m_packers)
+        p->printStatistics ();
+    for (const auto& c : m_compressors)
+        c->printStatistics ();
+}
+
+StreamGroup StreamGroup::connect (const std::string& host, uint16_t remotePort, unsigned count,
+    const StreamGroupConfig& config, bool ipv4, bool ipv6)
+{
+    if (!count || count > Hello::MAX_STREAMS)
+        throw SocketException ("Invalid number of streams");
+
+    std::random_device random;
+    const uint32_t group = random ();
+
+    StreamGroup g;
+    g.m_streams.reserve (count);
+    for (unsigned n = 0; n < count; n++)
+    {
+        g.add (TcpSocket::connect (host, remotePort, ipv4, ipv6));
+#if HAVE_KTLS
+        if (config.tls)
+            config.tls->secure (g.m_streams.back(), host);
+#endif
+        sendHello (g.m_streams.back(), group, (uint16_t)n, (uint16_t)count);
+    }
+
+    // the server confirms the group, when all streams are accepted
+    for (const auto& s : g.m_streams)
+    {
+        if (recvHello (s).getGroup () != group)
+            throw SocketException ("Invalid handshake");
+    }
+
+    g.init (config);
+    return g;
+}
+
+StreamGroup StreamGroup::accept (const TcpSocket& server, std::string& addr, uint16_t& port,
+    const StreamGroupConfig& config)
+{
+    std::vector<std::pair<uint16_t, TcpSocket>> accepted;
+
+    TcpSocket first = server.accept (addr, port);
+#if HAVE_KTLS
+    if (config.tls)
+        config.tls->secure (first);
+#endif
+    Hello hello = recvHello (first);
+    const uint32_t group = hello.getGroup ();
+    const uint16_t count = hello.getCount ();
+    if (!count || count > Hello::MAX_STREAMS || hello.getIndex () >= count)
+        throw SocketException ("Invalid handshake");
+    accepted.emplace_back (hello.getIndex (), std::move (first));
+
+    while (accepted.size () < count)
+    {
+        std::string a;
+        uint16_t p;
+        TcpSocket s = server.accept (a, p);
+#if HAVE_KTLS
+        if (config.tls)
+            config.tls->secure (s);
+#endif
+        hello = recvHello (s);
+        if (hello.getGroup () != group || hello.getIndex () >= count)
+            throw SocketException ("Unexpected connection from " + a);
+        for (const auto& e : accepted)
+        {
+            if (e.first == hello.getIndex ())
+                throw SocketException ("Invalid handshake");
+        }
+        accepted.emplace_back (hello.getIndex (), std::move (s));
+    }
+
+    // streams are ordered by their index, so both sides agree on the flow distribution
+    StreamGroup g;
+    g.m_streams.reserve (count);
+    for (uint16_t n = 0; n < count; n++)
+    {
+        for (auto& e : accepted)
+        {
+            if (e.first == n)
+            {
+                sendHello (e.second, group, n, count);
+                g.add (std::move (e.second));
+                break;
+            }
+        }
+    }
+
+    Console::PrintDebug ("accepted %u streams\n", (unsigned)count);
+    g.init (config);
+    return g;
+}
+
+
+// ------------ local helper functions ------------
+
+void sendHello (const TcpSocket& s, uint32_t group, uint16_t index, uint16_t count)
+{
+    uint8_t buf[sizeof (TunnelHeader) + sizeof (Hello)];
+    TunnelHeader::build (buf, Type::HELLO, sizeof (Hello));
+    ((Hello*)(buf + sizeof (TunnelHeader)))->set (group, index, count);
+
+    for (size_t sent = 0; sent < sizeof (buf); )
+        sent += s.send (buf + sent, sizeof (buf) - sent);
+}
+
+Hello recvHello (const TcpSocket& s)
+{
+    uint8_t buf[sizeof (TunnelHeader) + sizeof (Hello)];
+
+    // the peer doesn't send anything else before the handshake is finished
+    for (size_t received = 0; received < sizeof (buf); )
+        received += s.recv (buf + received, sizeof (buf) - received);
+
+    const TunnelHeader* h = (const TunnelHeader*)buf;
+    if (h->getType () != Type::HELLO || h->getLength () != sizeof (Hello))
+        throw SocketException ("Invalid handshake");
+
+    return *(const Hello*)(buf + sizeof (TunnelHeader));
+}
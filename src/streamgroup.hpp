@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAMGROUP_HPP
+#define STREAMGROUP_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "tunnelsocket.hpp"
+#include "tcpsocket.hpp"
+#include "socketevent.hpp"
+#include "coalescer.hpp"
+#include "deframer.hpp"
+#include "compressor.hpp"
+#include "headercompressor.hpp"
+#include "flowhash.hpp"
+#include "tlscontext.hpp"
+
+struct StreamGroupConfig
+{
+    unsigned mtu;
+    size_t   bufferSize; // size of the receive buffer of each stream
+    CoalescerConfig coalescing;
+    CompressorConfig compression; // must be enabled on both sides
+    bool     headerCompression;       // must be enabled on both sides
+    const TlsContext* tls;            // encrypt the streams with kernel TLS, must be enabled on both sides
+    unsigned notSentLowat;            // max. unsent bytes in the socket buffer, 0 keeps the system default
+
+    StreamGroupConfig () :
+        mtu (1500),
+        bufferSize (4 * 1024 * 1024),
+        headerCompression (false),
+        tls (nullptr),
+        notSentLowat (0)
+    {
+    }
+};
+
+// All TCP connections between client and server. Frames are distributed over the
+// streams by their flow hash, so the frames of a flow keep their order.
+class StreamGroup : public TunnelSocket
+{
+public:
+    StreamGroup (const StreamGroup&) = delete;
+    StreamGroup& operator=(const StreamGroup&) = delete;
+    StreamGroup& operator=(const StreamGroup&&) = delete;
+    StreamGroup (StreamGroup&& obj) = default;
+
+    // client side: open count connections and bind them with a HELLO handshake
+    static StreamGroup connect (const std::string& host, uint16_t remotePort, unsigned count,
+        const StreamGroupConfig& config, bool ipv4 = true, bool ipv6 = true);
+    // server side: accept all connections of the next client
+    static StreamGroup accept (const TcpSocket& server, std::string& addr, uint16_t& port,
+        const StreamGroupConfig& config);
+
+    size_t size () const
+    {
+        return m_streams.size ();
+    }
+    const TcpSocket& operator[] (size_t n) const
+    {
+        return m_streams[n];
+    }
+
+    // index of the stream the frame has to be sent on
+    size_t select (const uint8_t* frame, size_t len) const
+    {
+        return m_streams.size () == 1 ? 0 : select (flowHash (frame, len));
+    }
+    size_t select (uint32_t hash) const
+    {
+        return hash % m_streams.size ();
+    }
+
+    void sendBatch (const Frame* packets, size_t count) override;
+    int timeout () const override;
+    void flush () override;
+    // probes are sent on the first stream
+    void sendProbe (const Probe& probe) override;
+    void setLatencyMonitor (LatencyMonitor* monitor) override
+    {
+        m_monitor = monitor;
+    }
+    void setStats (StatsSlot* stats) override;
+    size_t recvBatch (Frame* frames, size_t count) override;
+    bool isGso (size_t n) const override
+    {
+        return n < m_gso.size () && m_gso[n];
+    }
+    void cancel () const override;
+    void printStatistics () const override;
+
+private:
+    StreamGroup () {}
+    void add (TcpSocket&& s);
+    void init (const StreamGroupConfig& config);
+
+    std::vector<TcpSocket> m_streams;
+    std::vector<SOCKET> m_handles;
+    SocketEvent m_event;
+
+    // decompressed batch of a stream, its packets are returned before
+    // the next packet of the stream
+    struct Inflated
+    {
+        std::unique_ptr<Decompressor> decompressor;
+        size_t pos  = 0;
+        size_t len  = 0;
+        bool   busy = false; // frames returned by the current recvBatch call point into it
+    };
+
+    // frames restored from a PACKED packet of a stream
+    struct Unpacked
+    {
+        std::unique_ptr<HeaderDecompressor> decompressor;
+        const std::vector<Frame>* frames = nullptr;
+        size_t pos  = 0;
+        bool   busy = false; // frames returned by the current recvBatch call point into it
+    };
+
+    void sendPacked (size_t stream);
+    void sendPacket (size_t stream, const uint8_t* packet, size_t len, uint64_t flows);
+
+    // used by the receiver thread only
+    std::vector<std::unique_ptr<HeaderCompressor>> m_packers;
+    std::vector<uint64_t> m_packedFlows; // Compressor::flowSet() of the frames of each packer
+    std::vector<std::unique_ptr<Compressor>> m_compressors;
+    std::vector<std::unique_ptr<Coalescer>> m_coalescers;
+    bool m_flushBatch = false; // coalescers only collect the frames of one sendBatch call
+    // used by the sender thread only
+    std::vector<std::unique_ptr<Deframer>> m_deframers;
+    std::vector<Inflated> m_inflated;
+    std::vector<Unpacked> m_unpacked;
+    std::vector<bool> m_gso; // frames of the last recvBatch call which have a GsoHeader
+    LatencyMonitor* m_monitor = nullptr;
+};
+
+#endif
@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <linux/if_tun.h>
+#include <linux/if_ether.h>
+
+#include <cstring>
+#include <cerrno>
+
+#include "tapsocket.hpp"
+#include "bug.hpp"
+
+// the virtio-net header is received into the end of the room for the GsoHeader,
+// so the frame is behind it in any case
+static const size_t VNET_OFFSET = sizeof (GsoHeader) - sizeof (VirtioNetHeader);
+
+
+TapSocket::TapSocket () :
+    m_fd (-1),
+    m_headroom (0),
+    m_poolDrops (0)
+{
+}
+
+TapSocket::~TapSocket ()
+{
+    if (m_fd >= 0)
+        ::close (m_fd);
+}
+
+std::unique_ptr<TapSocket> TapSocket::open (const std::string& interface, const TapSocketConfig& config)
+{
+    if (interface.size () >= IFNAMSIZ)
+        throw SocketException ("Interface name too long");
+
+    std::unique_ptr<TapSocket> s (new TapSocket ());
+    s->m_headroom = config.headroom;
+
+    s->m_fd = ::open ("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (s->m_fd < 0)
+        throw SocketException ();
+
+    // every frame is preceded by a virtio-net header, in both directions
+    struct ifreq ifr;
+    std::memset (&ifr, 0, sizeof (ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+    std::memcpy (ifr.ifr_name, interface.c_str (), interface.size ());
+    if (::ioctl (s->m_fd, TUNSETIFF, &ifr))
+        throw SocketException ();
+
+    const int vnetLen = (int)sizeof (VirtioNetHeader);
+    if (::ioctl (s->m_fd, TUNSETVNETHDRSZ, &vnetLen))
+        throw SocketException ();
+
+    // Without offloads, the host segments and checksums the frames before they are handed
+    // to us. Sent GSO frames are accepted by the host in any case.
+    const unsigned long offloads = config.offloads
+        ? TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN : 0;
+    if (::ioctl (s->m_fd, TUNSETOFFLOAD, offloads))
+        throw SocketException ();
+
+    const unsigned batch = config.batchSize ? config.batchSize : 1;
+    s->m_rxPoolConfig.count      = config.rxPoolSize ? config.rxPoolSize : 2 * batch;
+    // one more byte, so longer frames which are truncated by the kernel can be detected
+    s->m_rxPoolConfig.bufferSize = config.headroom + sizeof (GsoHeader) + config.mtu + 1;
+    s->m_rxPoolConfig.hugePages  = config.hugePages;
+    s->m_rxRefs.resize (batch);
+    s->m_rxGso.resize (batch);
+
+    return s;
+}
+
+void TapSocket::cancel () const
+{
+    m_event.cancel ();
+}
+
+size_t TapSocket::recvBatch (Frame* frames, size_t count, int timeout)
+{
+    BUG_ON (!count);
+
+    if (count > m_rxRefs.size ())
+        count = m_rxRefs.size ();
+
+    if (!m_rxPool)
+        m_rxPool = FramePool::create (m_rxPoolConfig);
+
+    const size_t space = m_rxPoolConfig.bufferSize - m_headroom - VNET_OFFSET;
+    size_t n = 0;
+    while (n < count)
+    {
+        // buffers still held by the caller are replaced by new ones
+        FrameRef& ref = m_rxRefs[n];
+        if (!ref || ref.isShared ())
+        {
+            ref = m_rxPool->alloc ();
+            if (!ref)
+            {
+                // Like a NIC without free descriptors, the next frame is dropped instead
+                // of returning at once, so the caller doesn't spin until buffers come back.
+                if (!n)
+                    discard (timeout);
+                break;
+            }
+        }
+        uint8_t* buf = ref.buffer () + m_headroom;
+
+        auto ret = ::read (m_fd, buf + VNET_OFFSET, space);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                throw SocketException ();
+            // only wait for the first frame, everything else is fetched if already queued
+            if (n || !timeout || !m_event.waitRecv (m_fd, timeout))
+                break;
+            continue;
+        }
+        // frames longer than the MTU are dropped
+        if ((size_t)ret >= space || (size_t)ret < sizeof (VirtioNetHeader) + ETH_HLEN)
+            continue;
+
+        VirtioNetHeader hdr;
+        std::memcpy (&hdr, buf + VNET_OFFSET, sizeof (hdr));
+        frames[n].data = buf + sizeof (GsoHeader);
+        frames[n].len  = (size_t)ret - sizeof (hdr);
+        m_rxGso[n] = !hdr.isPlain ();
+        if (m_rxGso[n])
+            hdr.toTunnel ().prepend (frames[n]);
+        ref.setFrame (m_headroom + sizeof (GsoHeader), frames[n].len);
+        n++;
+    }
+    return n;
+}
+
+void TapSocket::discard (int timeout)
+{
+    // the kernel drops the rest of the frame
+    uint8_t buf[sizeof (VirtioNetHeader) + ETH_HLEN];
+    while (::read (m_fd, buf, sizeof (buf)) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            throw SocketException ();
+        if (!timeout || !m_event.waitRecv (m_fd, timeout))
+            return;
+    }
+    m_poolDrops++;
+}
+
+FrameRef TapSocket::hold (size_t n) const
+{
+    if (n >= m_rxRefs.size ())
+        return FrameRef ();
+    return m_rxRefs[n];
+}
+
+void TapSocket::sendBatch (const Frame* frames, size_t count)
+{
+    VirtioNetHeader hdr;
+    std::memset (&hdr, 0, sizeof (hdr));
+    for (size_t n = 0; n < count; n++)
+        send (hdr, frames[n]);
+}
+
+void TapSocket::sendGso (const Frame& frame)
+{
+    send (VirtioNetHeader::fromTunnel (GsoHeader::of (frame)), frame);
+}
+
+void TapSocket::send (const VirtioNetHeader& hdr, const Frame& frame)
+{
+    struct iovec iov[2];
+    iov[0].iov_base = (void*)&hdr;
+    iov[0].iov_len  = sizeof (hdr);
+    iov[1].iov_base = frame.data;
+    iov[1].iov_len  = frame.len;
+    while (::writev (m_fd, iov, 2) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        // Dropped like a qdisc would do if the host can't keep up or the device is down.
+        // Invalid virtio-net headers are dropped as well instead of closing the tunnel.
+        if (errno == EAGAIN || errno == ENOBUFS || errno == EIO || errno == EINVAL)
+            break;
+        throw SocketException ();
+    }
+}
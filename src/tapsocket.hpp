@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TAPSOCKET_HPP
+#define TAPSOCKET_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "socketexception.hpp"
+#include "socketevent.hpp"
+#include "l2socket.hpp"
+#include "gso.hpp"
+
+
+struct TapSocketConfig
+{
+    unsigned mtu;        // max. length of a frame
+    size_t   headroom;   // free bytes in front of each frame returned by recvBatch
+    unsigned batchSize;  // max. number of frames per recvBatch call
+    unsigned rxPoolSize; // buffers frames are received into, 0 for 2 * batchSize
+    bool     hugePages;  // receive buffers in huge pages
+    bool     offloads;   // receive GSO frames and frames with partial checksums, see GsoHeader
+
+    TapSocketConfig () :
+        mtu (1500),
+        headroom (0),
+        batchSize (64),
+        rxPoolSize (0),
+        hugePages (false),
+        offloads (false)
+    {
+    }
+};
+
+// TAP device, frames the host sends to the device are received and sent frames are
+// received by the host. The device is created if it doesn't exist yet, it must be
+// configured (at least set up) by the user.
+class TapSocket : public L2Socket
+{
+public:
+    TapSocket (const TapSocket&) = delete;
+    TapSocket& operator=(const TapSocket&) = delete;
+    TapSocket& operator=(const TapSocket&&) = delete;
+    ~TapSocket ();
+
+    static std::unique_ptr<TapSocket> open (const std::string& interface, const TapSocketConfig& config = TapSocketConfig());
+
+    // the frames are received into pool buffers which can be held by the caller.
+    // If all of them are held, the next frame is dropped and 0 is returned.
+    size_t recvBatch (Frame* frames, size_t count, int timeout = -1) override;
+    FrameRef hold (size_t n) const override;
+    bool isGso (size_t n) const override
+    {
+        return n < m_rxGso.size () && m_rxGso[n];
+    }
+    uint64_t poolDrops () const override
+    {
+        return m_poolDrops;
+    }
+    void sendBatch (const Frame* frames, size_t count) override;
+    // GSO frames are handed to the host as a whole
+    void sendGso (const Frame& frame) override;
+    void cancel () const override;
+
+    int handle () const override
+    {
+        return m_fd;
+    }
+
+private:
+    TapSocket ();
+
+    void send (const VirtioNetHeader& hdr, const Frame& frame);
+    void discard (int timeout);
+
+    int m_fd;
+    SocketEvent m_event;
+    size_t m_headroom;
+
+    // the pool is created by the first recvBatch call, so it is local to the receiving thread
+    FramePoolConfig m_rxPoolConfig;
+    std::unique_ptr<FramePool> m_rxPool;
+    std::vector<FrameRef> m_rxRefs;
+    std::vector<bool> m_rxGso; // frames of the last batch which have a GsoHeader
+    uint64_t m_poolDrops;
+};
+
+#endif
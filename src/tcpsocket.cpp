@@ -23,44 +23,40 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#if HAVE_MSG_ZEROCOPY
+#include <ctime>
+#include <linux/errqueue.h>
+#endif
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #endif
 
 #include <cstring>
+#include <cerrno>
 #include <sstream>
 #include <list>
+#include <atomic>
 
 #include "tcpsocket.hpp"
+#include "addrinfo.hpp"
 
-// ------------ local helper functions ------------
-static std::string ipToString (const struct sockaddr* addr);
-    struct info
-    {
-        info (const struct addrinfo& info)
-        {
-            family = info.ai_family;
-            socktype = info.ai_socktype;
-            protocol = info.ai_protocol;
-            addrlen = info.ai_addrlen;
-            std::memcpy (&addr, info.ai_addr, addrlen);
-        }
-        int              family;
-        int              socktype;
-        int              protocol;
-        socklen_t        addrlen;
-        struct sockaddr_storage  addr;
-    };
-static void getaddrinfo (const std::string& node, uint16_t remotePort,
-    int family, int sockType, int protocol, std::list<info> &result);
+// shared by the thread sending and the one receiving, both may reap the notifications
+struct TcpSocket::ZeroCopy
+{
+    std::atomic<uint32_t> completed {0};
+    std::atomic<uint64_t> copied {0};
+};
 
 
 TcpSocket::TcpSocket (SOCKET s) : m_socket (s)
 {
 }
 
-TcpSocket::TcpSocket (TcpSocket&& obj)
+TcpSocket::TcpSocket (TcpSocket&& obj) : m_zeroCopy (std::move (obj.m_zeroCopy))
 {
     m_socket = obj.m_socket;
     obj.m_socket = INVALID_SOCKET;
@@ -92,7 +88,7 @@ void TcpSocket::cancel () const
 
 TcpSocket TcpSocket::connect (const std::string& host, uint16_t remotePort, bool ipv4, bool ipv6)
 {
-    std::list <struct info> r;
+    std::list <AddrInfo> r;
     int family = ipv4 && ipv6 ? AF_UNSPEC : (ipv6 ? AF_INET6 : AF_INET);
     ::getaddrinfo (host, remotePort, family, SOCK_STREAM, 0, r);
     for (const auto& addrInfo : r)
@@ -182,6 +178,20 @@ size_t TcpSocket::recv (void *buf, size_t len) const
     return (size_t)ret;
 }
 
+size_t TcpSocket::tryRecv (void *buf, size_t len) const
+{
+    auto ret = ::recv (m_socket, buf, len, MSG_DONTWAIT);
+
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (ret == 0)
+        throw SocketException ("Connection closed by peer");
+    if (ret < 0)
+        throw SocketException ();
+
+    return (size_t)ret;
+}
+
 size_t TcpSocket::send (const void *buf, size_t len) const
 {
     auto ret = ::send (m_socket, buf, len, 0); // auto because on windows the return value is int
@@ -191,6 +201,141 @@ size_t TcpSocket::send (const void *buf, size_t len) const
     return (size_t)ret;
 }
 
+size_t TcpSocket::trySend (const struct iovec* iov, size_t count) const
+{
+    struct msghdr msg;
+    std::memset (&msg, 0, sizeof (msg));
+    msg.msg_iov    = (struct iovec*)iov;
+    msg.msg_iovlen = count;
+
+    auto ret = ::sendmsg (m_socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (ret < 0)
+        throw SocketException ();
+
+    return (size_t)ret;
+}
+
+bool TcpSocket::setNotSentLowat (unsigned bytes) const
+{
+#if HAVE_TCP_NOTSENT_LOWAT
+    if (::setsockopt (m_socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof(bytes)))
+        throw SocketException ();
+    return true;
+#else
+    (void)bytes;
+    return false;
+#endif
+}
+
+#if HAVE_MSG_ZEROCOPY
+bool TcpSocket::enableZeroCopy ()
+{
+    const int enable = 1;
+    if (::setsockopt (m_socket, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)))
+    {
+        if (errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EINVAL)
+            return false;
+        throw SocketException ();
+    }
+    m_zeroCopy.reset (new ZeroCopy);
+    return true;
+}
+
+size_t TcpSocket::sendZeroCopy (const void *buf, size_t len) const
+{
+    auto ret = ::send (m_socket, buf, len, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (ret < 0 && errno == ENOBUFS)
+        return 0;
+    if (ret <= 0)
+        throw SocketException ();
+
+    return (size_t)ret;
+}
+
+uint32_t TcpSocket::reapZeroCopy () const
+{
+    if (!m_zeroCopy)
+        return 0;
+
+    while (1)
+    {
+        uint8_t control[128];
+        struct msghdr msg;
+        std::memset (&msg, 0, sizeof (msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof (control);
+
+        if (::recvmsg (m_socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                throw SocketException ();
+            return m_zeroCopy->completed.load (std::memory_order_acquire);
+        }
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm))
+        {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            const struct sock_extended_err* err = (const struct sock_extended_err*)CMSG_DATA (cm);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            if (err->ee_errno)
+            {
+                errno = (int)err->ee_errno;
+                throw SocketException ();
+            }
+            // TCP completes the calls in order, the kernel merges consecutive notifications
+            // into the range ee_info..ee_data. The other thread might have read a later one.
+            const uint32_t completed = err->ee_data + 1;
+            uint32_t current = m_zeroCopy->completed.load (std::memory_order_relaxed);
+            while ((int32_t)(completed - current) > 0
+                && !m_zeroCopy->completed.compare_exchange_weak (current, completed, std::memory_order_release))
+                ;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                m_zeroCopy->copied += err->ee_data - err->ee_info + 1;
+        }
+    }
+}
+
+void TcpSocket::waitZeroCopy (int timeout) const
+{
+    // pending notifications are signaled as POLLERR
+    struct pollfd pfd = {m_socket, 0, 0};
+    if (::poll (&pfd, 1, timeout) < 0 && errno != EINTR)
+        throw SocketException ();
+    if (pfd.revents & (POLLHUP | POLLNVAL))
+        throw SocketException ("Connection reset by peer");
+}
+#else
+bool TcpSocket::enableZeroCopy ()
+{
+    return false;
+}
+
+size_t TcpSocket::sendZeroCopy (const void *buf, size_t len) const
+{
+    return send (buf, len);
+}
+
+uint32_t TcpSocket::reapZeroCopy () const
+{
+    return 0;
+}
+
+void TcpSocket::waitZeroCopy (int) const
+{
+}
+#endif
+
+uint64_t TcpSocket::zeroCopyCopied () const
+{
+    return m_zeroCopy ? m_zeroCopy->copied.load () : 0;
+}
+
 std::string TcpSocket::getsockname () const
 {
     std::ostringstream out;
@@ -216,52 +361,3 @@ std::string TcpSocket::getpeername () const
     out << ipToString ((struct sockaddr *) &addr) << ":" << ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
     return out.str();
 }
-
-
-// ------------ local helper functions ------------
-
-std::string ipToString   (const struct sockaddr* addr)
-{
-    const char* ret = "";
-    if (addr->sa_family == AF_INET)
-    {
-        char ip[INET_ADDRSTRLEN];
-        ret = ::inet_ntop(AF_INET, &((struct sockaddr_in *)addr)->sin_addr , ip, sizeof(ip));
-    }
-    if (addr->sa_family == AF_INET6)
-    {
-        char ip[INET6_ADDRSTRLEN];
-        ret = ::inet_ntop(AF_INET6, &((struct sockaddr_in6 *)addr)->sin6_addr , ip, sizeof(ip));
-    }
-
-    if (!ret)
-        throw SocketException ();
-
-    return ret;
-}
-
-void getaddrinfo (const std::string& node, uint16_t remotePort,
-    int family, int sockType, int protocol, std::list<info>& result)
-{
-    struct addrinfo hints;
-    struct addrinfo *res, *rp;
-
-    std::memset (&hints, 0, sizeof (hints));
-    hints.ai_family   = family;
-    hints.ai_socktype = sockType;
-    hints.ai_protocol = protocol;
-    result.clear ();
-
-    int s = ::getaddrinfo (node.c_str (),
-        sockType != SOCK_RAW ? std::to_string(remotePort).c_str() : NULL,
-        &hints, &res);
-    if (s != 0)
-    {
-        throw SocketException (gai_strerror(s));
-    }
-    for (rp = res; rp != NULL; rp = rp->ai_next)
-    {
-        result.emplace_back (*rp);
-    }
-    freeaddrinfo (res);
-}
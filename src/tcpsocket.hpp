@@ -21,12 +21,14 @@
 
 #include <stdexcept>
 #include <string>
+#include <memory>
 #include <cstdint>
 
 #include "socketexception.hpp"
 #include "sockettype.h"
 #include "socketevent.hpp"
 
+struct iovec;
 
 class TcpSocket
 {
@@ -45,7 +47,28 @@ public:
 
     TcpSocket accept (std::string& addr, uint16_t& port) const;
     size_t recv (void *buf, size_t len) const;
+    // like recv, but returns 0 instead of waiting if no data is available
+    size_t tryRecv (void *buf, size_t len) const;
     size_t send (const void *buf, size_t len) const;
+    // gathering send which doesn't wait, returns the number of bytes sent (0 if the socket is full)
+    size_t trySend (const struct iovec* iov, size_t count) const;
+
+    // MSG_ZEROCOPY, returns false if not supported by the kernel
+    bool enableZeroCopy ();
+    // like send, but the buffer must not be modified until the kernel has completed this call.
+    // Returns 0 if the kernel can't pin more memory, wait for completions then.
+    size_t sendZeroCopy (const void *buf, size_t len) const;
+    // reads the completion notifications from the error queue without waiting, returns the number
+    // of completed sendZeroCopy calls. Any thread may reap, pending notifications wake up poll.
+    uint32_t reapZeroCopy () const;
+    // waits up to timeout milliseconds for completion notifications
+    void waitZeroCopy (int timeout) const;
+    // completed sendZeroCopy calls whose data the kernel had to copy anyway
+    uint64_t zeroCopyCopied () const;
+
+    // limits the unsent data in the socket buffer, send waits until less than bytes are unsent.
+    // Returns false if not supported.
+    bool setNotSentLowat (unsigned bytes) const;
 
     // get local address and port of socket
     std::string getsockname () const;
@@ -57,6 +80,11 @@ public:
         return m_socket != INVALID_SOCKET;
     }
 
+    SOCKET handle () const
+    {
+        return m_socket;
+    }
+
     void cancel () const;
 
 private:
@@ -64,6 +92,9 @@ private:
 
     SOCKET m_socket;
     SocketEvent m_event;
+
+    struct ZeroCopy;
+    std::unique_ptr<ZeroCopy> m_zeroCopy;
 };
 
 #endif
\ No newline at end of file
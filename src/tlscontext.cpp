@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <linux/tls.h>
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/kdf.h>
+#include <openssl/core_names.h>
+
+#include "tlscontext.hpp"
+#include "tcpsocket.hpp"
+#include "socketexception.hpp"
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+// traffic secrets of a connection, reported by OpenSSL's key log callback
+struct TrafficSecrets
+{
+    std::vector<uint8_t> client;
+    std::vector<uint8_t> server;
+};
+
+// ------------ local helper functions ------------
+static int secretsIndex ();
+static void keyLog (const SSL* ssl, const char* line);
+static std::string sslError (const char* what);
+static std::vector<uint8_t> expandLabel (const char* digest, const std::vector<uint8_t>& secret, const char* label, size_t len);
+static void setKey (int fd, int direction, unsigned cipher, const std::vector<uint8_t>& secret);
+
+
+TlsContext::TlsContext (struct ssl_ctx_st* ctx, bool server) :
+    m_ctx (ctx),
+    m_server (server)
+{
+}
+
+TlsContext::~TlsContext ()
+{
+    SSL_CTX_free (m_ctx);
+}
+
+std::unique_ptr<TlsContext> TlsContext::create (const TlsConfig& config, bool server)
+{
+    SSL_CTX* ctx = SSL_CTX_new (server ? TLS_server_method () : TLS_client_method ());
+    if (!ctx)
+        throw SocketException (sslError ("SSL_CTX_new"));
+    std::unique_ptr<TlsContext> tls (new TlsContext (ctx, server));
+
+    // only the ciphers the kernel implements
+    SSL_CTX_set_min_proto_version (ctx, TLS1_3_VERSION);
+    SSL_CTX_set_max_proto_version (ctx, TLS1_3_VERSION);
+    if (!SSL_CTX_set_ciphersuites (ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"))
+        throw SocketException (sslError ("SSL_CTX_set_ciphersuites"));
+    // session tickets would be sent with the traffic keys before the kernel takes over
+    SSL_CTX_set_num_tickets (ctx, 0);
+    SSL_CTX_set_keylog_callback (ctx, keyLog);
+
+    if (!config.certificate.empty ())
+    {
+        if (SSL_CTX_use_certificate_chain_file (ctx, config.certificate.c_str ()) != 1
+            || SSL_CTX_use_PrivateKey_file (ctx, config.certificate.c_str (), SSL_FILETYPE_PEM) != 1
+            || SSL_CTX_check_private_key (ctx) != 1)
+            throw SocketException (sslError (config.certificate.c_str ()));
+    }
+    if (!config.ca.empty ())
+    {
+        if (SSL_CTX_load_verify_locations (ctx, config.ca.c_str (), nullptr) != 1)
+            throw SocketException (sslError (config.ca.c_str ()));
+        SSL_CTX_set_verify (ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+    }
+    return tls;
+}
+
+void TlsContext::secure (const TcpSocket& s, const std::string& host) const
+{
+    std::unique_ptr<SSL, decltype (&SSL_free)> ssl (SSL_new (m_ctx), SSL_free);
+    if (!ssl || !SSL_set_fd (ssl.get (), s.handle ()))
+        throw SocketException (sslError ("SSL_new"));
+
+    if (!m_server && !host.empty ())
+    {
+        SSL_set_tlsext_host_name (ssl.get (), host.c_str ());
+        SSL_set1_host (ssl.get (), host.c_str ());
+    }
+
+    TrafficSecrets secrets;
+    SSL_set_ex_data (ssl.get (), secretsIndex (), &secrets);
+
+    ERR_clear_error ();
+    if ((m_server ? SSL_accept (ssl.get ()) : SSL_connect (ssl.get ())) != 1)
+        throw SocketException (sslError ("TLS handshake failed"));
+    if (secrets.client.empty () || secrets.server.empty ())
+        throw SocketException ("TLS traffic secrets not available");
+
+    // nothing was sent or received with the traffic keys so far, so the kernel starts with sequence number 0
+    const unsigned cipher = SSL_CIPHER_get_id (SSL_get_current_cipher (ssl.get ())) & 0xffff;
+    if (::setsockopt (s.handle (), SOL_TCP, TCP_ULP, "tls", sizeof ("tls")))
+    {
+        if (errno == ENOENT)
+            throw SocketException ("Kernel TLS is not available, load the tls module");
+        throw SocketException ();
+    }
+    setKey (s.handle (), TLS_TX, cipher, m_server ? secrets.server : secrets.client);
+    setKey (s.handle (), TLS_RX, cipher, m_server ? secrets.client : secrets.server);
+}
+
+
+// ------------ local helper functions ------------
+
+int secretsIndex ()
+{
+    static const int index = SSL_get_ex_new_index (0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+// lines in NSS key log format: <label> <client random> <secret>
+void keyLog (const SSL* ssl, const char* line)
+{
+    TrafficSecrets* secrets = (TrafficSecrets*)SSL_get_ex_data (ssl, secretsIndex ());
+    if (!secrets)
+        return;
+
+    std::vector<uint8_t>* secret = nullptr;
+    if (!std::strncmp (line, "CLIENT_TRAFFIC_SECRET_0 ", 24))
+        secret = &secrets->client;
+    else if (!std::strncmp (line, "SERVER_TRAFFIC_SECRET_0 ", 24))
+        secret = &secrets->server;
+    else
+        return;
+
+    const char* hex = std::strrchr (line, ' ') + 1;
+    secret->clear ();
+    for (; hex[0] && hex[1]; hex += 2)
+    {
+        char byte[3] = {hex[0], hex[1], 0};
+        secret->push_back ((uint8_t)std::strtoul (byte, nullptr, 16));
+    }
+}
+
+std::string sslError (const char* what)
+{
+    char buf[256];
+    unsigned long e = ERR_get_error ();
+    if (!e)
+        return what;
+    ERR_error_string_n (e, buf, sizeof (buf));
+    return std::string (what) + ": " + buf;
+}
+
+// HKDF-Expand-Label of RFC 8446 with an empty context
+std::vector<uint8_t> expandLabel (const char* digest, const std::vector<uint8_t>& secret, const char* label, size_t len)
+{
+    std::vector<uint8_t> info;
+    const std::string fullLabel = std::string ("tls13 ") + label;
+    info.push_back ((uint8_t)(len >> 8));
+    info.push_back ((uint8_t)len);
+    info.push_back ((uint8_t)fullLabel.size ());
+    info.insert (info.end (), fullLabel.begin (), fullLabel.end ());
+    info.push_back (0);
+
+    std::vector<uint8_t> out (len);
+    EVP_KDF* kdf = EVP_KDF_fetch (nullptr, "HKDF", nullptr);
+    EVP_KDF_CTX* ctx = kdf ? EVP_KDF_CTX_new (kdf) : nullptr;
+    int mode = EVP_KDF_HKDF_MODE_EXPAND_ONLY;
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string (OSSL_KDF_PARAM_DIGEST, (char*)digest, 0),
+        OSSL_PARAM_construct_int (OSSL_KDF_PARAM_MODE, &mode),
+        OSSL_PARAM_construct_octet_string (OSSL_KDF_PARAM_KEY, (void*)secret.data (), secret.size ()),
+        OSSL_PARAM_construct_octet_string (OSSL_KDF_PARAM_INFO, info.data (), info.size ()),
+        OSSL_PARAM_construct_end ()
+    };
+    const bool ok = ctx && EVP_KDF_derive (ctx, out.data (), out.size (), params) == 1;
+    EVP_KDF_CTX_free (ctx);
+    EVP_KDF_free (kdf);
+    if (!ok)
+        throw SocketException (sslError ("HKDF"));
+    return out;
+}
+
+void setKey (int fd, int direction, unsigned cipher, const std::vector<uint8_t>& secret)
+{
+    // the 12 byte IV is split into salt and explicit IV, both are constant with TLS 1.3
+    if (cipher == (TLS1_3_CK_AES_128_GCM_SHA256 & 0xffff))
+    {
+        struct tls12_crypto_info_aes_gcm_128 info;
+        std::memset (&info, 0, sizeof (info));
+        info.info.version     = TLS_1_3_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        const std::vector<uint8_t> key = expandLabel ("SHA256", secret, "key", sizeof (info.key));
+        const std::vector<uint8_t> iv  = expandLabel ("SHA256", secret, "iv", sizeof (info.salt) + sizeof (info.iv));
+        std::memcpy (info.key, key.data (), sizeof (info.key));
+        std::memcpy (info.salt, iv.data (), sizeof (info.salt));
+        std::memcpy (info.iv, iv.data () + sizeof (info.salt), sizeof (info.iv));
+        if (::setsockopt (fd, SOL_TLS, direction, &info, sizeof (info)))
+            throw SocketException ();
+    }
+    else if (cipher == (TLS1_3_CK_AES_256_GCM_SHA384 & 0xffff))
+    {
+        struct tls12_crypto_info_aes_gcm_256 info;
+        std::memset (&info, 0, sizeof (info));
+        info.info.version     = TLS_1_3_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        const std::vector<uint8_t> key = expandLabel ("SHA384", secret, "key", sizeof (info.key));
+        const std::vector<uint8_t> iv  = expandLabel ("SHA384", secret, "iv", sizeof (info.salt) + sizeof (info.iv));
+        std::memcpy (info.key, key.data (), sizeof (info.key));
+        std::memcpy (info.salt, iv.data (), sizeof (info.salt));
+        std::memcpy (info.iv, iv.data () + sizeof (info.salt), sizeof (info.iv));
+        if (::setsockopt (fd, SOL_TLS, direction, &info, sizeof (info)))
+            throw SocketException ();
+    }
+    else
+    {
+        throw SocketException ("Unsupported TLS cipher");
+    }
+}
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TLSCONTEXT_HPP
+#define TLSCONTEXT_HPP
+
+#include <string>
+#include <memory>
+
+class TcpSocket;
+struct ssl_ctx_st;
+
+struct TlsConfig
+{
+    std::string certificate; // PEM file with certificate chain and private key, required by the server
+    std::string ca;          // PEM file with CA certificates the peer is verified against
+};
+
+// TLS 1.3 for the tunnel connections. OpenSSL only does the handshake, afterwards
+// the record layer is handed to the kernel (kTLS), so the sockets are used exactly
+// as without TLS and the data isn't copied through user space buffers.
+class TlsContext
+{
+public:
+    TlsContext (const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+    ~TlsContext ();
+
+    // throws SocketException if the files can't be loaded
+    static std::unique_ptr<TlsContext> create (const TlsConfig& config, bool server);
+
+    // handshake on a connected socket, throws SocketException if it fails
+    // or if the kernel doesn't support TLS
+    void secure (const TcpSocket& s, const std::string& host = std::string()) const;
+
+private:
+    TlsContext (struct ssl_ctx_st* ctx, bool server);
+
+    struct ssl_ctx_st* m_ctx;
+    bool m_server;
+};
+
+#endif
@@ -20,7 +20,9 @@
 #define TUNNEL_HPP
 
 #include <cstdint>
+#include <cstring>
 #include "bug.hpp"
+#include "frame.hpp"
 
 static inline uint32_t swap32 (uint32_t val)
 {
@@ -39,20 +41,39 @@ static inline uint16_t swap16 (uint16_t val)
     return val;
 #endif
 }
+static inline uint64_t swap64 (uint64_t val)
+{
+#if HAVE_BIG_ENDIAN
+    return ((uint64_t)swap32 ((uint32_t)val) << 32) | swap32 ((uint32_t)(val >> 32));
+#else
+    return val;
+#endif
+}
 
 enum Type : uint16_t {
     NOP = 0,            // don't do anything
     HELLO = 0x326C,     // establish connection (client --HELLO-> server --HELLO-> client)
-    PACKET = 1        // encapsulated Ethernet packet
+    PACKET = 1,         // encapsulated Ethernet packet
+    COMPRESSED = 2,     // batch of packets, compressed as a whole
+    PACKED = 3,         // batch of packets with compressed headers
+    PROBE = 4,          // latency probe, echoed by the peer with its next probe
+    GSO = 5             // encapsulated GSO frame or frame with partial checksum, see GsoHeader
 };
 
 struct TunnelHeader
 {
     static void* packet (uint8_t* buf, uint32_t payloadLength)
+    {
+        return build (buf, Type::PACKET, payloadLength);
+    }
+    // Builds the header in the headroom of a frame. The GsoHeader in front of a GSO frame
+    // becomes part of the payload. Returns the whole packet.
+    static Frame encapsulate (const Frame& frame, bool gso);
+    static void* build (uint8_t* buf, Type type, uint32_t payloadLength)
     {
         TunnelHeader* h = (TunnelHeader*)buf;
         h->m_res = 0;
-        h->setType (Type::PACKET);
+        h->setType (type);
         h->setLength (payloadLength);
         return buf;
     }
@@ -98,4 +119,181 @@ private:
 // ensure packet struct without using compiler specific packing attributes/pragmas
 static_assert (sizeof (struct TunnelHeader) == 8, "TunnelHeader is not natural aligned");
 
+// payload of a HELLO packet, sent on each TCP stream of a connection
+struct Hello
+{
+    static const uint16_t MAX_STREAMS = 16;
+
+    void set (uint32_t group, uint16_t index, uint16_t count)
+    {
+        m_group = swap32 (group);
+        m_index = swap16 (index);
+        m_count = swap16 (count);
+    }
+    // random id, identical for all streams of a client
+    uint32_t getGroup () const
+    {
+        return swap32 (m_group);
+    }
+    uint16_t getIndex () const
+    {
+        return swap16 (m_index);
+    }
+    uint16_t getCount () const
+    {
+        return swap16 (m_count);
+    }
+
+private:
+    uint32_t m_group;
+    uint16_t m_index;
+    uint16_t m_count;
+};
+
+static_assert (sizeof (struct Hello) == 8, "Hello is not natural aligned");
+
+// payload of a COMPRESSED packet, followed by the compressed data
+struct CompressedHeader
+{
+    enum Algorithm : uint16_t {
+        LZ4 = 1,
+        ZSTD = 2
+    };
+
+    void set (Algorithm algorithm, uint32_t length)
+    {
+        m_algorithm = swap16 (algorithm);
+        m_res = 0;
+        m_len = swap32 (length);
+    }
+    Algorithm getAlgorithm () const
+    {
+        return (Algorithm)swap16 (m_algorithm);
+    }
+    // length of the uncompressed packets
+    uint32_t getLength () const
+    {
+        return swap32 (m_len);
+    }
+
+private:
+    uint16_t m_algorithm;
+    uint16_t m_res;
+    uint32_t m_len;
+};
+
+static_assert (sizeof (struct CompressedHeader) == 8, "CompressedHeader is not natural aligned");
+
+// payload of a PROBE packet. Each side sends probes periodically and echoes the last
+// probe of the peer in its next one, the times are only compared with the clock of
+// the side which set them.
+struct Probe
+{
+    // echoTime is the time of the echoed probe (0 if there is none), echoDelay
+    // the time it was held before this probe was sent
+    void set (uint64_t time, uint64_t echoTime, uint64_t echoDelay)
+    {
+        m_time      = swap64 (time);
+        m_echoTime  = swap64 (echoTime);
+        m_echoDelay = swap64 (echoDelay);
+    }
+    uint64_t getTime () const
+    {
+        return swap64 (m_time);
+    }
+    uint64_t getEchoTime () const
+    {
+        return swap64 (m_echoTime);
+    }
+    uint64_t getEchoDelay () const
+    {
+        return swap64 (m_echoDelay);
+    }
+
+private:
+    uint64_t m_time;
+    uint64_t m_echoTime;
+    uint64_t m_echoDelay;
+};
+
+static_assert (sizeof (struct Probe) == 24, "Probe is not natural aligned");
+
+// payload of a GSO packet, followed by the frame. A GSO frame of up to 64 KB is tunneled
+// as a whole and segmented by the kernel of the far end, a frame with a partial checksum
+// is checksummed there. The fields are those of the virtio-net header of the frame.
+// Within the buffers of a side, the GsoHeader is stored in front of its frame.
+struct GsoHeader
+{
+    // the checksum at csumStart + csumOffset is partial
+    static const uint8_t NEEDS_CSUM = 1;
+    // GSO frames are only tunneled with this MTU, both sides need it
+    static const unsigned MTU = 65535;
+
+    void set (uint8_t flags, uint8_t gsoType, uint16_t hdrLen, uint16_t gsoSize, uint16_t csumStart, uint16_t csumOffset)
+    {
+        m_flags      = flags;
+        m_gsoType    = gsoType;
+        m_hdrLen     = swap16 (hdrLen);
+        m_gsoSize    = swap16 (gsoSize);
+        m_csumStart  = swap16 (csumStart);
+        m_csumOffset = swap16 (csumOffset);
+        m_res        = 0;
+    }
+    uint8_t getFlags () const
+    {
+        return m_flags;
+    }
+    uint8_t getGsoType () const
+    {
+        return m_gsoType;
+    }
+    uint16_t getHdrLen () const
+    {
+        return swap16 (m_hdrLen);
+    }
+    uint16_t getGsoSize () const
+    {
+        return swap16 (m_gsoSize);
+    }
+    uint16_t getCsumStart () const
+    {
+        return swap16 (m_csumStart);
+    }
+    uint16_t getCsumOffset () const
+    {
+        return swap16 (m_csumOffset);
+    }
+
+    // the header in front of a frame, which isn't necessarily aligned
+    static GsoHeader of (const Frame& frame)
+    {
+        GsoHeader h;
+        std::memcpy (&h, frame.data - sizeof (GsoHeader), sizeof (GsoHeader));
+        return h;
+    }
+    void prepend (const Frame& frame) const
+    {
+        std::memcpy (frame.data - sizeof (GsoHeader), this, sizeof (GsoHeader));
+    }
+
+private:
+    uint8_t  m_flags;
+    uint8_t  m_gsoType;
+    uint16_t m_hdrLen;
+    uint16_t m_gsoSize;
+    uint16_t m_csumStart;
+    uint16_t m_csumOffset;
+    uint16_t m_res;
+};
+
+static_assert (sizeof (struct GsoHeader) == 12, "GsoHeader is not natural aligned");
+
+inline Frame TunnelHeader::encapsulate (const Frame& frame, bool gso)
+{
+    const size_t prefix = gso ? sizeof (GsoHeader) : 0;
+    uint8_t* buf = frame.data - prefix - sizeof (TunnelHeader);
+    build (buf, gso ? Type::GSO : Type::PACKET, (uint32_t)(prefix + frame.len));
+    return Frame {buf, sizeof (TunnelHeader) + prefix + frame.len};
+}
+
 #endif
\ No newline at end of file
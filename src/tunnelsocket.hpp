@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUNNELSOCKET_HPP
+#define TUNNELSOCKET_HPP
+
+#include <cstddef>
+
+#include "frame.hpp"
+
+class LatencyMonitor;
+struct Probe;
+struct StatsSlot;
+
+// common interface of all transports between client and server used by Receiver and Sender
+class TunnelSocket
+{
+public:
+    virtual ~TunnelSocket () {}
+
+    // Send count encapsulated frames, each one consists of tunnel header and payload.
+    // The transport might buffer them until flush() is called.
+    virtual void sendBatch (const Frame* packets, size_t count) = 0;
+    // remaining time in microseconds until buffered packets must be sent,
+    // -1 if nothing is buffered
+    virtual int timeout () const
+    {
+        return -1;
+    }
+    // send all buffered packets whose timeout expired
+    virtual void flush ()
+    {
+    }
+    // Send a latency probe, it is buffered like the frames. Probes received by recvBatch
+    // are passed to the monitor. Transports without probes ignore both.
+    virtual void sendProbe (const Probe& probe)
+    {
+        (void)probe;
+    }
+    virtual void setLatencyMonitor (LatencyMonitor* monitor)
+    {
+        (void)monitor;
+    }
+    // Publish the statistics of the sending side in the slot, which may be null.
+    // Must be called before the first frame is sent.
+    virtual void setStats (StatsSlot* stats)
+    {
+        (void)stats;
+    }
+
+    // Receive up to count frames, blocks until at least one is available.
+    // The returned frames contain the payload only and remain valid until the next call.
+    virtual size_t recvBatch (Frame* frames, size_t count) = 0;
+    // frame n of the last recvBatch call was a GSO packet, its GsoHeader is stored in front of it
+    virtual bool isGso (size_t n) const
+    {
+        (void)n;
+        return false;
+    }
+
+    // abort all blocking calls
+    virtual void cancel () const = 0;
+
+    virtual void printStatistics () const
+    {
+    }
+};
+
+#endif
@@ -0,0 +1,428 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <cstring>
+#include <cerrno>
+#include <list>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "udpsocket.hpp"
+#include "addrinfo.hpp"
+#include "tunnel.hpp"
+#include "console.hpp"
+
+// the kernel refuses GSO super packets with more segments
+static const size_t MAX_SEGMENTS = 64;
+// max. UDP payload of a super packet, IPv6 header assumed
+static const size_t MAX_GSO_BYTES = 65535 - 40 - 8;
+// number of datagrams (or GRO super packets) fetched at once
+static const size_t RX_MSG_COUNT = 8;
+static const size_t RX_MSG_SIZE  = 65536;
+// HELLO retransmissions of the client
+static const int HELLO_RETRIES = 5;
+static const int HELLO_TIMEOUT = 1000000;
+
+
+UdpSocket::UdpSocket (SOCKET s, const UdpSocketConfig& config, bool server)
+: m_socket (s), m_config (config), m_server (server), m_group (0), m_gso (false), m_gro (false),
+  m_maxSegment (0), m_rxNext (0)
+{
+}
+
+UdpSocket::~UdpSocket ()
+{
+    if (m_socket != INVALID_SOCKET)
+        ::close (m_socket);
+}
+
+void UdpSocket::cancel () const
+{
+    m_event.cancel ();
+}
+
+std::unique_ptr<UdpSocket> UdpSocket::connect (const std::string& host, uint16_t remotePort,
+    const UdpSocketConfig& config, bool ipv4, bool ipv6)
+{
+    std::list <AddrInfo> r;
+    int family = ipv4 && ipv6 ? AF_UNSPEC : (ipv6 ? AF_INET6 : AF_INET);
+    ::getaddrinfo (host, remotePort, family, SOCK_DGRAM, 0, r);
+    if (r.empty ())
+        throw SocketException (std::string("Could not resolve ") + host);
+
+    const AddrInfo& addrInfo = r.front ();
+    SOCKET fd = socket (addrInfo.family, addrInfo.socktype, addrInfo.protocol);
+    if (fd == INVALID_SOCKET)
+        throw SocketException();
+    std::unique_ptr<UdpSocket> s (new UdpSocket (fd, config, false));
+
+    if (::connect (fd, (sockaddr*)&addrInfo.addr, addrInfo.addrlen))
+        throw SocketException();
+
+    std::random_device random;
+    s->m_group = random ();
+
+    for (int n = 0; n < HELLO_RETRIES; n++)
+    {
+        s->sendHello ();
+        if (s->waitHello (HELLO_TIMEOUT))
+        {
+            s->setup ();
+            return s;
+        }
+    }
+
+    throw SocketException (std::string("No response from ") + host);
+}
+
+std::unique_ptr<UdpSocket> UdpSocket::accept (uint16_t port, std::string& addr, uint16_t& remotePort,
+    const UdpSocketConfig& config, bool ipv4, bool ipv6)
+{
+    SOCKET fd = socket (ipv6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0);
+    if (fd == INVALID_SOCKET)
+        throw SocketException();
+    std::unique_ptr<UdpSocket> s (new UdpSocket (fd, config, true));
+
+    const int enable = 1;
+    if (::setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)))
+        throw SocketException ();
+
+    struct sockaddr_storage address;
+    struct sockaddr_in*  addr4 = (struct sockaddr_in*)&address;
+    struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&address;
+    std::memset (&address, 0, sizeof (address));
+    if (!ipv6)
+    {
+        addr4->sin_family      = AF_INET;
+        addr4->sin_addr.s_addr = INADDR_ANY;
+        addr4->sin_port        = htons (port);
+    }
+    else
+    {
+        const int ipv6only = !ipv4;
+        if (::setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6only, sizeof(ipv6only)))
+            throw SocketException ();
+
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_addr   = in6addr_any;
+        addr6->sin6_port   = htons (port);
+    }
+
+    if (::bind (fd, (struct sockaddr *) &address, sizeof (address)))
+        throw SocketException ();
+
+    // everything except a valid HELLO is ignored
+    while (1)
+    {
+        uint8_t buf[sizeof (TunnelHeader) + sizeof (Hello)];
+        socklen_t addrLen = sizeof (address);
+
+        s->m_event.waitRecv (fd);
+        auto ret = ::recvfrom (fd, buf, sizeof (buf), MSG_DONTWAIT | MSG_TRUNC, (struct sockaddr *)&address, &addrLen);
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            throw SocketException ();
+
+        const TunnelHeader* h = (const TunnelHeader*)buf;
+        const Hello* hello = (const Hello*)(buf + sizeof (TunnelHeader));
+        if (ret != sizeof (buf) || h->getType () != Type::HELLO || h->getLength () != sizeof (Hello)
+            || hello->getCount () != 1)
+            continue;
+
+        if (::connect (fd, (struct sockaddr *)&address, addrLen))
+            throw SocketException ();
+
+        addr       = ipToString ((struct sockaddr *)&address);
+        remotePort = portOf ((struct sockaddr *)&address);
+        s->m_group = hello->getGroup ();
+        s->sendHello ();
+        s->setup ();
+        return s;
+    }
+}
+
+void UdpSocket::setup ()
+{
+    // large socket buffers absorb bursts, the kernel silently limits them to rmem_max/wmem_max
+    if (m_config.bufferSize)
+    {
+        const int size = (int)m_config.bufferSize;
+        ::setsockopt (m_socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+        ::setsockopt (m_socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof (addr);
+    if (::getsockname (m_socket, (struct sockaddr *)&addr, &len))
+        throw SocketException ();
+
+    // GSO segments must not exceed the path MTU, larger frames are sent one by one
+    // and fragmented by the IP layer
+    int pathMtu = 0;
+    socklen_t optLen = sizeof (pathMtu);
+    if (addr.ss_family == AF_INET6)
+    {
+        if (::getsockopt (m_socket, IPPROTO_IPV6, IPV6_MTU, &pathMtu, &optLen) || pathMtu < 1280)
+            pathMtu = 1280;
+        m_maxSegment = (size_t)pathMtu - 40 - 8;
+    }
+    else
+    {
+        if (::getsockopt (m_socket, IPPROTO_IP, IP_MTU, &pathMtu, &optLen) || pathMtu < 576)
+            pathMtu = 576;
+        m_maxSegment = (size_t)pathMtu - 20 - 8;
+    }
+
+#if HAVE_UDP_GSO
+    const int noSegmentation = 0;
+    m_gso = !::setsockopt (m_socket, SOL_UDP, UDP_SEGMENT, &noSegmentation, sizeof (noSegmentation));
+#endif
+#if HAVE_UDP_GRO
+    const int enable = 1;
+    m_gro = !::setsockopt (m_socket, SOL_UDP, UDP_GRO, &enable, sizeof (enable));
+#endif
+    Console::PrintDebug ("UDP GSO %s (max. segment %zu), GRO %s\n", m_gso ? "on" : "off", m_maxSegment,
+        m_gro ? "on" : "off");
+
+    m_rxBuffer.reset (new uint8_t[RX_MSG_COUNT * RX_MSG_SIZE]);
+    m_rxMsgs.resize (RX_MSG_COUNT);
+    m_rxIov.resize (RX_MSG_COUNT);
+    m_rxControl.resize (RX_MSG_COUNT);
+    for (size_t n = 0; n < RX_MSG_COUNT; n++)
+    {
+        m_rxIov[n].iov_base = m_rxBuffer.get () + n * RX_MSG_SIZE;
+        m_rxIov[n].iov_len  = RX_MSG_SIZE;
+        std::memset (&m_rxMsgs[n], 0, sizeof (m_rxMsgs[n]));
+        m_rxMsgs[n].msg_hdr.msg_iov    = &m_rxIov[n];
+        m_rxMsgs[n].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+void UdpSocket::sendHello () const
+{
+    uint8_t buf[sizeof (TunnelHeader) + sizeof (Hello)];
+    TunnelHeader::build (buf, Type::HELLO, sizeof (Hello));
+    ((Hello*)(buf + sizeof (TunnelHeader)))->set (m_group, 0, 1);
+
+    // a lost HELLO is repeated by the client
+    if (::send (m_socket, buf, sizeof (buf), 0) < 0 && errno != ECONNREFUSED)
+        throw SocketException ();
+}
+
+bool UdpSocket::waitHello (int timeout)
+{
+    auto deadline = std::chrono::steady_clock::now () + std::chrono::microseconds (timeout);
+
+    while (1)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds> (
+            deadline - std::chrono::steady_clock::now ()).count ();
+        if (remaining <= 0 || !m_event.waitRecv (m_socket, (int)remaining))
+            return false;
+
+        uint8_t buf[sizeof (TunnelHeader) + sizeof (Hello)];
+        auto ret = ::recv (m_socket, buf, sizeof (buf), MSG_DONTWAIT | MSG_TRUNC);
+        // ECONNREFUSED: the server is not running (yet)
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+            throw SocketException ();
+
+        const TunnelHeader* h = (const TunnelHeader*)buf;
+        const Hello* hello = (const Hello*)(buf + sizeof (TunnelHeader));
+        if (ret == sizeof (buf) && h->getType () == Type::HELLO && h->getLength () == sizeof (Hello)
+            && hello->getGroup () == m_group)
+            return true;
+    }
+}
+
+void UdpSocket::sendBatch (const Frame* packets, size_t count)
+{
+    if (m_txMsgs.size () < count)
+    {
+        m_txMsgs.resize (count);
+        m_txIov.resize (count);
+        m_txControl.resize (count);
+    }
+
+    while (count)
+    {
+        size_t sent = sendMsgs (packets, count);
+        if (!sent)
+        {
+            // e.g. the outgoing device has no checksum offloading
+            Console::PrintDebug ("UDP GSO not supported, disabled\n");
+            m_gso = false;
+            continue;
+        }
+        packets += sent;
+        count   -= sent;
+    }
+}
+
+size_t UdpSocket::sendMsgs (const Frame* packets, size_t count)
+{
+    // Consecutive packets of the same size become the segments of one message,
+    // only the last segment may be shorter. All messages are sent with one system call.
+    size_t msgCount = 0;
+    for (size_t n = 0; n < count; )
+    {
+        const size_t segment = packets[n].len;
+        size_t segments = 1;
+        size_t bytes = segment;
+        if (m_gso && segment <= m_maxSegment)
+        {
+            while (n + segments < count && segments < MAX_SEGMENTS
+                && packets[n + segments].len <= segment && bytes + packets[n + segments].len <= MAX_GSO_BYTES)
+            {
+                bytes += packets[n + segments].len;
+                if (packets[n + segments++].len < segment)
+                    break;
+            }
+        }
+
+        struct msghdr& msg = m_txMsgs[msgCount].msg_hdr;
+        std::memset (&msg, 0, sizeof (msg));
+        msg.msg_iov    = &m_txIov[n];
+        msg.msg_iovlen = segments;
+        for (size_t i = 0; i < segments; i++)
+        {
+            m_txIov[n + i].iov_base = packets[n + i].data;
+            m_txIov[n + i].iov_len  = packets[n + i].len;
+        }
+#if HAVE_UDP_GSO
+        if (segments > 1)
+        {
+            msg.msg_control    = m_txControl[msgCount].buf;
+            msg.msg_controllen = sizeof (m_txControl[msgCount].buf);
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR (&msg);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type  = UDP_SEGMENT;
+            cmsg->cmsg_len   = CMSG_LEN (sizeof (uint16_t));
+            *(uint16_t*)CMSG_DATA (cmsg) = (uint16_t)segment;
+        }
+#endif
+        msgCount++;
+        n += segments;
+    }
+
+    size_t packetsSent = 0;
+    for (size_t n = 0; n < msgCount; )
+    {
+        int ret = ::sendmmsg (m_socket, &m_txMsgs[n], (unsigned)(msgCount - n), 0);
+        if (ret < 0)
+        {
+            if (errno == EIO && m_gso)
+                return packetsSent;
+            if (errno == ECONNREFUSED)
+                throw SocketException ("Connection refused by peer");
+            throw SocketException ();
+        }
+        for (int i = 0; i < ret; i++)
+            packetsSent += m_txMsgs[n + i].msg_hdr.msg_iovlen;
+        n += (size_t)ret;
+    }
+    return packetsSent;
+}
+
+size_t UdpSocket::recvBatch (Frame* frames, size_t count)
+{
+    // the frames returned by the last call are not used anymore
+    if (m_rxNext == m_rxFrames.size ())
+    {
+        m_rxFrames.clear ();
+        m_rxNext = 0;
+        while (m_rxFrames.empty ())
+            recvMsgs ();
+    }
+
+    size_t n = 0;
+    for (; n < count && m_rxNext < m_rxFrames.size (); n++)
+        frames[n] = m_rxFrames[m_rxNext++];
+    return n;
+}
+
+void UdpSocket::recvMsgs ()
+{
+    m_event.waitRecv (m_socket);
+
+    for (size_t n = 0; n < RX_MSG_COUNT; n++)
+    {
+        m_rxMsgs[n].msg_hdr.msg_control    = m_rxControl[n].buf;
+        m_rxMsgs[n].msg_hdr.msg_controllen = sizeof (m_rxControl[n].buf);
+        m_rxMsgs[n].msg_hdr.msg_flags      = 0;
+    }
+
+    int ret = ::recvmmsg (m_socket, m_rxMsgs.data (), RX_MSG_COUNT, MSG_DONTWAIT, nullptr);
+    if (ret < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        if (errno == ECONNREFUSED)
+            throw SocketException ("Connection refused by peer");
+        throw SocketException ();
+    }
+
+    for (int n = 0; n < ret; n++)
+    {
+        const struct msghdr& msg = m_rxMsgs[n].msg_hdr;
+        const size_t len = m_rxMsgs[n].msg_len;
+        if (msg.msg_flags & MSG_TRUNC)
+            continue;
+
+        // a GRO super packet consists of segments of equal size, only the last one may be shorter
+        size_t segment = len;
+#if HAVE_UDP_GRO
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR ((struct msghdr*)&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                segment = (size_t)*(int*)CMSG_DATA (cmsg);
+        }
+#endif
+        if (!segment)
+            continue;
+
+        uint8_t* data = (uint8_t*)m_rxIov[n].iov_base;
+        for (size_t offset = 0; offset < len; offset += segment)
+            parseDatagram (data + offset, std::min (segment, len - offset));
+    }
+}
+
+void UdpSocket::parseDatagram (uint8_t* data, size_t len)
+{
+    if (len < sizeof (TunnelHeader))
+        return;
+
+    const TunnelHeader* h = (const TunnelHeader*)data;
+    if (h->getLength () != len - sizeof (TunnelHeader))
+        return;
+
+    if (h->isPacket ())
+    {
+        if (h->getLength () && h->getLength () <= m_config.mtu)
+            m_rxFrames.push_back (Frame {(uint8_t*)h->payload (), h->getLength ()});
+    }
+    // the client repeats its HELLO, if our answer got lost
+    else if (h->getType () == Type::HELLO && m_server)
+    {
+        sendHello ();
+    }
+}
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UDPSOCKET_HPP
+#define UDPSOCKET_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <sys/socket.h>
+
+#include "tunnelsocket.hpp"
+#include "socketexception.hpp"
+#include "sockettype.h"
+#include "socketevent.hpp"
+
+struct UdpSocketConfig
+{
+    unsigned mtu;
+    size_t   bufferSize; // SO_SNDBUF and SO_RCVBUF, 0 keeps the system default
+
+    UdpSocketConfig () :
+        mtu (1500),
+        bufferSize (4 * 1024 * 1024)
+    {
+    }
+};
+
+// Datagram transport, each datagram carries exactly one encapsulated frame.
+// Frames of equal size are sent as a single GSO super packet (UDP_SEGMENT), the
+// receive side lets the kernel merge them again (UDP_GRO). Lost frames are not
+// retransmitted, this is left to the tunneled protocols.
+class UdpSocket : public TunnelSocket
+{
+public:
+    UdpSocket (const UdpSocket&) = delete;
+    UdpSocket& operator=(const UdpSocket&) = delete;
+    ~UdpSocket ();
+
+    // client side: send HELLO until the server answers
+    static std::unique_ptr<UdpSocket> connect (const std::string& host, uint16_t remotePort,
+        const UdpSocketConfig& config, bool ipv4 = true, bool ipv6 = true);
+    // server side: wait for the HELLO of a client and connect to it
+    static std::unique_ptr<UdpSocket> accept (uint16_t port, std::string& addr, uint16_t& remotePort,
+        const UdpSocketConfig& config, bool ipv4 = true, bool ipv6 = true);
+
+    void sendBatch (const Frame* packets, size_t count) override;
+    size_t recvBatch (Frame* frames, size_t count) override;
+    void cancel () const override;
+
+    bool hasGso () const
+    {
+        return m_gso;
+    }
+    bool hasGro () const
+    {
+        return m_gro;
+    }
+
+private:
+    UdpSocket (SOCKET s, const UdpSocketConfig& config, bool server);
+    void setup ();
+    // returns the number of sent packets, 0 if GSO is not usable
+    size_t sendMsgs (const Frame* packets, size_t count);
+    void recvMsgs ();
+    void parseDatagram (uint8_t* data, size_t len);
+    void sendHello () const;
+    bool waitHello (int timeout);
+
+    SOCKET m_socket;
+    SocketEvent m_event;
+    UdpSocketConfig m_config;
+    bool m_server;
+    uint32_t m_group;
+    bool m_gso;
+    bool m_gro;
+    size_t m_maxSegment; // largest datagram which is not fragmented
+
+    // send path, used by the receiver thread only
+    union TxControl
+    {
+        char buf[CMSG_SPACE (sizeof (uint16_t))];
+        struct cmsghdr align;
+    };
+    std::vector<struct mmsghdr> m_txMsgs;
+    std::vector<struct iovec> m_txIov;
+    std::vector<TxControl> m_txControl;
+
+    // receive path, used by the sender thread only
+    union RxControl
+    {
+        char buf[CMSG_SPACE (sizeof (int))];
+        struct cmsghdr align;
+    };
+    std::unique_ptr<uint8_t[]> m_rxBuffer;
+    std::vector<struct mmsghdr> m_rxMsgs;
+    std::vector<struct iovec> m_rxIov;
+    std::vector<RxControl> m_rxControl;
+    std::vector<Frame> m_rxFrames; // received but not yet returned frames
+    size_t m_rxNext;
+};
+
+#endif
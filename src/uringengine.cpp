@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "uringengine.hpp"
+#include "rawsocket.hpp"
+#include "streamgroup.hpp"
+#include "tunnel.hpp"
+#include "console.hpp"
+
+// submission queue size, pending entries are submitted earlier if it is full
+static const unsigned RING_ENTRIES = 256;
+// max. number of frames sent to the raw socket per stream and round, limits the completions in flight
+static const unsigned RAW_SEND_BATCH = 64;
+// max. number of frames per sendmsg on a stream
+static const size_t STREAM_SEND_BATCH = 256;
+
+static const uint16_t FRAME_GROUP = 0;
+static const uint16_t CHUNK_GROUP = 1;
+
+
+UringEngine::UringEngine (const UringEngineConfig& config)
+: m_config (config), m_rawSocket (-1), m_group (nullptr), m_frameStride (0), m_rawRecvArmed (false),
+  m_framesExhausted (false), m_chunksExhausted (false)
+{
+}
+
+UringEngine::~UringEngine ()
+{
+}
+
+std::unique_ptr<UringEngine> UringEngine::create (const UringEngineConfig& config, const RawSocket& l2Socket,
+    const StreamGroup& streams)
+{
+    std::unique_ptr<UringEngine> e (new UringEngine (config));
+    e->m_rawSocket = l2Socket.handle ();
+    e->m_group     = &streams;
+
+    try
+    {
+        e->m_ring      = IoUring::create (RING_ENTRIES);
+        e->m_frameRing = UringBufferRing::create (*e->m_ring, FRAME_GROUP, config.frameCount);
+        e->m_chunkRing = UringBufferRing::create (*e->m_ring, CHUNK_GROUP, CHUNK_COUNT);
+    }
+    catch (const SocketException& ex)
+    {
+        Console::PrintVerbose ("io_uring not available: %s\n", ex.what ());
+        return nullptr;
+    }
+
+    // one extra byte to detect frames exceeding the MTU
+    e->m_frameStride = (sizeof (TunnelHeader) + config.mtu + 1 + 63) & ~(size_t)63;
+    e->m_frames.reset (new uint8_t[e->m_frameStride * config.frameCount]);
+    e->m_frameLen.resize (config.frameCount);
+    for (unsigned n = 0; n < config.frameCount; n++)
+        e->recycleFrame ((uint16_t)n);
+    e->m_frameRing->commit ();
+
+    e->m_chunks.reset (new uint8_t[CHUNK_SIZE * CHUNK_COUNT]);
+    for (unsigned n = 0; n < CHUNK_COUNT; n++)
+        e->recycleChunk ((uint16_t)n);
+    e->m_chunkRing->commit ();
+
+    e->m_streams.resize (streams.size ());
+    for (size_t n = 0; n < streams.size (); n++)
+    {
+        Stream& s   = e->m_streams[n];
+        s.socket    = streams[n].handle ();
+        s.deframer.reset (new Deframer (config.bufferSize, config.mtu));
+        s.sending   = 0;
+        s.recvArmed = false;
+        s.iov.resize (STREAM_SEND_BATCH);
+        s.iovFirst  = 0;
+        std::memset (&s.msg, 0, sizeof (s.msg));
+    }
+
+    return e;
+}
+
+void UringEngine::run ()
+{
+    Console::PrintDebug ("io_uring engine started\n");
+
+    try
+    {
+        while (1)
+        {
+            // multishot receives end if no buffer was available,
+            // they are restarted as soon as buffers were returned
+            if (!m_rawRecvArmed && !m_framesExhausted)
+                armRawRecv ();
+            for (size_t n = 0; n < m_streams.size (); n++)
+            {
+                if (!m_streams[n].recvArmed && !m_chunksExhausted)
+                    armStreamRecv (n);
+            }
+            m_frameRing->commit ();
+            m_chunkRing->commit ();
+
+            m_ring->submit (1);
+
+            const struct io_uring_cqe* cqe;
+            while ((cqe = m_ring->peek ()) != nullptr)
+            {
+                const Op op = (Op)(cqe->user_data >> 32);
+                const size_t index = (size_t)(cqe->user_data & 0xffffffff);
+                switch (op)
+                {
+                case RAW_RECV:
+                    onRawRecv (cqe);
+                    break;
+                case RAW_SEND:
+                    onRawSend (index, cqe->res);
+                    break;
+                case TCP_RECV:
+                    onStreamRecv (index, cqe);
+                    break;
+                case TCP_SEND:
+                    onStreamSend (index, cqe->res);
+                    break;
+                }
+                m_ring->advance ();
+            }
+
+            // all frames captured in this round leave with one sendmsg per stream
+            for (size_t n = 0; n < m_streams.size (); n++)
+            {
+                if (m_streams[n].inFlight.empty ())
+                    startStreamSend (n);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        Console::PrintError ("%s\n", e.what());
+    }
+
+    Console::PrintDebug ("io_uring engine terminated\n");
+}
+
+void UringEngine::armRawRecv ()
+{
+    struct io_uring_sqe* sqe = m_ring->sqe ();
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = m_rawSocket;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = m_frameRing->group ();
+    sqe->user_data = userData (RAW_RECV, 0);
+    m_rawRecvArmed = true;
+}
+
+void UringEngine::armStreamRecv (size_t stream)
+{
+    struct io_uring_sqe* sqe = m_ring->sqe ();
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = m_streams[stream].socket;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = m_chunkRing->group ();
+    sqe->user_data = userData (TCP_RECV, (uint32_t)stream);
+    m_streams[stream].recvArmed = true;
+}
+
+void UringEngine::onRawRecv (const struct io_uring_cqe* cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        m_rawRecvArmed = false;
+
+    if (cqe->res < 0)
+    {
+        if (cqe->res == -ENOBUFS)
+        {
+            m_framesExhausted = true;
+            return;
+        }
+        errno = -cqe->res;
+        throw SocketException ();
+    }
+
+    BUG_ON (!(cqe->flags & IORING_CQE_F_BUFFER));
+    const uint16_t id = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    const uint32_t len = (uint32_t)cqe->res;
+
+    // the peer would reject it anyway
+    if (!len || len > m_config.mtu)
+    {
+        recycleFrame (id);
+        return;
+    }
+
+    // the frame was received behind the room for the tunnel header
+    uint8_t* slot = frameSlot (id);
+    TunnelHeader::packet (slot, len);
+    m_frameLen[id] = len;
+
+    // all frames of a flow take the same stream to keep their order
+    m_streams[m_group->select (slot + sizeof (TunnelHeader), len)].queued.push_back (id);
+}
+
+void UringEngine::startStreamSend (size_t stream)
+{
+    Stream& s = m_streams[stream];
+    if (s.queued.empty ())
+        return;
+
+    const size_t count = std::min (s.queued.size (), STREAM_SEND_BATCH);
+    s.inFlight.assign (s.queued.begin (), s.queued.begin () + (long)count);
+    s.queued.erase (s.queued.begin (), s.queued.begin () + (long)count);
+
+    for (size_t n = 0; n < count; n++)
+    {
+        s.iov[n].iov_base = frameSlot (s.inFlight[n]);
+        s.iov[n].iov_len  = sizeof (TunnelHeader) + m_frameLen[s.inFlight[n]];
+    }
+    s.iovFirst = 0;
+    submitStreamSend (stream);
+}
+
+void UringEngine::submitStreamSend (size_t stream)
+{
+    Stream& s = m_streams[stream];
+    s.msg.msg_iov    = &s.iov[s.iovFirst];
+    s.msg.msg_iovlen = s.inFlight.size () - s.iovFirst;
+
+    struct io_uring_sqe* sqe = m_ring->sqe ();
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = s.socket;
+    sqe->addr      = (uint64_t)(uintptr_t)&s.msg;
+    sqe->len       = 1;
+    sqe->msg_flags = MSG_WAITALL;
+    sqe->user_data = userData (TCP_SEND, (uint32_t)stream);
+}
+
+void UringEngine::onStreamSend (size_t stream, int res)
+{
+    if (res < 0)
+    {
+        errno = -res;
+        throw SocketException ();
+    }
+
+    // continue a partial send behind the last transmitted byte
+    Stream& s = m_streams[stream];
+    size_t sent = (size_t)res;
+    while (s.iovFirst < s.inFlight.size () && sent >= s.iov[s.iovFirst].iov_len)
+        sent -= s.iov[s.iovFirst++].iov_len;
+
+    if (s.iovFirst < s.inFlight.size ())
+    {
+        s.iov[s.iovFirst].iov_base = (uint8_t*)s.iov[s.iovFirst].iov_base + sent;
+        s.iov[s.iovFirst].iov_len -= sent;
+        submitStreamSend (stream);
+        return;
+    }
+
+    for (uint16_t id : s.inFlight)
+        recycleFrame (id);
+    s.inFlight.clear ();
+    startStreamSend (stream);
+}
+
+void UringEngine::onStreamRecv (size_t stream, const struct io_uring_cqe* cqe)
+{
+    Stream& s = m_streams[stream];
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        s.recvArmed = false;
+
+    if (cqe->res == 0)
+        throw SocketException ("Connection closed by peer");
+    if (cqe->res < 0)
+    {
+        if (cqe->res == -ENOBUFS)
+        {
+            m_chunksExhausted = true;
+            return;
+        }
+        errno = -cqe->res;
+        throw SocketException ();
+    }
+
+    BUG_ON (!(cqe->flags & IORING_CQE_F_BUFFER));
+    s.chunks.push_back (Chunk {(uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT), 0, (size_t)cqe->res});
+    drainStream (stream);
+}
+
+void UringEngine::onRawSend (size_t stream, int res)
+{
+    // like a full transmit queue of the interface, the frame is lost
+    if (res < 0 && res != -ENOBUFS && res != -EAGAIN)
+    {
+        errno = -res;
+        throw SocketException ();
+    }
+
+    Stream& s = m_streams[stream];
+    BUG_ON (!s.sending);
+    if (!--s.sending)
+        drainStream (stream);
+}
+
+void UringEngine::drainStream (size_t stream)
+{
+    Stream& s = m_streams[stream];
+    Deframer& deframer = *s.deframer;
+
+    // the deframer memory is referenced until all raw socket sends completed
+    while (!s.sending)
+    {
+        deframer.release ();
+
+        while (!s.chunks.empty () && deframer.writable ())
+        {
+            Chunk& c = s.chunks.front ();
+            const size_t len = std::min (c.len - c.offset, deframer.writable ());
+            std::memcpy (deframer.writePtr (), chunk (c.id) + c.offset, len);
+            deframer.commit (len);
+            c.offset += len;
+            if (c.offset == c.len)
+            {
+                recycleChunk (c.id);
+                s.chunks.pop_front ();
+            }
+        }
+
+        const TunnelHeader* pHeader;
+        while (s.sending < RAW_SEND_BATCH && (pHeader = deframer.next ()) != nullptr)
+        {
+            if (!pHeader->isPacket() || !pHeader->getLength())
+                continue;
+
+            struct io_uring_sqe* sqe = m_ring->sqe ();
+            sqe->opcode    = IORING_OP_SEND;
+            sqe->fd        = m_rawSocket;
+            sqe->addr      = (uint64_t)(uintptr_t)pHeader->payload ();
+            sqe->len       = pHeader->getLength ();
+            sqe->user_data = userData (RAW_SEND, (uint32_t)stream);
+            s.sending++;
+        }
+
+        if (!s.sending && s.chunks.empty ())
+            break;
+    }
+}
+
+void UringEngine::recycleFrame (uint16_t id)
+{
+    // the frame is received behind the room for the tunnel header
+    m_frameRing->add (frameSlot (id) + sizeof (TunnelHeader), m_config.mtu + 1, id);
+    m_framesExhausted = false;
+}
+
+void UringEngine::recycleChunk (uint16_t id)
+{
+    m_chunkRing->add (chunk (id), CHUNK_SIZE, id);
+    m_chunksExhausted = false;
+}
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URINGENGINE_HPP
+#define URINGENGINE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "iouring.hpp"
+#include "deframer.hpp"
+
+class RawSocket;
+class StreamGroup;
+
+struct UringEngineConfig
+{
+    unsigned mtu;
+    size_t   bufferSize; // size of the tunnel receive buffer of each stream
+    unsigned frameCount; // number of receive buffers for captured frames, power of two
+
+    UringEngineConfig () :
+        mtu (1500),
+        bufferSize (4 * 1024 * 1024),
+        frameCount (1024)
+    {
+    }
+};
+
+// Single threaded data plane, replaces the Receiver and Sender threads.
+// The raw socket and all tunnel streams are driven by one io_uring:
+// - captured frames are received by a multishot recv into provided buffers,
+//   which have room for the tunnel header in front
+// - the frames queued for a stream are sent with one sendmsg
+// - each stream is received by a multishot recv, the data is deframed and the
+//   frames are sent to the raw socket, all send requests of a round are
+//   submitted with a single system call
+class UringEngine
+{
+public:
+    UringEngine (const UringEngine&) = delete;
+    UringEngine& operator=(const UringEngine&) = delete;
+    ~UringEngine ();
+
+    // returns nullptr if the kernel lacks the required io_uring features
+    static std::unique_ptr<UringEngine> create (const UringEngineConfig& config, const RawSocket& l2Socket,
+        const StreamGroup& streams);
+
+    // returns when a socket fails or the peer closes the connection
+    void run ();
+
+private:
+    enum Op : uint32_t {RAW_RECV, RAW_SEND, TCP_RECV, TCP_SEND};
+
+    struct Chunk
+    {
+        uint16_t id;
+        size_t   offset;
+        size_t   len;
+    };
+
+    struct Stream
+    {
+        int socket;
+
+        // tunnel -> raw socket
+        std::unique_ptr<Deframer> deframer;
+        std::deque<Chunk> chunks;   // received data not yet copied into the deframer
+        unsigned sending;           // raw socket sends in flight
+        bool     recvArmed;
+
+        // raw socket -> tunnel
+        std::vector<uint16_t> queued;   // captured frames waiting for the next sendmsg
+        std::vector<uint16_t> inFlight; // frames of the current sendmsg
+        std::vector<struct iovec> iov;
+        size_t   iovFirst;              // first iovec not completely sent
+        struct msghdr msg;
+    };
+
+    UringEngine (const UringEngineConfig& config);
+
+    static uint64_t userData (Op op, uint32_t index)
+    {
+        return ((uint64_t)op << 32) | index;
+    }
+
+    void armRawRecv ();
+    void armStreamRecv (size_t stream);
+    void onRawRecv (const struct io_uring_cqe* cqe);
+    void onRawSend (size_t stream, int res);
+    void onStreamRecv (size_t stream, const struct io_uring_cqe* cqe);
+    void onStreamSend (size_t stream, int res);
+    void startStreamSend (size_t stream);
+    void submitStreamSend (size_t stream);
+    void drainStream (size_t stream);
+    void recycleFrame (uint16_t id);
+    void recycleChunk (uint16_t id);
+
+    uint8_t* frameSlot (uint16_t id) const
+    {
+        return m_frames.get () + (size_t)id * m_frameStride;
+    }
+    uint8_t* chunk (uint16_t id) const
+    {
+        return m_chunks.get () + (size_t)id * CHUNK_SIZE;
+    }
+
+    static const size_t CHUNK_SIZE  = 64 * 1024;
+    static const unsigned CHUNK_COUNT = 64;
+
+    UringEngineConfig m_config;
+    std::unique_ptr<IoUring> m_ring;
+    int m_rawSocket;
+    const StreamGroup* m_group;
+
+    // captured frames, the tunnel header is built in front of each
+    std::unique_ptr<UringBufferRing> m_frameRing;
+    std::unique_ptr<uint8_t[]> m_frames;
+    size_t m_frameStride;
+    std::vector<uint32_t> m_frameLen;
+    bool m_rawRecvArmed;
+    bool m_framesExhausted;
+
+    // data received from the streams
+    std::unique_ptr<UringBufferRing> m_chunkRing;
+    std::unique_ptr<uint8_t[]> m_chunks;
+    bool m_chunksExhausted;
+
+    std::vector<Stream> m_streams;
+};
+
+#endif
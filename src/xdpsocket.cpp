@@ -0,0 +1,383 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+
+#include <cstring>
+#include <cerrno>
+#include <cstddef>
+
+#include "xdpsocket.hpp"
+#include "bug.hpp"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+// one UMEM frame per page
+static const unsigned UMEM_FRAME_SIZE = 4096;
+
+static int bpf (int cmd, union bpf_attr* attr)
+{
+    return (int)syscall (__NR_bpf, cmd, attr, sizeof (*attr));
+}
+
+static inline uint32_t ringAvailable (const uint32_t* producer, uint32_t consumer)
+{
+    return __atomic_load_n (producer, __ATOMIC_ACQUIRE) - consumer;
+}
+
+static inline uint32_t ringFree (uint32_t producer, const uint32_t* consumer, uint32_t size)
+{
+    return size - (producer - __atomic_load_n (consumer, __ATOMIC_ACQUIRE));
+}
+
+
+XdpSocket::XdpSocket () :
+    m_socket (INVALID_SOCKET),
+    m_zeroCopy (false),
+    m_umem (nullptr),
+    m_umemSize (0),
+    m_frameSize (UMEM_FRAME_SIZE),
+    m_headroom (0),
+    m_mtu (0),
+    m_rx (),
+    m_tx (),
+    m_fill (),
+    m_completion (),
+    m_mapFd (-1),
+    m_progFd (-1),
+    m_linkFd (-1)
+{
+}
+
+XdpSocket::~XdpSocket ()
+{
+    // closing the link detaches the XDP program from the interface
+    if (m_linkFd >= 0)
+        ::close (m_linkFd);
+    if (m_progFd >= 0)
+        ::close (m_progFd);
+    if (m_mapFd >= 0)
+        ::close (m_mapFd);
+
+    for (Ring* r : {&m_rx, &m_tx, &m_fill, &m_completion})
+    {
+        if (r->map)
+            ::munmap (r->map, r->mapSize);
+    }
+    if (m_socket != INVALID_SOCKET)
+        ::close (m_socket);
+    if (m_umem)
+        ::munmap (m_umem, m_umemSize);
+}
+
+std::unique_ptr<XdpSocket> XdpSocket::open (const std::string& interface, const XdpSocketConfig& config)
+{
+    int ifIndex = if_nametoindex (interface.c_str ());
+    if (!ifIndex)
+        throw SocketException();
+
+    // AF_XDP doesn't support frames spanning multiple UMEM frames
+    if (XDP_PACKET_HEADROOM + config.headroom + config.mtu > UMEM_FRAME_SIZE)
+        throw SocketException ("MTU too large for AF_XDP");
+
+    std::unique_ptr<XdpSocket> s (new XdpSocket ());
+    s->m_headroom = config.headroom;
+    s->m_mtu      = config.mtu;
+
+    s->m_socket = socket (AF_XDP, SOCK_RAW, 0);
+    if (s->m_socket == INVALID_SOCKET)
+        throw SocketException();
+
+    s->setupUmem (config);
+
+    struct sockaddr_xdp sxdp;
+    std::memset (&sxdp, 0, sizeof (sxdp));
+    sxdp.sxdp_family   = AF_XDP;
+    sxdp.sxdp_ifindex  = ifIndex;
+    sxdp.sxdp_queue_id = config.queue;
+
+    // prefer zero copy, copy mode works with every driver (e.g. veth)
+    int ret = -1;
+    if (!config.copyMode)
+    {
+        sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+        ret = ::bind (s->m_socket, (struct sockaddr*)&sxdp, sizeof (sxdp));
+        s->m_zeroCopy = !ret;
+    }
+    if (ret)
+    {
+        sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (::bind (s->m_socket, (struct sockaddr*)&sxdp, sizeof (sxdp)))
+            throw SocketException ();
+    }
+
+    s->loadProgram (ifIndex, config.queue);
+
+    return s;
+}
+
+void XdpSocket::setupUmem (const XdpSocketConfig& config)
+{
+    const unsigned frames = config.frameCount;
+    const unsigned half   = frames / 2;
+
+    // the kernel requires power of two ring sizes
+    if (frames < 2 || (half & (half - 1)))
+        throw SocketException ("AF_XDP frame count must be a power of two");
+
+    m_umemSize = (size_t)frames * m_frameSize;
+    void* umem = ::mmap (nullptr, m_umemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED)
+        throw SocketException ();
+    m_umem = (uint8_t*)umem;
+
+    struct xdp_umem_reg reg;
+    std::memset (&reg, 0, sizeof (reg));
+    reg.addr       = (uint64_t)m_umem;
+    reg.len        = m_umemSize;
+    reg.chunk_size = m_frameSize;
+    reg.headroom   = (uint32_t)config.headroom;
+    if (::setsockopt (m_socket, SOL_XDP, XDP_UMEM_REG, &reg, sizeof (reg)))
+        throw SocketException ();
+
+    // the first half of the frames is used for receiving, the second half for sending
+    for (int opt : {XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING})
+    {
+        if (::setsockopt (m_socket, SOL_XDP, opt, &half, sizeof (half)))
+            throw SocketException ();
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof (off);
+    if (::getsockopt (m_socket, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen))
+        throw SocketException ();
+
+    mapRing (m_rx,         half, sizeof (struct xdp_desc), XDP_PGOFF_RX_RING,              off.rx);
+    mapRing (m_tx,         half, sizeof (struct xdp_desc), XDP_PGOFF_TX_RING,              off.tx);
+    mapRing (m_fill,       half, sizeof (uint64_t),        XDP_UMEM_PGOFF_FILL_RING,       off.fr);
+    mapRing (m_completion, half, sizeof (uint64_t),        XDP_UMEM_PGOFF_COMPLETION_RING, off.cr);
+
+    // pass all receive frames to the kernel
+    auto* fill = (uint64_t*)m_fill.desc;
+    for (unsigned n = 0; n < half; n++)
+        fill[n] = (uint64_t)n * m_frameSize;
+    __atomic_store_n (m_fill.producer, half, __ATOMIC_RELEASE);
+
+    m_txFree.reserve (half);
+    for (unsigned n = half; n < frames; n++)
+        m_txFree.push_back ((uint64_t)n * m_frameSize);
+    m_rxHeld.reserve (half);
+}
+
+void XdpSocket::mapRing (Ring& ring, unsigned size, size_t descSize, uint64_t offset,
+    const struct xdp_ring_offset& off)
+{
+    ring.mapSize = off.desc + size * descSize;
+    void* map = ::mmap (nullptr, ring.mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_socket, (off_t)offset);
+    if (map == MAP_FAILED)
+        throw SocketException ();
+
+    ring.map      = map;
+    ring.producer = (uint32_t*)((uint8_t*)map + off.producer);
+    ring.consumer = (uint32_t*)((uint8_t*)map + off.consumer);
+    ring.flags    = (uint32_t*)((uint8_t*)map + off.flags);
+    ring.desc     = (uint8_t*)map + off.desc;
+    ring.mask     = size - 1;
+}
+
+void XdpSocket::loadProgram (int ifIndex, unsigned queue)
+{
+    union bpf_attr attr;
+
+    // map queue index -> AF_XDP socket
+    std::memset (&attr, 0, sizeof (attr));
+    attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size    = sizeof (uint32_t);
+    attr.value_size  = sizeof (uint32_t);
+    attr.max_entries = queue + 1;
+    m_mapFd = bpf (BPF_MAP_CREATE, &attr);
+    if (m_mapFd < 0)
+        throw SocketException ();
+
+    // return bpf_redirect_map (&xsks, ctx->rx_queue_index, XDP_PASS);
+    const struct bpf_insn prog[] = {
+        // r2 = ctx->rx_queue_index
+        { BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof (struct xdp_md, rx_queue_index), 0 },
+        // r1 = xsks
+        { BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, m_mapFd },
+        { 0, 0, 0, 0, 0 },
+        // r3 = XDP_PASS, the action if there is no socket for the queue
+        { BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS },
+        { BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+        { BPF_JMP | BPF_EXIT, 0, 0, 0, 0 },
+    };
+    static const char license[] = "GPL";
+
+    std::memset (&attr, 0, sizeof (attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns     = (uint64_t)prog;
+    attr.insn_cnt  = sizeof (prog) / sizeof (prog[0]);
+    attr.license   = (uint64_t)license;
+    m_progFd = bpf (BPF_PROG_LOAD, &attr);
+    if (m_progFd < 0)
+        throw SocketException ();
+
+    std::memset (&attr, 0, sizeof (attr));
+    const uint32_t key = queue;
+    const uint32_t value = (uint32_t)m_socket;
+    attr.map_fd = m_mapFd;
+    attr.key    = (uint64_t)&key;
+    attr.value  = (uint64_t)&value;
+    if (bpf (BPF_MAP_UPDATE_ELEM, &attr))
+        throw SocketException ();
+
+    // try native mode first, fall back to generic mode if the driver doesn't support XDP
+    for (uint32_t flags : {0u, (uint32_t)XDP_FLAGS_SKB_MODE})
+    {
+        std::memset (&attr, 0, sizeof (attr));
+        attr.link_create.prog_fd        = m_progFd;
+        attr.link_create.target_ifindex = ifIndex;
+        attr.link_create.attach_type    = BPF_XDP;
+        attr.link_create.flags          = flags;
+        m_linkFd = bpf (BPF_LINK_CREATE, &attr);
+        if (m_linkFd >= 0)
+            return;
+    }
+    throw SocketException ();
+}
+
+void XdpSocket::cancel () const
+{
+    m_event.cancel ();
+}
+
+size_t XdpSocket::recvBatch (Frame* frames, size_t count, int timeout)
+{
+    BUG_ON (!count);
+
+    // frames of the last call are not used anymore, give them back to the kernel
+    // (the fill ring is large enough for all receive frames)
+    if (!m_rxHeld.empty ())
+    {
+        uint32_t prod = *m_fill.producer;
+        BUG_ON (ringFree (prod, m_fill.consumer, m_fill.mask + 1) < m_rxHeld.size ());
+
+        auto* fill = (uint64_t*)m_fill.desc;
+        for (uint64_t addr : m_rxHeld)
+            fill[prod++ & m_fill.mask] = addr;
+        __atomic_store_n (m_fill.producer, prod, __ATOMIC_RELEASE);
+        m_rxHeld.clear ();
+    }
+
+    uint32_t cons = *m_rx.consumer;
+    uint32_t available;
+    while (!(available = ringAvailable (m_rx.producer, cons)))
+    {
+        // poll also wakes up the driver if needed
+        if (!m_event.waitRecv (m_socket, timeout))
+            return 0;
+    }
+
+    size_t n = 0;
+    auto* desc = (struct xdp_desc*)m_rx.desc;
+    for (; n < count && n < available; n++)
+    {
+        const struct xdp_desc& d = desc[cons++ & m_rx.mask];
+        frames[n].data = m_umem + d.addr;
+        frames[n].len  = d.len;
+        // in aligned mode, the kernel accepts any address inside of a frame
+        m_rxHeld.push_back (d.addr - d.addr % m_frameSize);
+    }
+    __atomic_store_n (m_rx.consumer, cons, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+void XdpSocket::sendBatch (const Frame* frames, size_t count)
+{
+    auto* completion = (uint64_t*)m_completion.desc;
+    auto* desc = (struct xdp_desc*)m_tx.desc;
+    uint32_t prod = *m_tx.producer;
+
+    for (size_t n = 0; n < count; n++)
+    {
+        BUG_ON (frames[n].len > m_frameSize);
+
+        // reclaim the frames the kernel has finished sending
+        while (m_txFree.empty ())
+        {
+            uint32_t cons = *m_completion.consumer;
+            uint32_t done = ringAvailable (m_completion.producer, cons);
+            if (!done)
+            {
+                __atomic_store_n (m_tx.producer, prod, __ATOMIC_RELEASE);
+                kickTx ();
+                if (!ringAvailable (m_completion.producer, cons))
+                    m_event.waitSend (m_socket);
+                continue;
+            }
+            while (done--)
+                m_txFree.push_back (completion[cons++ & m_completion.mask]);
+            __atomic_store_n (m_completion.consumer, cons, __ATOMIC_RELEASE);
+        }
+
+        // the tx ring has as many entries as there are transmit frames, so it can't overflow
+        uint64_t addr = m_txFree.back ();
+        m_txFree.pop_back ();
+        std::memcpy (m_umem + addr, frames[n].data, frames[n].len);
+        desc[prod & m_tx.mask].addr    = addr;
+        desc[prod & m_tx.mask].len     = (uint32_t)frames[n].len;
+        desc[prod & m_tx.mask].options = 0;
+        prod++;
+    }
+
+    __atomic_store_n (m_tx.producer, prod, __ATOMIC_RELEASE);
+    kickTx ();
+}
+
+void XdpSocket::kickTx () const
+{
+    // in zero copy mode the driver only needs a kick if it asks for it
+    if (m_zeroCopy && !(__atomic_load_n (m_tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP))
+        return;
+
+    // in copy mode, the kernel processes only a limited number of frames per call
+    // and returns EAGAIN if there are some left
+    while (::sendto (m_socket, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0)
+    {
+        if (errno == EAGAIN)
+        {
+            if (__atomic_load_n (m_tx.consumer, __ATOMIC_ACQUIRE) != *m_tx.producer)
+                continue;
+            break;
+        }
+        if (errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+            throw SocketException ();
+        break;
+    }
+}
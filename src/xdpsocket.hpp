@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XDPSOCKET_HPP
+#define XDPSOCKET_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "socketexception.hpp"
+#include "sockettype.h"
+#include "socketevent.hpp"
+#include "l2socket.hpp"
+
+
+struct XdpSocketConfig
+{
+    unsigned mtu;        // max. length of a frame
+    size_t   headroom;   // free bytes in front of each frame returned by recvBatch
+    unsigned queue;      // rx/tx queue of the interface the socket is bound to
+    unsigned frameCount; // number of UMEM frames, half of them is used for receiving
+    bool     copyMode;   // don't try zero copy mode
+
+    XdpSocketConfig () :
+        mtu (1500),
+        headroom (0),
+        queue (0),
+        frameCount (4096),
+        copyMode (false)
+    {
+    }
+};
+
+struct xdp_ring_offset;
+
+// AF_XDP socket, frames of the bound queue are redirected to it by a small
+// XDP program and don't reach the network stack of the host anymore
+class XdpSocket : public L2Socket
+{
+public:
+    XdpSocket (const XdpSocket&) = delete;
+    XdpSocket& operator=(const XdpSocket&) = delete;
+    XdpSocket& operator=(const XdpSocket&&) = delete;
+    ~XdpSocket ();
+
+    static std::unique_ptr<XdpSocket> open (const std::string& interface, const XdpSocketConfig& config = XdpSocketConfig());
+
+    size_t recvBatch (Frame* frames, size_t count, int timeout = -1) override;
+    void sendBatch (const Frame* frames, size_t count) override;
+    void cancel () const override;
+
+    int handle () const override
+    {
+        return m_socket;
+    }
+
+    bool isZeroCopy () const
+    {
+        return m_zeroCopy;
+    }
+
+private:
+    // single producer/single consumer ring shared with the kernel
+    struct Ring
+    {
+        uint32_t* producer;
+        uint32_t* consumer;
+        uint32_t* flags;
+        void*     desc;
+        uint32_t  mask;
+        void*     map;
+        size_t    mapSize;
+    };
+
+    XdpSocket ();
+
+    void setupUmem (const XdpSocketConfig& config);
+    void mapRing (Ring& ring, unsigned size, size_t descSize, uint64_t offset,
+        const struct xdp_ring_offset& off);
+    void loadProgram (int ifIndex, unsigned queue);
+    void kickTx () const;
+
+    SOCKET m_socket;
+    SocketEvent m_event;
+    bool m_zeroCopy;
+
+    uint8_t* m_umem;
+    size_t   m_umemSize;
+    unsigned m_frameSize;
+    size_t   m_headroom;
+    unsigned m_mtu;
+
+    Ring m_rx;
+    Ring m_tx;
+    Ring m_fill;
+    Ring m_completion;
+
+    // frames handed out by the last recvBatch call, refilled on the next call
+    std::vector<uint64_t> m_rxHeld;
+    // free transmit frames
+    std::vector<uint64_t> m_txFree;
+
+    int m_mapFd;
+    int m_progFd;
+    int m_linkFd;
+};
+
+#endif
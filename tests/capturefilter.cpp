@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "capturefilter.hpp"
+#include "check.hpp"
+
+struct Packet
+{
+    std::vector<uint8_t> data;
+    bool     tagPresent = false; // VLAN tag stripped by the driver
+    uint32_t tag = 0;
+};
+
+// Runs the subset of classic BPF emitted by the compiler like the kernel would,
+// returns the number of bytes passed to the socket. Bad programs fail checks.
+static uint32_t run (const std::vector<struct sock_filter>& program, const Packet& p)
+{
+    uint32_t a = 0;
+    for (size_t pc = 0; pc < program.size (); pc++)
+    {
+        const struct sock_filter& i = program[pc];
+        switch (i.code)
+        {
+        case BPF_LD | BPF_W | BPF_ABS:
+        case BPF_LD | BPF_H | BPF_ABS:
+        case BPF_LD | BPF_B | BPF_ABS:
+        {
+            if (i.k == (uint32_t)(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT))
+            {
+                a = p.tagPresent;
+                break;
+            }
+            if (i.k == (uint32_t)(SKF_AD_OFF + SKF_AD_VLAN_TAG))
+            {
+                a = p.tag;
+                break;
+            }
+            const size_t size = BPF_SIZE (i.code) == BPF_W ? 4 : BPF_SIZE (i.code) == BPF_H ? 2 : 1;
+            // out of bounds loads drop the frame
+            if (i.k + size > p.data.size ())
+                return 0;
+            a = 0;
+            for (size_t n = 0; n < size; n++)
+                a = a << 8 | p.data[i.k + n];
+            break;
+        }
+        case BPF_ALU | BPF_AND | BPF_K:
+            a &= i.k;
+            break;
+        case BPF_JMP | BPF_JEQ | BPF_K:
+        case BPF_JMP | BPF_JSET | BPF_K:
+        {
+            const bool match = BPF_OP (i.code) == BPF_JEQ ? a == i.k : (a & i.k) != 0;
+            pc += match ? i.jt : i.jf;
+            break;
+        }
+        case BPF_RET | BPF_K:
+            return i.k;
+        default:
+            CHECK (!"unexpected instruction");
+            return 0;
+        }
+    }
+    CHECK (!"program without return");
+    return 0;
+}
+
+// all jumps stay inside the program and it ends with a return, like the kernel checks it
+static bool isValid (const std::vector<struct sock_filter>& program)
+{
+    if (program.empty () || program.back ().code != (BPF_RET | BPF_K))
+        return false;
+    for (size_t pc = 0; pc < program.size (); pc++)
+    {
+        if (BPF_CLASS (program[pc].code) == BPF_JMP
+            && (pc + 1 + program[pc].jt >= program.size () || pc + 1 + program[pc].jf >= program.size ()))
+            return false;
+    }
+    return true;
+}
+
+static bool accepts (const std::string& rules, const Packet& p)
+{
+    const std::vector<struct sock_filter> program = CaptureFilter::compile (rules);
+    CHECK (isValid (program));
+    return run (program, p) != 0;
+}
+
+static Packet frame (const char* dst, const char* src, uint16_t type, int vlan = -1)
+{
+    Packet p;
+    p.data.resize (64);
+    unsigned b[6];
+    std::sscanf (dst, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]);
+    for (size_t n = 0; n < 6; n++)
+        p.data[n] = (uint8_t)b[n];
+    std::sscanf (src, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]);
+    for (size_t n = 0; n < 6; n++)
+        p.data[6 + n] = (uint8_t)b[n];
+    size_t off = 12;
+    if (vlan >= 0)
+    {
+        p.data[off++] = 0x81;
+        p.data[off++] = 0x00;
+        p.data[off++] = (uint8_t)(vlan >> 8 | 0x20); // priority 1 must be ignored
+        p.data[off++] = (uint8_t)vlan;
+    }
+    p.data[off++] = (uint8_t)(type >> 8);
+    p.data[off]   = (uint8_t)type;
+    return p;
+}
+
+static const char* HOST  = "02:00:00:00:00:01";
+static const char* PEER  = "02:00:00:00:00:02";
+static const char* BCAST = "ff:ff:ff:ff:ff:ff";
+static const char* STP   = "01:80:c2:00:00:00";
+
+static void testDefaults ()
+{
+    const Packet ip = frame (PEER, HOST, 0x0800);
+    // without rules, or with drop rules only, everything else is captured
+    CHECK (accepts ("", ip));
+    CHECK (accepts ("drop type 0x0806", ip));
+    CHECK (!accepts ("drop type 0x0806", frame (BCAST, HOST, 0x0806)));
+    // with an accept rule, frames matching no rule are dropped
+    CHECK (accepts ("accept type 0x0800", ip));
+    CHECK (!accepts ("accept type 0x0800", frame (BCAST, HOST, 0x0806)));
+}
+
+static void testTerms ()
+{
+    CHECK (accepts ("accept src 02:00:00:00:00:01", frame (PEER, HOST, 0x0800)));
+    CHECK (!accepts ("accept src 02:00:00:00:00:01", frame (HOST, PEER, 0x0800)));
+    // only the last two bytes differ, the second half of the address is compared as well
+    CHECK (!accepts ("accept dst 02:00:00:00:01:02", frame (PEER, HOST, 0x0800)));
+    CHECK (accepts ("accept dst 02:00:00:00:00:02", frame (PEER, HOST, 0x0800)));
+
+    CHECK (accepts ("accept multicast", frame (STP, HOST, 0x0027)));
+    CHECK (accepts ("accept multicast", frame (BCAST, HOST, 0x0806)));
+    CHECK (!accepts ("accept multicast", frame (PEER, HOST, 0x0800)));
+    CHECK (accepts ("accept broadcast", frame (BCAST, HOST, 0x0806)));
+    CHECK (!accepts ("accept broadcast", frame (STP, HOST, 0x0027)));
+    CHECK (!accepts ("accept broadcast", frame ("ff:ff:ff:ff:00:ff", HOST, 0x0027)));
+}
+
+static void testVlan ()
+{
+    Packet stripped = frame (PEER, HOST, 0x0800);
+    stripped.tagPresent = true;
+    stripped.tag = 0x200a; // priority 1, id 10
+
+    CHECK (accepts ("accept vlan 10", frame (PEER, HOST, 0x0800, 10)));
+    CHECK (accepts ("accept vlan 10", stripped));
+    CHECK (!accepts ("accept vlan 10", frame (PEER, HOST, 0x0800, 20)));
+    CHECK (!accepts ("accept vlan 10", frame (PEER, HOST, 0x0800)));
+    CHECK (accepts ("accept vlan any", stripped));
+    CHECK (accepts ("accept vlan any", frame (PEER, HOST, 0x0800, 20)));
+    CHECK (!accepts ("accept vlan any", frame (PEER, HOST, 0x0800)));
+
+    // QinQ outer tag
+    Packet qinq = frame (PEER, HOST, 0x0800, 10);
+    qinq.data[12] = 0x88;
+    qinq.data[13] = 0xa8;
+    CHECK (accepts ("accept vlan 10", qinq));
+    CHECK (accepts ("accept vlan any", qinq));
+}
+
+// the jumps to the end of a negated term are swapped with the ones leaving the rule
+static void testNegation ()
+{
+    const Packet ip  = frame (PEER, HOST, 0x0800);
+    const Packet arp = frame (BCAST, HOST, 0x0806);
+
+    CHECK (!accepts ("accept not type 0x0800", ip));
+    CHECK (accepts ("accept not type 0x0800", arp));
+    CHECK (accepts ("drop not type 0x0800", ip));
+    CHECK (!accepts ("drop not type 0x0800", arp));
+
+    // terms of several instructions, the inner jumps must not be swapped
+    CHECK (accepts ("accept not src 02:00:00:00:00:02", ip));
+    CHECK (!accepts ("accept not src 02:00:00:00:00:01", ip));
+    CHECK (!accepts ("accept not src 02:00:00:00:01:01", frame (PEER, "02:00:00:00:01:01", 0x0800)));
+    CHECK (accepts ("accept not src 02:00:00:00:01:01", frame (PEER, "02:00:00:01:01:01", 0x0800)));
+    CHECK (accepts ("accept not broadcast", frame (STP, HOST, 0x0027)));
+    CHECK (!accepts ("accept not broadcast", arp));
+    CHECK (accepts ("accept not vlan 10", frame (PEER, HOST, 0x0800, 20)));
+    CHECK (accepts ("accept not vlan 10", ip));
+    CHECK (!accepts ("accept not vlan 10", frame (PEER, HOST, 0x0800, 10)));
+    CHECK (!accepts ("accept not vlan any", frame (PEER, HOST, 0x0800, 20)));
+    CHECK (accepts ("accept not vlan any", ip));
+
+    // negated and plain terms mixed in one rule
+    const char* rule = "accept type 0x0800 not dst 02:00:00:00:00:03 not multicast";
+    CHECK (accepts (rule, ip));
+    CHECK (!accepts (rule, frame ("02:00:00:00:00:03", HOST, 0x0800)));
+    CHECK (!accepts (rule, frame (BCAST, HOST, 0x0800)));
+    CHECK (!accepts (rule, frame (PEER, HOST, 0x86dd)));
+}
+
+// the first matching rule decides, a failing term continues with the next rule
+static void testRuleOrder ()
+{
+    const char* rules = "drop dst 01:80:c2:00:00:00, accept vlan 10, accept not multicast";
+    CHECK (!accepts (rules, frame (STP, HOST, 0x0027)));
+    CHECK (!accepts (rules, frame (STP, HOST, 0x0027, 10)));
+    CHECK (accepts (rules, frame (BCAST, HOST, 0x0806, 10)));
+    CHECK (!accepts (rules, frame (BCAST, HOST, 0x0806, 20)));
+    CHECK (accepts (rules, frame (PEER, HOST, 0x0800, 20)));
+    CHECK (accepts (rules, frame (PEER, HOST, 0x0800)));
+
+    CHECK (accepts ("accept type 0x0800 src 02:00:00:00:00:01, drop type 0x0800", frame (PEER, HOST, 0x0800)));
+    CHECK (!accepts ("accept type 0x0800 src 02:00:00:00:00:01, drop type 0x0800", frame (HOST, PEER, 0x0800)));
+}
+
+static void testErrors ()
+{
+    CHECK_THROWS (CaptureFilter::compile ("allow type 0x0800"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept type"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept type, drop multicast"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept type 0x10000"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept type ip"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept vlan 4096"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept src 02:00:00:00:00"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept src 02:00:00:00:00:01:02"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept unicast"), std::invalid_argument);
+    CHECK_THROWS (CaptureFilter::compile ("accept not"), std::invalid_argument);
+
+    // a rule must fit into the 8 bit jumps
+    std::string rule = "accept";
+    for (unsigned n = 0; n < 130; n++)
+        rule += " not multicast";
+    CHECK_THROWS (CaptureFilter::compile (rule), std::invalid_argument);
+
+    // the longest rule is still resolved correctly
+    rule = "accept";
+    for (unsigned n = 0; n < 126; n++)
+        rule += " type 0x0800";
+    CHECK (accepts (rule, frame (PEER, HOST, 0x0800)));
+    CHECK (!accepts (rule, frame (PEER, HOST, 0x0806)));
+}
+
+int main ()
+{
+    testDefaults ();
+    testTerms ();
+    testVlan ();
+    testNegation ();
+    testRuleOrder ();
+    testErrors ();
+    return testResult ();
+}
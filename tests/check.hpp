@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <cstdio>
+
+// Minimal helpers of the unit tests: a failed check is printed and the test
+// continues, main returns the result of testResult().
+
+static unsigned testFailures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            std::fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            testFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(expr, exception) \
+    do { \
+        bool thrown = false; \
+        try \
+        { \
+            (void)(expr); \
+        } \
+        catch (const exception&) \
+        { \
+            thrown = true; \
+        } \
+        if (!thrown) \
+        { \
+            std::fprintf (stderr, "%s:%d: %s not thrown: %s\n", __FILE__, __LINE__, #exception, #expr); \
+            testFailures++; \
+        } \
+    } while (0)
+
+static inline int testResult ()
+{
+    if (testFailures)
+        std::fprintf (stderr, "%u checks failed\n", testFailures);
+    return testFailures ? 1 : 0;
+}
+
+#endif
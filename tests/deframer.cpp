@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+
+#include "deframer.hpp"
+#include "check.hpp"
+
+static const uint32_t MAX_PAYLOAD = 1500;
+
+// Generates the tunnel byte stream: packets of varying length, each payload
+// byte derived from the packet number and its position.
+class Stream
+{
+public:
+    Stream () :
+        m_packet (0),
+        m_offset (0),
+        m_len (0)
+    {
+        start ();
+    }
+
+    void write (uint8_t* p, size_t len)
+    {
+        while (len)
+        {
+            const size_t n = std::min (len, sizeof (TunnelHeader) + m_len - m_offset);
+            std::memcpy (p, m_bytes + m_offset, n);
+            p += n;
+            len -= n;
+            m_offset += n;
+            if (m_offset == m_len + sizeof (TunnelHeader))
+            {
+                m_packet++;
+                start ();
+            }
+        }
+    }
+
+    static uint32_t length (uint32_t packet)
+    {
+        static const uint32_t lengths[] = {1, 7, 64, 1500, 333, 2, 1499, 90, 1024, 8};
+        return lengths[packet % (sizeof (lengths) / sizeof (lengths[0]))];
+    }
+    static uint8_t byte (uint32_t packet, uint32_t i)
+    {
+        return (uint8_t)(packet * 31 + i * 7);
+    }
+
+private:
+    void start ()
+    {
+        m_len = length (m_packet);
+        TunnelHeader::packet (m_bytes, m_len);
+        for (uint32_t i = 0; i < m_len; i++)
+            m_bytes[sizeof (TunnelHeader) + i] = byte (m_packet, i);
+        m_offset = 0;
+    }
+
+    uint32_t m_packet;
+    size_t   m_offset;
+    uint32_t m_len;
+    uint8_t  m_bytes[sizeof (TunnelHeader) + MAX_PAYLOAD];
+};
+
+static bool valid (const TunnelHeader* h, uint32_t packet)
+{
+    if (!h->isPacket () || h->getLength () != Stream::length (packet))
+        return false;
+    for (uint32_t i = 0; i < h->getLength (); i++)
+    {
+        if (h->payload ()[i] != Stream::byte (packet, i))
+            return false;
+    }
+    return true;
+}
+
+// The stream is written in odd chunk sizes and parsed many times around the ring.
+// Packets and writes crossing the end of the buffer must be contiguous, packets not
+// released yet must stay intact.
+static void testWrapAround ()
+{
+    Deframer deframer (4096, MAX_PAYLOAD);
+    CHECK (deframer.size () >= 4096);
+    CHECK (deframer.writable () == deframer.size ());
+
+    static const size_t chunks[] = {1, 3, 8, 13, 700, 1507, 4096, 9, 2000};
+    Stream stream;
+    // packets returned by next() but not released yet
+    std::deque<std::pair<const TunnelHeader*, uint32_t>> held;
+    uint32_t packet = 0;
+    uint64_t parsed = 0;
+    unsigned crossed = 0;
+    unsigned bad = 0;
+
+    for (unsigned i = 0; packet < 20000; i++)
+    {
+        const size_t len = std::min (chunks[i % (sizeof (chunks) / sizeof (chunks[0]))], deframer.writable ());
+        stream.write (deframer.writePtr (), len);
+        deframer.commit (len);
+
+        while (const TunnelHeader* h = deframer.next ())
+        {
+            const size_t packetLen = sizeof (TunnelHeader) + h->getLength ();
+            crossed += parsed % deframer.size () + packetLen > deframer.size ();
+            parsed += packetLen;
+            bad += !valid (h, packet);
+            held.emplace_back (h, packet++);
+        }
+        CHECK (deframer.pending () < sizeof (TunnelHeader) + MAX_PAYLOAD);
+
+        // keep the packets of every other round, so the buffer runs full
+        if (i % 2)
+        {
+            for (const auto& p : held)
+                bad += !valid (p.first, p.second);
+            held.clear ();
+            deframer.release ();
+            CHECK (deframer.writable () == deframer.size () - deframer.pending ());
+        }
+    }
+    CHECK (bad == 0);
+    CHECK (crossed > 100);
+}
+
+static void testPartial ()
+{
+    Deframer deframer (4096, MAX_PAYLOAD);
+    uint8_t packet[sizeof (TunnelHeader) + 10];
+    TunnelHeader::packet (packet, 10);
+    std::memset (packet + sizeof (TunnelHeader), 0x55, 10);
+
+    // the header arrives in pieces, then the payload
+    for (size_t i = 0; i < sizeof (packet); i++)
+    {
+        CHECK (deframer.next () == nullptr);
+        CHECK (deframer.pending () == i);
+        *deframer.writePtr () = packet[i];
+        deframer.commit (1);
+    }
+    const TunnelHeader* h = deframer.next ();
+    CHECK (h && h->getLength () == 10 && h->payload ()[9] == 0x55);
+    CHECK (deframer.next () == nullptr);
+    CHECK (deframer.pending () == 0);
+    CHECK (deframer.writable () == deframer.size () - sizeof (packet));
+    deframer.release ();
+    CHECK (deframer.writable () == deframer.size ());
+}
+
+static void testTooLong ()
+{
+    Deframer deframer (4096, MAX_PAYLOAD);
+    TunnelHeader::packet (deframer.writePtr (), MAX_PAYLOAD + 1);
+    deframer.commit (sizeof (TunnelHeader));
+    CHECK_THROWS (deframer.next (), std::length_error);
+}
+
+int main ()
+{
+    testWrapAround ();
+    testPartial ();
+    testTooLong ();
+    return testResult ();
+}
@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "fqcodel.hpp"
+#include "flowhash.hpp"
+#include "check.hpp"
+
+static const size_t FRAME_LEN = 1000;
+
+class Test
+{
+public:
+    explicit Test (const FqCodelConfig& config) :
+        m_queue (config),
+        m_flows (config.flows)
+    {
+        FramePoolConfig poolConfig;
+        poolConfig.count = 256;
+        m_pool = FramePool::create (poolConfig);
+    }
+
+    // frame id of flow (the last byte of the source MAC address)
+    void enqueue (uint8_t flow, uint32_t id, uint64_t now)
+    {
+        FrameRef ref = m_pool->alloc ();
+        CHECK (ref);
+        uint8_t* p = ref.buffer ();
+        std::memset (p, 0, FRAME_LEN);
+        p[0]  = 2;
+        p[6]  = 2;
+        p[11] = flow;
+        p[12] = 0x88;
+        p[13] = 0xb5;
+        std::memcpy (p + 14, &id, sizeof (id));
+        ref.setFrame (0, FRAME_LEN);
+        m_queue.enqueue (std::move (ref), now);
+    }
+
+    // ids of the frames taken
+    std::vector<uint32_t> dequeue (size_t count, uint64_t now)
+    {
+        FrameRef refs[256];
+        const size_t n = m_queue.dequeue (refs, count, SIZE_MAX, now);
+        std::vector<uint32_t> ids;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t id;
+            std::memcpy (&id, refs[i].frame ().data + 14, sizeof (id));
+            ids.push_back (id);
+        }
+        return ids;
+    }
+
+    // the flows must use different queues
+    bool separate (uint8_t a, uint8_t b) const
+    {
+        return queue (a) != queue (b);
+    }
+
+    FqCodel& queue ()
+    {
+        return m_queue;
+    }
+
+private:
+    size_t queue (uint8_t flow) const
+    {
+        uint8_t p[14] = {2, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, flow, 0x88, 0xb5};
+        return flowHash (p, sizeof (p)) % m_flows;
+    }
+
+    std::unique_ptr<FramePool> m_pool;
+    FqCodel m_queue;
+    unsigned m_flows;
+};
+
+static FqCodelConfig config ()
+{
+    FqCodelConfig c;
+    c.target   = 5000;
+    c.interval = 100000;
+    c.limit    = 64;
+    c.quantum  = 1514;
+    c.mtu      = 1514;
+    return c;
+}
+
+typedef std::vector<uint32_t> Ids;
+
+// RFC 8289: the delay must stay above target for an interval, then the drop
+// rate increases with the square root of the drops
+static void testCodel ()
+{
+    Test t (config ());
+    for (uint32_t id = 0; id < 20; id++)
+        t.enqueue (1, id, 0);
+
+    CHECK (t.dequeue (1, 10000) == Ids {0});    // above target from now on
+    CHECK (t.dequeue (1, 50000) == Ids {1});    // not for an interval yet
+    CHECK (t.dequeue (1, 110000) == Ids {3});   // first drop, the next one after an interval
+    CHECK (t.dequeue (1, 150000) == Ids {4});
+    CHECK (t.dequeue (1, 209999) == Ids {5});
+    CHECK (t.dequeue (1, 210000) == Ids {7});   // interval / sqrt (2) until the next drop
+    CHECK (t.dequeue (1, 280709) == Ids {8});
+    CHECK (t.dequeue (1, 280710) == Ids {10});
+    CHECK (t.queue ().size () == 9);
+
+    // the queue runs empty, which ends the dropping state
+    CHECK (t.dequeue (64, 290000).size () == 9);
+    CHECK (t.queue ().empty ());
+    for (uint32_t id = 100; id < 110; id++)
+        t.enqueue (1, id, 300000);
+    CHECK (t.dequeue (64, 304999).size () == 10);
+}
+
+// a delay below target never causes drops
+static void testBelowTarget ()
+{
+    Test t (config ());
+    for (uint32_t round = 0; round < 100; round++)
+    {
+        const uint64_t now = round * 50000;
+        for (uint32_t id = 0; id < 10; id++)
+            t.enqueue (1, id, now);
+        CHECK (t.dequeue (64, now + 4999).size () == 10);
+    }
+}
+
+// a flow whose backlog fits into a single frame isn't dropped from, however long it waits
+static void testSingleFrame ()
+{
+    Test t (config ());
+    t.enqueue (1, 0, 0);
+    t.enqueue (1, 1, 0);
+    CHECK (t.dequeue (1, 10000) == Ids {0});
+    CHECK (t.dequeue (1, 1000000) == Ids {1});
+
+    for (uint32_t id = 10; id < 20; id++)
+    {
+        t.enqueue (1, id, 2000000 + id * 200000);
+        CHECK (t.dequeue (1, 2000000 + id * 200000 + 150000) == Ids {id});
+    }
+}
+
+// at the limit, the oldest frame of the longest flow is dropped
+static void testLimit ()
+{
+    FqCodelConfig c = config ();
+    c.limit = 8;
+    Test t (c);
+    CHECK (t.separate (1, 2));
+
+    for (uint32_t id = 0; id < 6; id++)
+        t.enqueue (1, id, 0);
+    t.enqueue (2, 10, 0);
+    t.enqueue (2, 11, 0);
+    t.enqueue (1, 6, 0);
+    t.enqueue (2, 12, 0);
+    CHECK (t.queue ().size () == 8);
+
+    Ids ids = t.dequeue (64, 1);
+    std::sort (ids.begin (), ids.end ());
+    CHECK ((ids == Ids {2, 3, 4, 5, 6, 10, 11, 12}));
+}
+
+// flows get turns of a quantum, new flows go first
+static void testFairness ()
+{
+    Test t (config ());
+    CHECK (t.separate (1, 2) && t.separate (1, 3) && t.separate (2, 3));
+
+    for (uint32_t id = 0; id < 10; id++)
+        t.enqueue (1, id, 0);
+    for (uint32_t id = 100; id < 110; id++)
+        t.enqueue (2, id, 0);
+    CHECK ((t.dequeue (8, 1) == Ids {0, 1, 100, 101, 2, 3, 102, 103}));
+
+    t.enqueue (3, 200, 1);
+    CHECK ((t.dequeue (2, 2) == Ids {200, 4}));
+}
+
+int main ()
+{
+    testCodel ();
+    testBelowTarget ();
+    testSingleFrame ();
+    testLimit ();
+    testFairness ();
+    return testResult ();
+}
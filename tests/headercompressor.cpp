@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "headercompressor.hpp"
+#include "tunnel.hpp"
+#include "check.hpp"
+
+typedef std::vector<uint8_t> Bytes;
+
+static void put16 (uint8_t* p, uint16_t value)
+{
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static uint16_t checksum (const uint8_t* p, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t n = 0; n + 1 < len; n += 2)
+        sum += (uint32_t)(p[n] << 8 | p[n + 1]);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+struct Flow
+{
+    uint8_t  host = 1;     // last byte of the source MAC and IP address
+    uint8_t  proto = 17;   // 0: not IPv4
+    uint16_t port = 1000;
+    bool     vlan = false;
+    size_t   options = 0;  // bytes of IP options
+};
+
+// a valid frame of the flow, only identification and payload vary
+static Bytes frame (const Flow& f, uint16_t id, size_t payload)
+{
+    Bytes b (12);
+    const uint8_t macs[12] = {2, 0, 0, 0, 0, 0xee, 2, 0, 0, 0, 0, f.host};
+    std::memcpy (b.data (), macs, 12);
+    if (f.vlan)
+        b.insert (b.end (), {0x81, 0x00, 0x00, 0x0a});
+    if (!f.proto)
+    {
+        b.insert (b.end (), {0x88, 0xb5});
+        for (size_t n = 0; n < payload; n++)
+            b.push_back ((uint8_t)(n * 7 + id));
+        return b;
+    }
+    b.insert (b.end (), {0x08, 0x00});
+
+    const size_t ip = b.size ();
+    const size_t ihl = 20 + f.options;
+    const size_t l4 = f.proto == 17 ? 8 : 0;
+    b.resize (ip + ihl + l4);
+    b[ip] = (uint8_t)(0x40 | ihl / 4);
+    put16 (&b[ip + 2], (uint16_t)(ihl + l4 + payload));
+    put16 (&b[ip + 4], id);
+    b[ip + 8]  = 64;
+    b[ip + 9]  = f.proto;
+    const uint8_t addrs[8] = {10, 0, 0, f.host, 10, 0, 0, 0xee};
+    std::memcpy (&b[ip + 12], addrs, 8);
+    for (size_t n = 0; n < f.options; n++)
+        b[ip + 20 + n] = 1; // NOP
+    put16 (&b[ip + 10], checksum (&b[ip], ihl));
+    if (f.proto == 17)
+    {
+        put16 (&b[ip + ihl], f.port);
+        put16 (&b[ip + ihl + 2], 53);
+        put16 (&b[ip + ihl + 4], (uint16_t)(8 + payload));
+        put16 (&b[ip + ihl + 6], (uint16_t)(0xbeef ^ id)); // not verified, just carried
+    }
+    for (size_t n = 0; n < payload; n++)
+        b.push_back ((uint8_t)(n * 7 + id));
+    return b;
+}
+
+// PACKED packet of the frames and its payload
+static Bytes pack (HeaderCompressor& c, const std::vector<Bytes>& frames)
+{
+    for (const Bytes& f : frames)
+        CHECK (c.add (f.data (), f.size ()));
+    size_t len;
+    const uint8_t* packet = c.finish (len);
+    const TunnelHeader* h = (const TunnelHeader*)packet;
+    CHECK (h->getType () == Type::PACKED);
+    CHECK (h->getLength () == len - sizeof (TunnelHeader));
+    return Bytes (packet + sizeof (TunnelHeader), packet + len);
+}
+
+static bool restores (HeaderDecompressor& d, const Bytes& payload, const std::vector<Bytes>& frames)
+{
+    const std::vector<Frame>& out = d.decompress (payload.data (), payload.size ());
+    if (out.size () != frames.size ())
+        return false;
+    for (size_t n = 0; n < frames.size (); n++)
+    {
+        if (out[n].len != frames[n].size () || std::memcmp (out[n].data, frames[n].data (), frames[n].size ()))
+            return false;
+    }
+    return true;
+}
+
+static void testRoundTrip ()
+{
+    HeaderCompressor c;
+    HeaderDecompressor d;
+
+    Flow udp, tcp, vlan, options, other;
+    tcp.host = 2;
+    tcp.proto = 6;
+    vlan.host = 3;
+    vlan.vlan = true;
+    options.host = 4;
+    options.options = 8;
+    other.host = 5;
+    other.proto = 0;
+
+    // the first packet defines the contexts, the later ones use them
+    for (uint16_t round = 0; round < 4; round++)
+    {
+        std::vector<Bytes> frames;
+        for (const Flow* f : {&udp, &tcp, &vlan, &options, &other})
+        {
+            frames.push_back (frame (*f, (uint16_t)(100 + round), 10 + round));
+            frames.push_back (frame (*f, (uint16_t)(101 + round), 0));
+        }
+        // not compressible: too short, wrong IP checksum, padded
+        frames.push_back (Bytes (10, 0x55));
+        Bytes bad = frame (udp, 7, 20);
+        bad[14 + 10] ^= 1;
+        frames.push_back (bad);
+        Bytes padded = frame (udp, 8, 4);
+        padded.resize (60);
+        frames.push_back (padded);
+
+        const Bytes payload = pack (c, frames);
+        CHECK (restores (d, payload, frames));
+    }
+}
+
+// the identification may jump in both directions and wrap
+static void testIdentification ()
+{
+    HeaderCompressor c;
+    HeaderDecompressor d;
+    Flow f;
+    std::vector<Bytes> frames;
+    for (uint16_t id : {0xfffe, 0xffff, 0x0000, 0x0001, 0x8000, 0x0002, 0x7fff, 0x7fff, 0x1234})
+        frames.push_back (frame (f, id, 32));
+    const Bytes payload = pack (c, frames);
+    CHECK (restores (d, payload, frames));
+
+    // later frames of a flow only carry the context, the fields and the payload
+    size_t raw = 0;
+    for (const Bytes& b : frames)
+        raw += b.size ();
+    CHECK (payload.size () < raw - (frames.size () - 1) * 30);
+}
+
+// More flows than contexts: they are replaced round robin, id 127 is never
+// used, because it marks a raw frame.
+static void testContexts ()
+{
+    HeaderCompressor c;
+    HeaderDecompressor d;
+
+    const unsigned FLOWS = 3 * HeaderCompressor::CONTEXTS;
+    for (unsigned n = 0; n < FLOWS; n++)
+    {
+        Flow f;
+        f.host = (uint8_t)n;
+        f.port = (uint16_t)(n / 256);
+        const std::vector<Bytes> frames = {frame (f, 1, 16), frame (f, 2, 16)};
+        const Bytes payload = pack (c, frames);
+        // FULL | context id, then a reference to it
+        CHECK (payload[0] == (0x80 | n % HeaderCompressor::CONTEXTS));
+        CHECK (payload[0] != 0xff);
+        CHECK (restores (d, payload, frames));
+    }
+
+    // a flow whose context was replaced defines it again
+    Flow f;
+    f.host = 0;
+    const std::vector<Bytes> frames = {frame (f, 3, 16)};
+    const Bytes payload = pack (c, frames);
+    CHECK (payload[0] & 0x80);
+    CHECK (restores (d, payload, frames));
+}
+
+static void testInvalid ()
+{
+    // a raw frame
+    {
+        HeaderDecompressor d;
+        const Bytes raw = {0x7f, 3, 1, 2, 3};
+        const std::vector<Frame>& out = d.decompress (raw.data (), raw.size ());
+        CHECK (out.size () == 1 && out[0].len == 3 && out[0].data[2] == 3);
+    }
+    // 127 with the FULL bit isn't a context
+    {
+        HeaderDecompressor d;
+        Bytes full = {0xff, 0, 14};
+        full.insert (full.end (), 14, 0);
+        full.push_back (0);
+        CHECK_THROWS (d.decompress (full.data (), full.size ()), std::runtime_error);
+    }
+    // reference to a context which was never defined
+    {
+        HeaderDecompressor d;
+        const Bytes ref = {0x05, 0};
+        CHECK_THROWS (d.decompress (ref.data (), ref.size ()), std::runtime_error);
+    }
+    // header length doesn't match the kind
+    {
+        HeaderDecompressor d;
+        Bytes full = {0x80, 2, 20};
+        full.insert (full.end (), 20, 0);
+        full.push_back (0);
+        CHECK_THROWS (d.decompress (full.data (), full.size ()), std::runtime_error);
+    }
+    // every truncation of a record is detected
+    {
+        HeaderCompressor c;
+        Flow f;
+        const Bytes full = pack (c, {frame (f, 1, 8)});
+        const Bytes ref  = pack (c, {frame (f, 2, 8)});
+        for (size_t len = 1; len < full.size (); len++)
+        {
+            HeaderDecompressor d;
+            CHECK_THROWS (d.decompress (full.data (), len), std::runtime_error);
+        }
+        for (size_t len = 1; len < ref.size (); len++)
+        {
+            HeaderDecompressor d;
+            d.decompress (full.data (), full.size ());
+            CHECK_THROWS (d.decompress (ref.data (), len), std::runtime_error);
+        }
+    }
+}
+
+int main ()
+{
+    testRoundTrip ();
+    testIdentification ();
+    testContexts ();
+    testInvalid ();
+    return testResult ();
+}
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * l2tunnel <https://github.com/amartin755/l2tunnel>
+ * Copyright (C) 2024 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <barrier>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "mactable.hpp"
+#include "check.hpp"
+
+struct Mac
+{
+    uint8_t b[6];
+};
+
+static Mac mac (uint32_t n)
+{
+    return Mac {{2, 0, (uint8_t)(n >> 24), (uint8_t)(n >> 16), (uint8_t)(n >> 8), (uint8_t)n}};
+}
+
+static MacTableConfig config (size_t size)
+{
+    MacTableConfig c;
+    c.size  = size;
+    c.aging = 300;
+    return c;
+}
+
+static void testLearn ()
+{
+    MacTable table (config (1024));
+    const uint64_t now = MacTable::now ();
+    const Mac a = mac (1), b = mac (2), c = mac (3);
+
+    CHECK (table.lookup (a.b, now) == MacTable::UNKNOWN);
+    table.learn (a.b, MacTable::LOCAL, now);
+    table.learn (b.b, MacTable::REMOTE, now);
+    CHECK (table.lookup (a.b, now) == MacTable::LOCAL);
+    CHECK (table.lookup (b.b, now) == MacTable::REMOTE);
+    CHECK (table.lookup (c.b, now) == MacTable::UNKNOWN);
+
+    // a station moved to the other side
+    table.learn (a.b, MacTable::REMOTE, now + 1);
+    table.learn (b.b, MacTable::LOCAL, now + 1);
+    CHECK (table.lookup (a.b, now + 1) == MacTable::REMOTE);
+    CHECK (table.lookup (b.b, now + 1) == MacTable::LOCAL);
+
+    // group addresses are never learned
+    const Mac group = {{3, 0, 0, 0, 0, 1}};
+    CHECK (!MacTable::isUnicast (group.b));
+    CHECK (MacTable::isUnicast (a.b));
+    table.learn (group.b, MacTable::LOCAL, now);
+    CHECK (table.lookup (group.b, now) == MacTable::UNKNOWN);
+}
+
+static void testAging ()
+{
+    MacTable table (config (1024));
+    const uint64_t now = MacTable::now ();
+    const Mac a = mac (1), b = mac (2);
+
+    table.learn (a.b, MacTable::LOCAL, now);
+    CHECK (table.lookup (a.b, now + 300) == MacTable::LOCAL);
+    CHECK (table.lookup (a.b, now + 301) == MacTable::UNKNOWN);
+
+    // refreshed entries survive the expiry
+    table.learn (b.b, MacTable::REMOTE, now + 200);
+    table.expire (now + 299);
+    CHECK (table.lookup (a.b, now) == MacTable::LOCAL);
+    table.expire (now + 301);
+    CHECK (table.lookup (a.b, now) == MacTable::UNKNOWN);
+    CHECK (table.lookup (b.b, now + 301) == MacTable::REMOTE);
+
+    // after a wrap of the 16 bit time stamps everything is gone
+    table.expire (now + 70000);
+    CHECK (table.lookup (b.b, now + 200) == MacTable::UNKNOWN);
+}
+
+// a full bucket replaces its oldest entry
+static void testEviction ()
+{
+    // two buckets of eight entries
+    MacTable table (config (16));
+    const uint64_t now = MacTable::now ();
+    const Mac kept = mac (1000);
+
+    for (uint32_t n = 0; n < 64; n++)
+    {
+        const Mac m = mac (n);
+        table.learn (m.b, MacTable::LOCAL, now + n);
+        table.learn (kept.b, MacTable::REMOTE, now + n);
+    }
+    unsigned found = 0;
+    for (uint32_t n = 0; n < 64; n++)
+    {
+        const Mac m = mac (n);
+        found += table.lookup (m.b, now + 64) == MacTable::LOCAL;
+    }
+    CHECK (found == 15);
+    CHECK (table.lookup (kept.b, now + 64) == MacTable::REMOTE);
+    const Mac last = mac (63);
+    CHECK (table.lookup (last.b, now + 64) == MacTable::LOCAL);
+}
+
+// bucket of an address in a table of two buckets, computed like MacTable::bucket
+static unsigned bucket (const Mac& m)
+{
+    uint64_t key = 0;
+    for (uint8_t b : m.b)
+        key = key << 8 | b;
+    return (unsigned)((key * 0x9e3779b97f4a7c15ull) >> 63);
+}
+
+// Receiver and sender learn the same new addresses at the same time. If an address
+// got two entries, the eight addresses of one bucket wouldn't fit anymore.
+static void testConcurrentInsert ()
+{
+    std::vector<Mac> macs;
+    for (uint32_t n = 0; macs.size () < 8; n++)
+    {
+        if (!bucket (mac (n)))
+            macs.push_back (mac (n));
+    }
+
+    const unsigned rounds = 20000;
+    const uint64_t now = MacTable::now ();
+    std::unique_ptr<MacTable> table;
+    std::barrier sync (3);
+
+    auto learner = [&] (MacTable::Location where)
+    {
+        for (unsigned r = 0; r < rounds; r++)
+        {
+            sync.arrive_and_wait ();
+            for (const Mac& m : macs)
+                table->learn (m.b, where, now);
+            sync.arrive_and_wait ();
+        }
+    };
+    std::thread local (learner, MacTable::LOCAL);
+    std::thread remote (learner, MacTable::REMOTE);
+
+    unsigned lost = 0;
+    for (unsigned r = 0; r < rounds; r++)
+    {
+        table.reset (new MacTable (config (16)));
+        sync.arrive_and_wait ();
+        sync.arrive_and_wait ();
+        for (const Mac& m : macs)
+            lost += table->lookup (m.b, now) == MacTable::UNKNOWN;
+    }
+    local.join ();
+    remote.join ();
+    CHECK (lost == 0);
+}
+
+int main ()
+{
+    testLearn ();
+    testAging ();
+    testEviction ();
+    testConcurrentInsert ();
+    return testResult ();
+}